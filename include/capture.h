@@ -0,0 +1,124 @@
+/**
+ * @file capture.h
+ * @brief Shared per-mux tuner captures with a warm linger period
+ *
+ * A capture is one dvbv5-zap process tuned to a frequency. A reader
+ * thread copies its output into a ring of whole TS packets, and any
+ * number of viewers read from that ring, each at its own position.
+ * Because zap runs with -P the ring carries the whole mux, so viewers
+ * of any channel on that frequency share one capture.
+ *
+ * When the last viewer leaves, the tuner is not released straight
+ * away. It lingers (USER_LINGER) with zap still running for
+ * stream_linger_secs. A request for any channel on the mux in that
+ * window attaches instantly, without a new zap spawn or frontend lock.
+ * This matters for players that probe a stream, close it and reopen it.
+ * A lingering tuner is the first one acquire_tuner() reclaims when EPG
+ * or another stream needs a tuner and none is idle.
+ *
+ * The reader also tracks the mux's PAT, each program's PMT and the
+ * ring offset of the newest keyframe on each program's video PID. That
+ * is an MPEG-2 sequence header, or an H.264/HEVC parameter set or IDR.
+ * A viewer joining a running capture gets the PAT and PMT as they
+ * stood just before that keyframe. It then reads the ring from the
+ * keyframe onwards, so the player can show a picture at once instead
+ * of waiting for the next PAT, PMT and I-frame. The cached PSI packets
+ * are the last ones before the keyframe, so continuity counters stay
+ * intact.
+ *
+ * With timeshift enabled (timeshift.h), a spill thread copies the ring
+ * to disk. A viewer that pauses or rewinds further back than the ring
+ * then reads from the file at the same absolute offsets.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "channels.h"
+#include "stream_trace.h"
+
+/** Ring per capture; a viewer further behind than this skips ahead */
+#define CAPTURE_RING_BYTES (188 * 7 * 3072)
+
+/** Programs per mux whose PMT and keyframes are tracked */
+#define CAPTURE_MAX_PROGRAMS 16
+
+/** Seconds an unwatched capture stays tuned (0 = release at once) */
+extern int stream_linger_secs;
+
+typedef struct Capture Capture;
+
+/**
+ * Why capture_open() failed
+ */
+typedef enum {
+    CAPTURE_OK,
+    CAPTURE_NO_TUNER,       /**< Every tuner busy (after retries) */
+    CAPTURE_SPAWN_FAILED    /**< pipe/fork/exec of dvbv5-zap failed */
+} CaptureError;
+
+/**
+ * One viewer's read position in a capture
+ */
+typedef struct {
+    Capture *cap;
+    uint64_t pos;           /**< Absolute ring offset of the next byte */
+    uint64_t overruns;      /**< Times the viewer fell a ring behind */
+    int tuner_id;           /**< Adapter number */
+    int tuner_index;        /**< Index into tuners[] */
+    int warm;               /**< Attached to an already running capture */
+    unsigned char prefix[2 * 188]; /**< Cached PAT+PMT sent before ring data */
+    int prefix_len;
+    int prefix_sent;
+    uint64_t limit;         /**< Stop before this offset (0 = follow live) */
+} CaptureViewer;
+
+/**
+ * Attach a viewer to the capture for a channel's mux
+ * Reuses a running or lingering capture on the same frequency, otherwise
+ * acquires a tuner (retrying for a few seconds) and spawns dvbv5-zap.
+ * Marks the tuner/spawn phases on the trace.
+ * @param chan Channel to watch
+ * @param tr   Startup trace of the request
+ * @param err  Receives the failure reason (may be NULL)
+ * @return New viewer (caller must capture_close()), or NULL on failure
+ */
+CaptureViewer *capture_open(const Channel *chan, StreamTrace *tr, CaptureError *err);
+
+/**
+ * Read live TS from the capture, blocking until data is available
+ * Always returns whole 188-byte packets when len is a multiple of 188.
+ * @return Bytes read, or 0 once the capture has ended
+ */
+ssize_t capture_read(CaptureViewer *v, unsigned char *buf, size_t len);
+
+/**
+ * Absolute offsets a viewer can seek to: [start, end)
+ * Covers the memory ring and, with timeshift, the spill file.
+ */
+void capture_window(CaptureViewer *v, uint64_t *start, uint64_t *end);
+
+/**
+ * Move a viewer about `seconds` behind live (needs timeshift)
+ * @return 1 if moved, 0 if there is no timeshift index
+ */
+int capture_seek_time(CaptureViewer *v, double seconds);
+
+/**
+ * Serve bytes [start, end) of the capture, then end the stream
+ * Both ends are rounded down to whole packets (at least one is served),
+ * and end is clamped to the live edge; the adjusted range is left in
+ * v->pos and v->limit.
+ * @return 1 if moved, 0 if start is outside capture_window()
+ */
+int capture_seek_range(CaptureViewer *v, uint64_t start, uint64_t end);
+
+/**
+ * Detach a viewer; the last one starts the linger period
+ */
+void capture_close(CaptureViewer *v);
+
+#endif
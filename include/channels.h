@@ -1,80 +1,134 @@
 /**
  * @file channels.h
  * @brief Channel management for DVB/ATSC tuning
- * 
+ *
  * Handles loading and querying channel information from channels.conf.
  * Each channel maps a virtual channel number (e.g., "15.1") to its
  * physical frequency and service ID for tuning.
+ *
+ * The loaded lineup is published as an immutable, reference-counted
+ * ChannelTable snapshot. Readers pin the current snapshot with
+ * channels_acquire() (no locks) and drop it with channels_release().
+ * A reload builds a new table and swaps it in atomically; the old one
+ * is freed once its last reader lets go.
  */
 
 #ifndef CHANNELS_H
 #define CHANNELS_H
 
 #include <sys/types.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include "config.h"
 
 /**
  * Represents a single broadcast channel
- * 
+ *
  * @field name       Station call sign (e.g., "WANE-HD")
  * @field service_id DVB service ID for this program
  * @field frequency  RF frequency in Hz (e.g., "581000000")
  * @field number     Virtual channel number (e.g., "15.1")
+ *
+ * Integer forms and the XMLTV unique ID are filled in once by
+ * load_channels() so lookups never reparse the strings.
  */
 typedef struct {
     char name[64];
     char service_id[32];
     char frequency[32];
     char number[32];
+    uint32_t freq_hz;     /**< frequency as an integer (Hz) */
+    int sid;              /**< service_id as an integer */
+    int major;            /**< Major part of number */
+    int minor;            /**< Minor part of number */
+    char unique_id[48];   /**< XMLTV channel ID, see get_unique_channel_id() */
 } Channel;
 
-/** Global array of loaded channels */
-extern Channel channels[MAX_CHANNELS];
-
-/** Number of channels currently loaded */
-extern int channel_count;
+/**
+ * Immutable channel lineup snapshot
+ * Never modified after publication; Channel pointers obtained from a
+ * table stay valid until that table is released.
+ */
+typedef struct {
+    atomic_int refs;        /**< Reader references + 1 while published */
+    int count;              /**< Number of channels */
+    Channel *channels;      /**< Channels sorted by major.minor */
+    int hash_mask;          /**< Bucket count - 1 (power of two) */
+    int *number_buckets;    /**< Chain heads by number hash */
+    int *number_next;       /**< Chain links, -1 terminates */
+    int *freq_sid_buckets;  /**< Chain heads by frequency+service_id hash */
+    int *freq_sid_next;     /**< Chain links, -1 terminates */
+} ChannelTable;
 
 /** Path to channels.conf file (may be overridden at runtime) */
 extern char channels_conf_path[512];
 
 /**
- * Load channels from a DVB channels.conf file
+ * Load channels from a DVB channels.conf file and publish them
+ * Replaces the current snapshot; existing readers keep the old one.
  * @param filename Path to the channels.conf file
- * @return Number of channels loaded, or -1 on error
+ * @return Number of channels loaded, or -1 on error (current lineup kept)
  */
 int load_channels(const char *filename);
 
+/**
+ * Reload channels_conf_path and publish the result
+ * @return Number of channels loaded, or -1 on error (current lineup kept)
+ */
+int channels_reload();
+
+/**
+ * Watch channels_conf_path with inotify and reload on change
+ * Starts a detached background thread.
+ */
+void channels_watch_start();
+
+/**
+ * Pin the current channel snapshot (never blocks)
+ * @return Current table; never NULL once load_channels() has run
+ */
+ChannelTable *channels_acquire();
+
+/**
+ * Drop a reference obtained from channels_acquire()
+ */
+void channels_release(ChannelTable *t);
+
 /**
  * Find a channel by its virtual channel number
+ * @param t      Pinned channel snapshot
  * @param number Virtual channel number (e.g., "15.1")
  * @return Pointer to Channel, or NULL if not found
  */
-Channel *find_channel_by_number(const char *number);
+Channel *find_channel_by_number(const ChannelTable *t, const char *number);
 
 /**
  * Find a channel by frequency and service ID
  * Used for accurate EPG mapping when source_id alone is ambiguous
- * @param freq     Frequency string (e.g., "581000000")
+ * @param t          Pinned channel snapshot
+ * @param freq_hz    Frequency in Hz
  * @param service_id DVB service ID
  * @return Pointer to Channel, or NULL if not found
  */
-Channel *find_channel_by_freq_sid(const char *freq, int service_id);
+Channel *find_channel_by_freq_sid(const ChannelTable *t, uint32_t freq_hz, int service_id);
 
 /**
- * Check if a virtual channel number exists on multiple frequencies
- * This can happen when receiving stations from different markets
- * @param number Virtual channel number to check
- * @return 1 if duplicated, 0 if unique
+ * Find a channel by frequency and virtual channel number
+ * Distinguishes channels whose VCN is duplicated across markets
+ * @param t       Pinned channel snapshot
+ * @param freq_hz Frequency in Hz
+ * @param number  Virtual channel number (e.g., "15.1")
+ * @return Pointer to Channel, or NULL if not found
  */
-int is_vcn_duplicated(const char *number);
+Channel *find_channel_by_freq_number(const ChannelTable *t, uint32_t freq_hz, const char *number);
 
 /**
  * Get a unique channel ID for XMLTV output
  * Returns simple format ("16.1") normally, or with MHz suffix ("16.1-527")
  * if the same VCN exists on multiple frequencies
  * @param ch Pointer to Channel
- * @return Static string with unique channel ID
+ * @return Unique channel ID, precomputed at load time (owned by the channel)
  */
-const char *get_unique_channel_id(Channel *ch);
+const char *get_unique_channel_id(const Channel *ch);
 
 #endif
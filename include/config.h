@@ -19,10 +19,103 @@
 /** Default path to SQLite EPG database */
 #define DB_PATH "epg.db"
 
+/** How long a database writer waits for another connection's lock */
+#ifndef DB_BUSY_TIMEOUT_MS
+#define DB_BUSY_TIMEOUT_MS 5000
+#endif
+
 /** Maximum number of DVB tuner adapters supported */
 #define MAX_TUNERS 16
 
-/** Maximum number of channels that can be loaded */
-#define MAX_CHANNELS 200
+/**
+ * Default EPG guide depth in EIT/ETT instances (3 hours each)
+ * 8 = 24 hours, 128 = full 16-day ATSC horizon
+ */
+#ifndef EPG_GUIDE_DEPTH
+#define EPG_GUIDE_DEPTH 8
+#endif
+
+/** Maximum EIT/ETT instances defined by ATSC A/65 */
+#define EPG_MAX_GUIDE_DEPTH 128
+
+/** Directory for timeshift spill files (deleted on creation, see timeshift.h) */
+#ifndef TIMESHIFT_DIR
+#define TIMESHIFT_DIR "."
+#endif
+
+/** Timeshift file bytes per second of window: the full 19.39 Mbps ATSC rate */
+#define TIMESHIFT_BYTES_PER_SEC 2424832
+
+/** Directory for DVR recordings */
+#ifndef RECORDINGS_DIR
+#define RECORDINGS_DIR "recordings"
+#endif
+
+/**
+ * Recording bytes per second preallocated up front: about one HD program
+ * (10 Mbps), since recordings hold a single program, not the whole mux
+ */
+#ifndef DVR_BYTES_PER_SEC
+#define DVR_BYTES_PER_SEC 1250000
+#endif
+
+/** Seconds recorded before a program's start and after its end */
+#ifndef DVR_PADDING_SECS
+#define DVR_PADDING_SECS 60
+#endif
+
+/** Default seconds a tuner stays on its mux after the last viewer leaves */
+#ifndef STREAM_LINGER_SECS
+#define STREAM_LINGER_SECS 30
+#endif
+
+/** Socket send buffer for ?profile=latency streams (small: less queued delay) */
+#ifndef STREAM_SNDBUF_LATENCY
+#define STREAM_SNDBUF_LATENCY (128 * 1024)
+#endif
+
+/** Socket send buffer for ?profile=throughput streams */
+#ifndef STREAM_SNDBUF_THROUGHPUT
+#define STREAM_SNDBUF_THROUGHPUT (1024 * 1024)
+#endif
+
+/** Batch size for ?profile=throughput streams, in whole 7-packet groups */
+#define STREAM_BATCH_BYTES (188 * 7 * 48)
+
+/** Longest a throughput batch is held before it is sent anyway */
+#ifndef STREAM_BATCH_MAX_MS
+#define STREAM_BATCH_MAX_MS 100
+#endif
+
+/** Default jitter buffer of ?pace=1 streams, in milliseconds (see pacer.h) */
+#ifndef PACE_JITTER_MS
+#define PACE_JITTER_MS 200
+#endif
+
+/** Multicast groups of -M channels: the /16 of this base plus major.minor (see mcast.h) */
+#ifndef MCAST_GROUP_BASE
+#define MCAST_GROUP_BASE "239.255.0.0"
+#endif
+
+/** UDP port of multicast channels (the RTP/AVP default) */
+#ifndef MCAST_PORT
+#define MCAST_PORT 5004
+#endif
+
+/** Hop limit of multicast datagrams; 1 keeps them on the LAN */
+#ifndef MCAST_TTL
+#define MCAST_TTL 1
+#endif
+
+/** Seconds a multicast channel runs after its last IGMP report or request
+ *  (IGMP Group Membership Interval) */
+#ifndef MCAST_IDLE_SECS
+#define MCAST_IDLE_SECS 260
+#endif
+
+/** Interval of our own IGMP queries when no router queries the LAN */
+#ifndef MCAST_QUERY_SECS
+#define MCAST_QUERY_SECS 125
+#endif
 
 #endif
@@ -0,0 +1,23 @@
+/**
+ * @file crc32.h
+ * @brief MPEG-2 CRC32 of PSI sections
+ *
+ * The CRC-32/MPEG-2 used by every long-form PSI/PSIP section (ISO
+ * 13818-1 Annex A): polynomial 0x04C11DB7, initial value 0xFFFFFFFF, no
+ * reflection, no final XOR.
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * CRC of a byte range
+ * Over a whole section including its CRC_32 field the result is zero
+ * when the section is intact.
+ */
+uint32_t crc32_mpeg(const unsigned char *data, size_t len);
+
+#endif
@@ -10,12 +10,34 @@
 #ifndef DB_H
 #define DB_H
 
+/**
+ * A scheduled or finished recording (see dvr.h)
+ */
+typedef struct {
+    int id;
+    char frequency[32];
+    char channel[32];          /**< Virtual channel number "X.Y" */
+    long long start_time;      /**< Program start, ms since epoch */
+    long long end_time;        /**< Program end, ms since epoch */
+    char title[128];           /**< First language variant of the title */
+    char status[16];           /**< scheduled, recording, done, failed, missed */
+    char path[512];            /**< File, once recording has started */
+    long long bytes;           /**< Bytes durably written */
+} DbRecording;
+
 /**
  * Initialize the database connection and create tables if needed
  * @return 1 on success, 0 on failure
  */
 int db_init();
 
+/**
+ * Same as db_init() with an explicit database path
+ * @param path SQLite filename, or ":memory:" for a throwaway database
+ * @return 1 on success, 0 on failure
+ */
+int db_init_at(const char *path);
+
 /**
  * Close the database connection
  */
@@ -31,16 +53,20 @@ int db_has_data();
 /**
  * Generate XMLTV-formatted program guide
  * Includes channel list and all programs ordered by channel/time
+ * @param lang ISO 639 code to output, or NULL for every language
+ *             (one lang-tagged <title>/<desc> per variant)
  * @return Allocated XML string (caller must free), or NULL on error
  */
-char *db_get_xmltv_programs();
+char *db_get_xmltv_programs(const char *lang);
 
 /**
  * Generate JSON-formatted program guide
  * Returns future programs only (end_time > now)
+ * @param lang ISO 639 code to prefer, or NULL; programs without that
+ *             language fall back to their first one
  * @return Allocated JSON string (caller must free), or NULL on error
  */
-char *db_get_json_programs();
+char *db_get_json_programs(const char *lang);
 
 /**
  * Insert or update a program entry
@@ -50,7 +76,7 @@ char *db_get_json_programs();
  * @param channel_service_id Virtual channel number "X.Y"
  * @param start_time        Start time in ms since epoch (key component)
  * @param end_time          End time in ms since epoch
- * @param title             Program title
+ * @param title             Program title (multi-language buffer, see mls.h)
  * @param event_id          ATSC event ID (for ETT matching)
  * @param source_id         ATSC source ID
  */
@@ -61,11 +87,26 @@ void db_upsert_program(const char *frequency, const char *channel_service_id,
 /**
  * Update program description from ETT (Extended Text Table)
  * Matches by frequency, channel, and event_id
+ * The description is a multi-language buffer (see mls.h).
  */
 void db_update_program_description(const char *frequency, 
                                    const char *channel_service_id, 
                                    int event_id, const char *description);
 
+/**
+ * Open a transaction grouping the following writes
+ * Used by the EPG writer so a batch costs one commit instead of one
+ * per row. db_upsert_program(), db_update_program_description() and the
+ * batch calls run on the writer's own connection; call them only from
+ * the EPG writer thread.
+ */
+void db_begin_batch();
+
+/**
+ * Commit the transaction opened by db_begin_batch()
+ */
+void db_commit_batch();
+
 /**
  * Delete program entries that ended more than 24 hours ago
  * Called periodically to prevent database bloat
@@ -73,4 +114,48 @@ void db_update_program_description(const char *frequency,
  */
 int db_cleanup_expired();
 
+/**
+ * Schedule a recording of a program in the guide
+ * Scheduling the same program twice returns the existing recording.
+ * @param channel_service_id Virtual channel number "X.Y"
+ * @param start_time         Program start in ms since epoch
+ * @return Recording id, 0 if no such program, -1 on error
+ */
+int db_add_recording(const char *channel_service_id, long long start_time);
+
+/**
+ * Fetch scheduled recordings starting at or before a time
+ * @return Number of rows written to out
+ */
+int db_due_recordings(long long until_ms, DbRecording *out, int max);
+
+/**
+ * Fetch one recording
+ * @return 1 if found
+ */
+int db_get_recording(int id, DbRecording *out);
+
+/**
+ * Update a recording's status, file (NULL keeps it) and size
+ */
+void db_update_recording(int id, const char *status, const char *path, long long bytes);
+
+/**
+ * Remove a recording's row
+ * @return 1 if it existed
+ */
+int db_delete_recording(int id);
+
+/**
+ * Mark recordings left "recording" by a previous run as failed
+ * @return Number of recordings marked
+ */
+int db_fail_interrupted_recordings();
+
+/**
+ * All recordings as JSON
+ * @return Allocated string (caller must free), or NULL on error
+ */
+char *db_get_recordings_json();
+
 #endif
@@ -0,0 +1,43 @@
+/**
+ * @file dvr.h
+ * @brief Recording engine for programs in the guide
+ *
+ * Recordings are scheduled from rows of the programs table (see
+ * db_add_recording()). A scheduler thread starts each one
+ * DVR_PADDING_SECS before the program, and it runs until the same
+ * padding past the end.
+ *
+ * A recorder is an ordinary capture viewer (capture.h): it shares the
+ * tuner and the zap process with anyone watching the same mux, and it
+ * keeps only the recorded program (spts.h). It reads from the capture
+ * ring like a live viewer, so it can never slow the capture down. If the disk stalls for longer than the ring and
+ * the block queue cover, only the recording loses data (counted in
+ * zaplink_dvr_overruns_total).
+ *
+ * Disk I/O goes through a per-recording writer thread. The recorder
+ * fills 1 MB page-aligned blocks, and the writer issues them with
+ * O_DIRECT (falling back to buffered I/O where unsupported) into a file
+ * preallocated for the program's length. The file is trimmed to its
+ * real size at the end.
+ */
+
+#ifndef DVR_H
+#define DVR_H
+
+/**
+ * Mark recordings cut off by a previous exit and start the scheduler
+ */
+void dvr_start();
+
+/**
+ * Delete a recording: stop it if running, remove its file and row
+ * @return 1 if it existed
+ */
+int dvr_delete(int id);
+
+/**
+ * Number of recordings currently capturing
+ */
+int dvr_active_count();
+
+#endif
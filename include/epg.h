@@ -15,12 +15,20 @@
 #ifndef EPG_H
 #define EPG_H
 
+#include <stdint.h>
+
 /**
  * If set to 1 before starting, skip the initial EPG scan cycle
  * Used when database already has data from a previous session
  */
 extern int epg_skip_first;
 
+/**
+ * Number of EIT/ETT instances (3 hours each) collected per mux
+ * Range 1..EPG_MAX_GUIDE_DEPTH; must be set before start_epg_thread()
+ */
+extern int epg_guide_depth;
+
 /**
  * Start the EPG collection threads
  * Creates worker threads (one per tuner) and orchestrator thread
@@ -33,6 +41,35 @@ void start_epg_thread();
  */
 void stop_epg_thread();
 
+/**
+ * Counters from one offline replay
+ */
+typedef struct {
+    long bytes;             /**< Input bytes read */
+    long packets;           /**< Aligned TS packets */
+    long sections;          /**< Sections delivered to table parsers */
+    long events_queued;     /**< Guide updates handed to the writer */
+    long events_dropped;    /**< Guide updates lost to a full writer queue */
+    long sync_losses;       /**< Resynchronizations */
+    long cc_errors;         /**< Continuity counter discontinuities */
+    long crc_errors;        /**< Sections dropped on CRC mismatch */
+    uint64_t read_ns;       /**< Capture stage: time in read() */
+    uint64_t stall_ns;      /**< Capture stage: waiting on the parse stage */
+    uint64_t parse_ns;      /**< Parse stage: busy time */
+} EpgReplayStats;
+
+/**
+ * Feed a recorded transport stream through the scan pipeline
+ * Uses the same capture, parse and persistence stages as a live scan,
+ * with no tuner. The EPG writer must be running (epg_writer_start());
+ * updates may still be queued on return (see epg_writer_flush()).
+ * @param fd   Readable TS source (file or pipe), read to EOF
+ * @param freq Mux frequency in Hz the capture was taken from
+ * @param out  Receives counters (may be NULL)
+ * @return 0 on success, -1 if the pipeline could not be started
+ */
+int epg_replay_fd(int fd, const char *freq, EpgReplayStats *out);
+
 /**
  * Block until the first complete EPG scan cycle finishes
  * Used at startup to ensure guide data is available before serving
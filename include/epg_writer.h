@@ -0,0 +1,103 @@
+/**
+ * @file epg_writer.h
+ * @brief Batched persistence stage for EPG scan results
+ *
+ * Parse stages collect guide updates into batches and hand them to a
+ * single writer thread, which applies each group of queued batches in
+ * one SQLite transaction. Submitting never blocks: if the bounded queue
+ * is full the batch is dropped and counted (PSIP data repeats every
+ * cycle), so a slow database can never back up into tuner reads.
+ */
+
+#ifndef EPG_WRITER_H
+#define EPG_WRITER_H
+
+#include <stdint.h>
+
+#define EPG_BATCH_EVENTS 64     /**< Updates per batch */
+#define EPG_WRITER_QUEUE 128    /**< Batches queued before dropping */
+
+typedef enum {
+    EPG_EVENT_PROGRAM,          /**< EIT event: upsert title and times */
+    EPG_EVENT_DESCRIPTION       /**< ETT text: update description */
+} EpgEventKind;
+
+/**
+ * One pending guide update; text is owned by the batch
+ */
+typedef struct {
+    EpgEventKind kind;
+    char channel[32];           /**< Virtual channel number "X.Y" */
+    long long start_ms;         /**< Program only */
+    long long end_ms;           /**< Program only */
+    int event_id;
+    int source_id;              /**< Program only */
+    char *text;                 /**< Title or description (mls.h buffer) */
+} EpgEvent;
+
+/**
+ * Guide updates from one mux, applied in order
+ */
+typedef struct {
+    char frequency[32];
+    int count;
+    EpgEvent events[EPG_BATCH_EVENTS];
+} EpgEventBatch;
+
+/**
+ * Persistence stage counters (cumulative since start)
+ */
+typedef struct {
+    unsigned long batches;          /**< Batches written */
+    unsigned long events;           /**< Updates written */
+    unsigned long dropped_events;   /**< Updates lost to a full queue */
+    unsigned long transactions;     /**< Commits performed */
+    uint64_t db_ns;                 /**< Time spent inside SQLite */
+    int queue_high_water;           /**< Deepest queue seen */
+} EpgWriterStats;
+
+/**
+ * Start the writer thread
+ */
+void epg_writer_start();
+
+/**
+ * Write everything still queued, then stop the writer thread
+ */
+void epg_writer_stop();
+
+/**
+ * Allocate an empty batch for a mux
+ * @return New batch, or NULL on allocation failure
+ */
+EpgEventBatch *epg_batch_new(const char *frequency);
+
+/**
+ * Append an update; ev->text is copied
+ * @return 1 if added, 0 if the batch is full or text could not be copied
+ */
+int epg_batch_add(EpgEventBatch *b, const EpgEvent *ev);
+
+/**
+ * Free a batch and its text
+ */
+void epg_batch_free(EpgEventBatch *b);
+
+/**
+ * Queue a batch for writing (never blocks)
+ * Ownership passes to the writer either way.
+ * @return 1 if queued, 0 if dropped
+ */
+int epg_writer_submit(EpgEventBatch *b);
+
+/**
+ * Block until every batch submitted so far has been written
+ */
+void epg_writer_flush();
+
+/**
+ * Snapshot the persistence counters
+ */
+void epg_writer_stats(EpgWriterStats *out);
+
+#endif
@@ -7,6 +7,9 @@
  * - /playlist.m3u     - M3U playlist of available channels
  * - /xmltv.xml        - XMLTV format program guide
  * - /xmltv.json       - JSON format program guide
+ * - /metrics          - Prometheus metrics
+ * - /status           - Transport health of active streams
+ * - /startup          - Startup timelines of recent streams
  * 
  * Each client connection is handled in a separate thread.
  */
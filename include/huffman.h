@@ -8,8 +8,13 @@
  * - Type 0x02: Program description compression
  * 
  * Both use 1st-order conditional Huffman coding with 128 trees
- * (one per preceding character). The huffman.bin file contains
- * pre-built decoding tables from the A/65 specification.
+ * (one per preceding character). The decoding tables from the A/65
+ * specification are compiled into the binary: support/gen_huffman.py
+ * turns huffman.bin into a generated C source at build time.
+ *
+ * Each tree also has an 8-bit lookup table giving the symbol and code
+ * length (or the interior node to continue from for longer codes), so
+ * most symbols decode with one table access.
  */
 
 #ifndef HUFFMAN_H
@@ -27,36 +32,48 @@ typedef struct {
     int16_t children[2];
 } HuffmanNode;
 
+/** Bits resolved per fast-lookup access */
+#define HUFFMAN_LUT_BITS 8
+#define HUFFMAN_LUT_SIZE (1 << HUFFMAN_LUT_BITS)
+#define HUFFMAN_LUT_LEAF 0x1   /**< Entry resolves to a symbol */
+#define HUFFMAN_LUT_CONT 0x2   /**< Entry continues at an interior node */
+
 /**
- * Huffman decoding table for 1st-order conditional coding
- * Contains 128 trees (one per preceding ASCII character)
+ * One fast-lookup entry, indexed by context and the next 8 input bits
+ * LUT_LEAF: value is the decoded symbol, bits the code length.
+ * LUT_CONT: value is the tree node reached after 8 bits.
+ * Neither flag: the pattern leads nowhere (invalid/empty tree).
  */
 typedef struct {
-    HuffmanNode *trees;     /**< Array of tree nodes */
-    int nodes_per_tree;     /**< Fixed size of each tree */
-} HuffmanTable;
+    int16_t value;
+    uint8_t bits;
+    uint8_t flags;
+} HuffmanLutEntry;
 
-/**
- * Initialize the Huffman decoder
- * Loads huffman.bin from the current working directory
- * @return 1 on success, 0 on failure (file not found, parse error)
- */
-int huffman_init();
+/* Generated tables (build/gen/huffman_tables.c), 128 contexts each */
+extern const int huffman_tables_valid;
+extern const int huffman_nodes_per_tree;
+extern const HuffmanNode huffman_title_trees[];
+extern const HuffmanNode huffman_desc_trees[];
+extern const HuffmanLutEntry huffman_title_lut[];
+extern const HuffmanLutEntry huffman_desc_lut[];
 
 /**
- * Clean up Huffman decoder resources
+ * Check whether real decode tables were compiled in
+ * @return 1 if available, 0 if the build used placeholder tables
  */
-void huffman_cleanup();
+int huffman_available();
 
 /**
  * Decode an ATSC Huffman-compressed text segment
+ * Needs no initialization; safe to call from any thread.
  * 
  * @param compr_type Compression type (0x01 = title, 0x02 = description)
  * @param src        Compressed bitstream
  * @param src_len    Length of compressed data in bytes
- * @param dest       Output buffer for decoded string
+ * @param dest       Output buffer; written from the start and NUL-terminated
  * @param dest_len   Size of output buffer
- * @return 1 on success, 0 on decoding failure
+ * @return Number of characters written, or -1 if tables are unavailable
  */
 int huffman_decode(int compr_type, const uint8_t *src, int src_len, 
                    char *dest, int dest_len);
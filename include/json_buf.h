@@ -0,0 +1,45 @@
+/**
+ * @file json_buf.h
+ * @brief Growable buffer for building JSON responses
+ *
+ * Used by the status endpoints (/status, /startup). Appends never fail
+ * individually: an allocation failure marks the buffer, and
+ * json_buf_finish() then returns NULL.
+ */
+
+#ifndef JSON_BUF_H
+#define JSON_BUF_H
+
+#include <stddef.h>
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int failed;
+} JsonBuf;
+
+/**
+ * Start an empty buffer
+ * @return 1 on success, 0 if out of memory
+ */
+int json_buf_init(JsonBuf *jb, size_t cap);
+
+/**
+ * Append formatted text
+ */
+void json_printf(JsonBuf *jb, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Append a quoted string, escaping quotes, backslashes and control
+ * characters
+ */
+void json_string(JsonBuf *jb, const char *s);
+
+/**
+ * Take the finished text
+ * @return Allocated string (caller must free), or NULL if any append failed
+ */
+char *json_buf_finish(JsonBuf *jb);
+
+#endif
@@ -1,13 +1,21 @@
 /**
  * @file log.h
- * @brief Colored console logging with severity levels
- * 
+ * @brief Asynchronous console logging with severity levels
+ *
  * Provides macro-based logging with:
  * - Four severity levels: ERROR, WARN, INFO, DEBUG
  * - Automatic timestamps
- * - ANSI color coding for readability
+ * - ANSI color coding when stderr is a terminal
+ * - Plain-text or JSON-lines output
  * - Verbose mode gating for DEBUG messages
- * 
+ *
+ * Once log_start() has been called, callers only format the message and
+ * push it into a lock-free queue; a background thread adds timestamps,
+ * rate limits repeats and writes to stderr. A full queue drops (and
+ * counts) messages rather than blocking, so a burst of warnings can
+ * never stall a capture thread. Before log_start() (and in the support
+ * tools) messages are written synchronously.
+ *
  * Usage:
  *   LOG_INFO("HTTP", "Listening on port %d", port);
  *   LOG_ERROR("DB", "Failed to open database: %s", errmsg);
@@ -18,7 +26,6 @@
 #define LOG_H
 
 #include <stdio.h>
-#include <time.h>
 
 /** Log severity levels (ordered from most to least critical) */
 typedef enum {
@@ -28,6 +35,12 @@ typedef enum {
     LOG_DEBUG   /**< Verbose debug output (requires -v flag) */
 } LogLevel;
 
+/** Output formats */
+typedef enum {
+    LOG_FORMAT_PLAIN,   /**< "[HH:MM:SS] LEVEL TAG message" */
+    LOG_FORMAT_JSON     /**< One JSON object per line */
+} LogFormat;
+
 /** Global verbose flag - controls DEBUG output visibility */
 extern int g_verbose;
 
@@ -39,33 +52,49 @@ extern int g_verbose;
 #define COLOR_CYAN    "\033[1;36m"   /* Tags */
 #define COLOR_DIM     "\033[2m"      /* Debug/timestamps */
 
+/** Messages longer than this are truncated */
+#define LOG_MSG_MAX 400
+
+/** Identical messages allowed per window before they are summarized */
+#define LOG_RATE_BURST 5
+
+/** Rate limiting window in seconds */
+#define LOG_RATE_WINDOW 10
+
+/**
+ * Queue a log record - use the convenience macros below instead
+ */
+void log_write(LogLevel level, const char *tag, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * Select the output format (default plain; call before log_start)
+ */
+void log_set_format(LogFormat format);
+
+/**
+ * Parse a format name ("plain" or "json")
+ * @return 1 on success, 0 if the name is unknown
+ */
+int log_parse_format(const char *name, LogFormat *out);
+
+/**
+ * Start the background writer; messages become asynchronous
+ * Remaining messages are flushed at exit.
+ */
+void log_start();
+
 /**
- * Format current time as HH:MM:SS into provided buffer
+ * Write everything queued and stop the background writer
  */
-static inline void log_timestamp(char *buf, size_t len) {
-    time_t now = time(NULL);
-    struct tm *tm = localtime(&now);
-    strftime(buf, len, "%H:%M:%S", tm);
-}
+void log_stop();
 
 /**
  * Core logging macro - use convenience macros below instead
  */
 #define LOG(level, tag, fmt, ...) do { \
     if ((level) == LOG_DEBUG && !g_verbose) break; \
-    char _ts[16]; log_timestamp(_ts, sizeof(_ts)); \
-    const char *_color = ""; \
-    const char *_prefix = ""; \
-    switch (level) { \
-        case LOG_ERROR: _color = COLOR_RED; _prefix = "ERROR"; break; \
-        case LOG_WARN:  _color = COLOR_YELLOW; _prefix = "WARN "; break; \
-        case LOG_INFO:  _color = COLOR_GREEN; _prefix = "INFO "; break; \
-        case LOG_DEBUG: _color = COLOR_DIM; _prefix = "DEBUG"; break; \
-    } \
-    fprintf(stderr, "%s[%s]%s %s%-5s%s %s" COLOR_CYAN "%s" COLOR_RESET " " fmt "\n", \
-        COLOR_DIM, _ts, COLOR_RESET, \
-        _color, _prefix, COLOR_RESET, \
-        _color, tag, ##__VA_ARGS__); \
+    log_write(level, tag, fmt, ##__VA_ARGS__); \
 } while(0)
 
 /** Log an error message */
@@ -0,0 +1,74 @@
+/**
+ * @file mcast.h
+ * @brief RTP/UDP multicast publication of channels
+ *
+ * With -M rtp (or -M udp) any channel can be published to a multicast
+ * group, so LAN set-top boxes share one stream instead of opening one
+ * HTTP relay each. Channel major.minor maps to group
+ * MCAST_GROUP_BASE + major.minor (239.255.15.3 for 15.3) on
+ * MCAST_PORT. /multicast.m3u lists those URLs, and the mDNS TXT record
+ * points to it.
+ *
+ * A publication is a capture viewer (capture.h) behind an SPTS filter
+ * (spts.h). It packs seven TS packets into each datagram, behind an RFC
+ * 2250 RTP header in rtp mode, and sends every whole datagram a read
+ * produced with one sendmmsg().
+ *
+ * Publications start on demand:
+ *   - GET /multicast/{channel}, which returns the group URL
+ *   - an IGMP membership report for the group. IGMPv3 joins start a
+ *     channel. IGMPv2 reports refresh running ones, because they are
+ *     only seen for groups we have joined ourselves.
+ * A publication stops on an IGMP leave or once MCAST_IDLE_SECS pass
+ * with no report or request. Watching IGMP needs a raw socket
+ * (CAP_NET_RAW). Without one, only HTTP requests keep channels alive.
+ * While channels are published and no other IGMP querier is heard, the
+ * listener sends general queries itself so members keep reporting.
+ */
+
+#ifndef MCAST_H
+#define MCAST_H
+
+#include <stddef.h>
+#include "channels.h"
+
+typedef enum {
+    MCAST_OFF,
+    MCAST_RTP,
+    MCAST_UDP
+} McastMode;
+
+/** Publication format (-M), MCAST_OFF to disable */
+extern McastMode mcast_mode;
+
+/**
+ * Parse an -M value ("rtp" or "udp")
+ * @return 1 on success
+ */
+int mcast_parse_mode(const char *name, McastMode *out);
+
+/**
+ * Start the IGMP listener (no-op when multicast is off)
+ */
+void mcast_start();
+
+/**
+ * URL of a channel's group, e.g. "rtp://@239.255.15.3:5004"
+ * @return 1 on success, 0 if the channel has no group (major/minor > 255)
+ */
+int mcast_url(const Channel *chan, char *out, size_t len);
+
+/**
+ * Start publishing a channel, or keep it published for another
+ * MCAST_IDLE_SECS
+ * @return 1 if published (or starting), 0 if multicast is off or the
+ *         channel has no group
+ */
+int mcast_request(const Channel *chan);
+
+/**
+ * Number of channels currently published
+ */
+int mcast_active_count();
+
+#endif
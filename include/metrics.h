@@ -0,0 +1,124 @@
+/**
+ * @file metrics.h
+ * @brief Prometheus metrics for the relay, tuners, EPG and HTTP API
+ *
+ * Hot paths only ever do relaxed atomic adds. Global counters and
+ * histograms are sharded: each thread is assigned a cache-line aligned
+ * shard on first use, so relay and scan threads on different tuners do
+ * not bounce the same line. Per-channel stream counters live in one slot
+ * per channel that is only written by that channel's viewers. Shards are
+ * summed when /metrics is scraped.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Channels tracked individually; later ones are not exported */
+#define METRICS_MAX_STREAMS 256
+
+/**
+ * Monotonic event counters
+ */
+typedef enum {
+    METRIC_TUNER_WAITS,         /**< Stream requests that had to wait for a tuner */
+    METRIC_TUNER_PREEMPTIONS,   /**< EPG scans preempted by a stream */
+    METRIC_TUNER_UNAVAILABLE,   /**< Streams refused with 503 */
+    METRIC_TUNER_LINGER_RECLAIMS, /**< Warm tuners taken back for other work */
+    METRIC_STREAM_WARM_STARTS,  /**< Streams attached to an already running capture */
+    METRIC_STREAM_KEYFRAME_STARTS, /**< Warm starts replayed from a cached keyframe */
+    METRIC_STREAM_FILTERED_BYTES, /**< Mux bytes not sent to single-program viewers */
+    METRIC_PACE_RESYNCS,        /**< Paced schedules re-anchored (discontinuity, stall, drift) */
+    METRIC_PACE_STALLS,         /**< Paced sends put off by a full client socket */
+    METRIC_MCAST_BYTES,         /**< TS bytes published to multicast groups */
+    METRIC_DVR_BYTES,           /**< Bytes written to recordings */
+    METRIC_DVR_OVERRUNS,        /**< Recorders that fell a capture ring behind */
+    METRIC_EPG_SECTIONS,        /**< PSIP sections parsed */
+    METRIC_EPG_EVENTS,          /**< Guide updates queued for storage */
+    METRIC_EPG_EVENTS_DROPPED,  /**< Guide updates lost to a full writer queue */
+    METRIC_EPG_CRC_ERRORS,      /**< Sections dropped on CRC mismatch */
+    METRIC_EPG_CC_ERRORS,       /**< Continuity counter discontinuities */
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+/**
+ * Latency histograms (observed in nanoseconds, exported in seconds)
+ */
+typedef enum {
+    METRIC_TUNER_WAIT,          /**< Time a stream waited for a tuner */
+    METRIC_EPG_SCAN,            /**< Duration of one mux scan */
+    METRIC_DB_UPSERT,           /**< SQLite: program upsert */
+    METRIC_DB_DESCRIPTION,      /**< SQLite: description update */
+    METRIC_DB_COMMIT,           /**< SQLite: batch commit */
+    METRIC_DB_XMLTV,            /**< SQLite: XMLTV guide query */
+    METRIC_DB_JSON,             /**< SQLite: JSON guide query */
+    METRIC_DB_CLEANUP,          /**< SQLite: expired program purge */
+    METRIC_HTTP_PLAYLIST,       /**< GET /playlist.m3u */
+    METRIC_HTTP_XMLTV,          /**< GET /xmltv.xml */
+    METRIC_HTTP_JSON,           /**< GET /xmltv.json */
+    METRIC_HTTP_RELOAD,         /**< POST /reload */
+    METRIC_HTTP_METRICS,        /**< GET /metrics */
+    METRIC_HTTP_STATUS,         /**< GET /status */
+    METRIC_HTTP_STARTUP,        /**< GET /startup */
+    METRIC_HTTP_OTHER,          /**< Anything else (errors, 404s) */
+    METRIC_STARTUP_PARSED,      /**< Stream startup (from accept): request parsed */
+    METRIC_STARTUP_TUNER,       /**< ... tuner acquired */
+    METRIC_STARTUP_SPAWNED,     /**< ... dvbv5-zap exec'd */
+    METRIC_STARTUP_FIRST_BYTE,  /**< ... first TS bytes (frontend locked) */
+    METRIC_STARTUP_FIRST_PAT,   /**< ... first PAT */
+    METRIC_STARTUP_FIRST_PMT,   /**< ... first PMT */
+    METRIC_STARTUP_FIRST_SENT,  /**< ... first bytes sent to the client */
+    METRIC_PACE_LATENESS,       /**< Paced packets: send time minus PCR schedule */
+    METRIC_HISTOGRAM_COUNT
+} MetricHistogram;
+
+/** Per-channel relay counters; obtain with metrics_stream_open() */
+typedef struct MetricsStream MetricsStream;
+
+/**
+ * Monotonic clock in nanoseconds, for timing observations
+ */
+uint64_t metrics_now_ns(void);
+
+/**
+ * Add n to a counter
+ */
+void metrics_add(MetricCounter c, uint64_t n);
+
+/**
+ * Record one latency observation
+ */
+void metrics_observe(MetricHistogram h, uint64_t ns);
+
+/**
+ * Register a viewer of a channel
+ * @return Counter slot for the channel, or NULL if the table is full
+ *         (the other stream functions accept NULL)
+ */
+MetricsStream *metrics_stream_open(const char *channel);
+
+/**
+ * Account relayed TS bytes (packets are derived as bytes / 188)
+ */
+void metrics_stream_relayed(MetricsStream *s, size_t bytes);
+
+/**
+ * Account transport errors seen by a relay (ts_health.h)
+ * @param tuner_index Index into tuners[] the stream is on
+ */
+void metrics_stream_errors(MetricsStream *s, int tuner_index, uint64_t cc_errors, uint64_t tei_packets);
+
+/**
+ * Unregister a viewer
+ */
+void metrics_stream_close(MetricsStream *s);
+
+/**
+ * Render every metric in the Prometheus text exposition format
+ * @return Allocated string (caller must free), or NULL on failure
+ */
+char *metrics_render(void);
+
+#endif
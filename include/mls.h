@@ -0,0 +1,62 @@
+/**
+ * @file mls.h
+ * @brief Compact multi-language strings for EPG text
+ *
+ * An ATSC Multiple String Structure may carry the same title or
+ * description in several languages. The EPG decoder keeps every
+ * variant in one NUL-terminated UTF-8 buffer, stored as-is in the
+ * database, so guide endpoints can pick a language without decoding
+ * the broadcast data again.
+ *
+ * Layout: each variant is MLS_SEP, a 3-letter ISO 639 code, then its
+ * text, e.g. "\x1E" "engNews" "\x1E" "spaNoticias". Text never contains
+ * control characters, so MLS_SEP cannot appear inside it. A buffer that
+ * does not start with MLS_SEP is a single untagged variant (rows written
+ * before language retention existed).
+ */
+
+#ifndef MLS_H
+#define MLS_H
+
+#include <stddef.h>
+
+/** Variant separator (ASCII record separator) */
+#define MLS_SEP '\x1E'
+
+/** Length of a language code in the buffer */
+#define MLS_LANG_LEN 3
+
+/**
+ * One language variant; text points into the source buffer and is
+ * not NUL-terminated
+ */
+typedef struct {
+    char lang[MLS_LANG_LEN + 1];  /**< ISO 639 code, "" if untagged */
+    const char *text;
+    size_t len;
+} MlsVariant;
+
+/**
+ * Iterate the variants of a buffer
+ * @param cursor In/out position; initialize to the buffer start
+ * @param out    Receives the next variant
+ * @return 1 if a variant was returned, 0 at the end
+ */
+int mls_next(const char **cursor, MlsVariant *out);
+
+/**
+ * Pick the variant for a language
+ * Falls back to the first variant if lang is NULL/empty or absent.
+ * @param mls  Multi-language buffer (NULL allowed)
+ * @param lang ISO 639 code (e.g., "spa"), case-insensitive
+ * @param out  Receives the selected variant (empty if none)
+ * @return 1 if lang matched exactly, 0 otherwise
+ */
+int mls_select(const char *mls, const char *lang, MlsVariant *out);
+
+/**
+ * Check that a string is usable as a language code (3 ASCII letters)
+ */
+int mls_valid_lang(const char *lang);
+
+#endif
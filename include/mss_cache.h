@@ -0,0 +1,63 @@
+/**
+ * @file mss_cache.h
+ * @brief Memoized decode cache for ATSC Multiple String Structures
+ * 
+ * Broadcasters resend the same titles and descriptions every EIT/ETT
+ * cycle and for every repeat airing. This cache maps the raw MSS bytes
+ * (plus the output size they were decoded for) to the final sanitized
+ * string, so each distinct string is Huffman-decoded once per process.
+ * 
+ * The cache is bounded: entries live in fixed slots recycled with CLOCK
+ * (second-chance) eviction. It is sharded by key hash, each shard with
+ * its own mutex, so EPG workers on different tuners rarely contend.
+ */
+
+#ifndef MSS_CACHE_H
+#define MSS_CACHE_H
+
+#include <stddef.h>
+
+/** Total cache slots across all shards */
+#ifndef MSS_CACHE_SLOTS
+#define MSS_CACHE_SLOTS 8192
+#endif
+
+/**
+ * Cache effectiveness counters
+ */
+typedef struct {
+    unsigned long hits;       /**< Lookups served from cache */
+    unsigned long misses;     /**< Lookups that required decoding */
+    unsigned long evictions;  /**< Entries recycled by CLOCK */
+    unsigned long entries;    /**< Slots currently occupied */
+    size_t bytes;             /**< Key + value bytes held */
+} MssCacheStats;
+
+/**
+ * Look up a decoded string
+ * @param raw      Raw MSS bytes as found in the section
+ * @param raw_len  Length of raw
+ * @param out      Output buffer, NUL-terminated on hit
+ * @param out_len  Size of out (part of the key)
+ * @return Length of the cached string, or -1 on miss
+ */
+int mss_cache_get(const unsigned char *raw, int raw_len, char *out, size_t out_len);
+
+/**
+ * Store a decoded string for raw (replaces nothing; first writer wins)
+ * @param val_len Length of val excluding the terminator
+ */
+void mss_cache_put(const unsigned char *raw, int raw_len, size_t out_len,
+                   const char *val, size_t val_len);
+
+/**
+ * Snapshot the cache counters (summed over shards)
+ */
+void mss_cache_stats(MssCacheStats *st);
+
+/**
+ * Free all cached entries
+ */
+void mss_cache_cleanup();
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file pacer.h
+ * @brief PCR-paced stream output
+ *
+ * Tuner output arrives in bursts, and a relay that forwards it at once
+ * overruns the small buffers of some Wi-Fi TV sticks. A paced stream
+ * (?pace=1) goes through a PaceSession instead. The relay pushes
+ * packets into the session's queue, and each packet gets a send time
+ * from the program clock. Packets between two PCRs are spread evenly
+ * over the interval, and the whole schedule runs pace_jitter_ms behind
+ * arrival. That delay is the jitter buffer that absorbs tuner bursts.
+ *
+ * One pacer thread serves every paced session from a timer wheel with
+ * 1 ms slots. Each tick it sends, without blocking, the packets that
+ * have come due on the sessions in that slot. It then files each
+ * session under the slot of its next packet. A client whose socket is
+ * full is retried a few ticks later rather than holding up the others.
+ *
+ * The schedule is re-anchored on PCR discontinuities and whenever it
+ * drifts out of the jitter buffer. That covers a stalled tuner, and a
+ * broadcast clock running fast or slow against ours. How late packets
+ * leave against their schedule is exported as
+ * zaplink_pace_lateness_seconds.
+ */
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Jitter buffer of paced streams, in milliseconds */
+extern int pace_jitter_ms;
+
+typedef struct PaceSession PaceSession;
+
+/**
+ * Start pacing output to a connected socket
+ * Starts the pacer thread on first use.
+ * @return New session, or NULL on failure
+ */
+PaceSession *pace_open(int fd);
+
+/**
+ * Queue whole TS packets for paced sending
+ * Blocks while the queue is full.
+ * @return 1, or 0 once the client is gone
+ */
+int pace_push(PaceSession *s, const unsigned char *buf, size_t len);
+
+/**
+ * Bytes sent to the client so far
+ */
+uint64_t pace_sent_bytes(PaceSession *s);
+
+/**
+ * Send what is still queued on schedule (unless the client is gone),
+ * then free the session
+ * @return Bytes sent to the client over the whole session
+ */
+uint64_t pace_close(PaceSession *s);
+
+/**
+ * Number of open paced sessions
+ */
+int pace_session_count();
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ * @file spts.h
+ * @brief Single-program transport stream filter for one channel
+ *
+ * Captures carry the whole mux (dvbv5-zap -P), so a viewer of 15.3
+ * would otherwise also receive the video of 15.1 and 15.2. The filter
+ * follows the PAT and the channel's PMT. It keeps only the PIDs that
+ * PMT names (PCR and elementary streams), the PMT itself and the ATSC
+ * PSIP base PID (0x1FFB), and it drops null packets. Every PAT is
+ * replaced by a single-entry PAT for the program. Its continuity
+ * counter is our own, so players see one clean program.
+ *
+ * If the PAT does not list the service (a stale channels.conf), the
+ * filter passes the whole mux, minus nulls, rather than nothing.
+ *
+ * Filtering is in place and packet aligned. It never adds bytes, and it
+ * holds no state across calls other than the PSI it has parsed.
+ */
+
+#ifndef SPTS_H
+#define SPTS_H
+
+#include <stddef.h>
+
+typedef struct SptsFilter SptsFilter;
+
+/**
+ * Create a filter for one program
+ * @param service_id program_number of the channel
+ * @return New filter, or NULL on allocation failure
+ */
+SptsFilter *spts_open(int service_id);
+
+/**
+ * Filter whole TS packets in place
+ * @param buf Packets; a trailing partial packet is dropped
+ * @return Bytes of buf still to send (a multiple of 188, may be 0)
+ */
+size_t spts_filter(SptsFilter *f, unsigned char *buf, size_t len);
+
+/**
+ * Free a filter (NULL is ignored)
+ */
+void spts_close(SptsFilter *f);
+
+#endif
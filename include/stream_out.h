@@ -0,0 +1,77 @@
+/**
+ * @file stream_out.h
+ * @brief Packet-aligned socket output for stream relays
+ *
+ * The relay reads TS straight into the StreamOut buffer and commits
+ * what it read. Every send covers whole 188-byte packets, and a short
+ * write is finished before anything else is queued, so a client never
+ * sees a packet split by a slow socket.
+ *
+ * Two profiles, picked per request with ?profile=:
+ *
+ *   latency     (default) TCP_NODELAY and a small send buffer. Each
+ *               read of up to three 7-packet groups is sent at once.
+ *               For live viewing and channel surfing.
+ *   throughput  TCP_CORK and a large send buffer. Output is batched
+ *               into STREAM_BATCH_BYTES and sent in one call, or sooner
+ *               once the oldest byte has waited STREAM_BATCH_MAX_MS.
+ *               Fewer syscalls and full-sized segments, for clients
+ *               that record rather than watch.
+ */
+
+#ifndef STREAM_OUT_H
+#define STREAM_OUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum {
+    STREAM_PROFILE_LATENCY,
+    STREAM_PROFILE_THROUGHPUT
+} StreamProfile;
+
+/**
+ * Output state of one relay
+ */
+typedef struct {
+    int fd;
+    StreamProfile profile;
+    unsigned char *buf;
+    size_t size;            /**< Buffer size, whole packets */
+    size_t fill;            /**< Bytes committed, not yet sent */
+    uint64_t oldest_ns;     /**< When the oldest unsent byte was committed */
+} StreamOut;
+
+/**
+ * Parse a ?profile= value
+ * @return The profile; unknown or NULL names give STREAM_PROFILE_LATENCY
+ */
+StreamProfile stream_profile_parse(const char *name);
+
+/**
+ * Set up the socket for a profile and allocate the buffer
+ * @return 1 on success, 0 on allocation failure
+ */
+int stream_out_open(StreamOut *o, int fd, StreamProfile profile);
+
+/**
+ * Where to read the next data
+ * @param room Receives the space available (a multiple of 188, never 0)
+ */
+unsigned char *stream_out_space(StreamOut *o, size_t *room);
+
+/**
+ * Queue n bytes written at stream_out_space() and send if due
+ * n may be 0, which only checks the batch timer.
+ * @return Bytes sent to the socket (0 if still batching), or -1 once the
+ *         client is gone
+ */
+ssize_t stream_out_commit(StreamOut *o, size_t n);
+
+/**
+ * Send what is left, release the cork and free the buffer
+ */
+void stream_out_close(StreamOut *o);
+
+#endif
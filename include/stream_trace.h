@@ -0,0 +1,78 @@
+/**
+ * @file stream_trace.h
+ * @brief Per-session stream startup timeline
+ *
+ * Every /stream request carries a StreamTrace: monotonic timestamps for
+ * each startup phase, measured from the moment the connection was
+ * accepted. When the session has started (or failed to) the timeline is
+ * logged at debug level, folded into the
+ * zaplink_stream_startup_seconds{phase=...} histograms and kept in a
+ * small ring of recent sessions served by /startup. Requests rejected
+ * with a 4xx are kept for /startup but left out of the histograms.
+ *
+ * dvbv5-zap only writes once the frontend has locked and the demux is
+ * set up, so the first byte read from it marks tuner lock.
+ */
+
+#ifndef STREAM_TRACE_H
+#define STREAM_TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+/** Recent sessions kept for /startup */
+#define STREAM_TRACE_RECENT 32
+
+/**
+ * Startup phases, in the order they normally complete
+ */
+typedef enum {
+    TRACE_ACCEPTED,     /**< Connection accepted */
+    TRACE_PARSED,       /**< Request line and headers parsed */
+    TRACE_TUNER,        /**< Tuner acquired (after any retries) */
+    TRACE_SPAWNED,      /**< dvbv5-zap exec'd */
+    TRACE_FIRST_BYTE,   /**< First TS bytes from the tuner (frontend locked) */
+    TRACE_FIRST_PAT,    /**< First PAT seen */
+    TRACE_FIRST_PMT,    /**< First PMT of a listed program seen */
+    TRACE_FIRST_SENT,   /**< First bytes written to the client */
+    TRACE_PHASES
+} TracePhase;
+
+/**
+ * Startup timeline of one stream session
+ */
+typedef struct {
+    char channel[32];
+    char client[64];
+    char outcome[16];           /**< "ok", "503", "404", "no data", ... */
+    int tuner_id;               /**< Adapter number, -1 if none */
+    int retries;                /**< acquire_tuner retries */
+    int warm;                   /**< Joined an already tuned mux */
+    time_t started;             /**< Wall clock at accept */
+    uint64_t t[TRACE_PHASES];   /**< Monotonic ns; 0 = phase not reached */
+} StreamTrace;
+
+/**
+ * Start a timeline
+ * @param accepted_ns Monotonic time the connection was accepted
+ */
+void trace_begin(StreamTrace *tr, uint64_t accepted_ns);
+
+/**
+ * Record a phase (only the first mark of each phase counts)
+ */
+void trace_mark(StreamTrace *tr, TracePhase phase);
+
+/**
+ * Finish a timeline: log it, record histograms, keep it for /startup
+ * Idempotent; only the first call has any effect.
+ */
+void trace_finish(StreamTrace *tr, const char *outcome);
+
+/**
+ * Recent startup timelines as JSON (milliseconds since accept)
+ * @return Allocated string (caller must free), or NULL on failure
+ */
+char *trace_recent_json(void);
+
+#endif
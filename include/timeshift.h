@@ -0,0 +1,70 @@
+/**
+ * @file timeshift.h
+ * @brief Disk-backed timeshift window for a mux capture
+ *
+ * When enabled (-T minutes), each capture spills its ring to a file
+ * preallocated for that many minutes at the full ATSC rate, used as a
+ * circular buffer. Positions are the capture's absolute byte offsets, so
+ * the memory ring holds the newest seconds, the file the minutes before
+ * them, and a viewer's position is valid in either.
+ *
+ * The spill also indexes the stream on PCR. Every half second of PCR
+ * time opens a new segment, recorded as (byte offset, timeline). The
+ * timeline is the PCR unwrapped across 2^33 and with discontinuities
+ * removed. "N seconds behind live" is then a binary search over the
+ * segments.
+ *
+ * The file is unlinked as soon as it is created, so it never outlives
+ * the process.
+ */
+
+#ifndef TIMESHIFT_H
+#define TIMESHIFT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** Minutes of timeshift per capture (0 = disabled) */
+extern int timeshift_minutes;
+
+typedef struct Timeshift Timeshift;
+
+/**
+ * Create the spill file and index for a capture
+ * @param freq_hz Mux frequency (names the file)
+ * @param minutes Window length
+ * @return New timeshift, or NULL if the file cannot be created
+ */
+Timeshift *timeshift_create(uint32_t freq_hz, int minutes);
+
+/**
+ * Free the index and close (and so delete) the spill file
+ */
+void timeshift_destroy(Timeshift *ts);
+
+/**
+ * Append whole packets that start at absolute offset pos
+ * Appends must be contiguous; a gap restarts the window at pos.
+ */
+void timeshift_append(Timeshift *ts, const unsigned char *buf, size_t len, uint64_t pos);
+
+/**
+ * Read spilled data at an absolute offset
+ * @return Bytes read, or -1 if pos is not (or no longer) in the file
+ */
+ssize_t timeshift_read(Timeshift *ts, uint64_t pos, unsigned char *buf, size_t len);
+
+/**
+ * Absolute offsets currently held in the file: [start, end)
+ */
+void timeshift_window(Timeshift *ts, uint64_t *start, uint64_t *end);
+
+/**
+ * Find the segment starting about `seconds` behind the newest PCR
+ * Clamped to the oldest segment still in the file.
+ * @return 1 with *pos set, or 0 if nothing is indexed yet
+ */
+int timeshift_seek(Timeshift *ts, double seconds, uint64_t *pos);
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * @file ts_health.h
+ * @brief Inline transport stream health analysis for live relays
+ *
+ * The relay hands every chunk it forwards to ts_health_feed(), which
+ * walks the 4-byte TS headers (and the adaptation field when present)
+ * without copying payload. Per PID it tracks continuity errors and TEI
+ * packets, and on PCR PIDs the delivered bitrate and PCR jitter. PCR
+ * jitter is the deviation of each PCR from where a constant-rate stream
+ * would put it, so it reflects the broadcast/tuner side rather than the
+ * network: CC/TEI errors with clean PCRs point at reception, PCR jitter
+ * at the multiplex, and clean numbers with a complaining viewer at the
+ * network.
+ *
+ * It also notes when the first PAT and the first PMT of a program it
+ * lists arrive, for stream startup tracing.
+ *
+ * Active sessions are registered so /status can report them.
+ */
+
+#ifndef TS_HEALTH_H
+#define TS_HEALTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include "metrics.h"
+
+#define TS_PACKET_SIZE 188
+#define TS_HEALTH_MAX_PIDS 48      /**< PIDs tracked per session; more are counted as untracked */
+
+/**
+ * Counters for one PID
+ */
+typedef struct {
+    uint16_t pid;
+    int8_t last_cc;                /**< -1 until the first payload packet */
+    uint64_t packets;
+    uint64_t cc_errors;
+    uint64_t tei_packets;
+    uint64_t pcr_count;
+    uint64_t last_pcr;             /**< 27 MHz units */
+    uint64_t last_pcr_packet;      /**< Session packet index of last_pcr */
+    double bitrate_bps;            /**< Smoothed TS rate between PCRs */
+    double jitter_avg_us;          /**< Smoothed |PCR error| */
+    double jitter_max_us;          /**< Worst |PCR error| seen */
+} TsPidHealth;
+
+/**
+ * One relay session; fed by the relay thread only
+ */
+typedef struct TsHealth {
+    char channel[32];
+    char client[64];
+    int tuner_id;                  /**< Adapter number */
+    int tuner_index;               /**< Index into tuners[] for metrics */
+    time_t started;
+    MetricsStream *metrics;        /**< Per-channel counters (may be NULL) */
+
+    pthread_mutex_t lock;          /**< Guards the counters against /status readers */
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t null_packets;
+    uint64_t tei_packets;
+    uint64_t cc_errors;
+    uint64_t sync_losses;
+    uint64_t untracked_packets;    /**< Packets on PIDs beyond the table */
+    int pat_seen;                  /**< A PAT section has started */
+    int pmt_seen;                  /**< A PMT listed in the PAT has started */
+    uint8_t pmt_pid[8192 / 8];     /**< Bitmap of PMT PIDs from the PAT */
+    int pid_count;
+    TsPidHealth pids[TS_HEALTH_MAX_PIDS];
+
+    int16_t pid_slot[8192];        /**< PID -> index into pids, -1 if none */
+    unsigned char carry[TS_PACKET_SIZE];
+    int carry_len;
+    struct TsHealth *next;
+} TsHealth;
+
+/**
+ * Start analysing a relay session and register it for /status
+ * @return New session, or NULL on allocation failure
+ */
+TsHealth *ts_health_open(const char *channel, int tuner_id, int tuner_index,
+                         const char *client, MetricsStream *metrics);
+
+/**
+ * Account one relayed chunk (any length; packets may straddle chunks)
+ */
+void ts_health_feed(TsHealth *h, const unsigned char *buf, size_t len);
+
+/**
+ * Unregister and free a session
+ */
+void ts_health_close(TsHealth *h);
+
+/**
+ * Describe every active session as JSON
+ * @return Allocated string (caller must free), or NULL on failure
+ */
+char *ts_health_status_json(void);
+
+#endif
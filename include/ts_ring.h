@@ -0,0 +1,95 @@
+/**
+ * @file ts_ring.h
+ * @brief Lock-free single-producer/single-consumer ring of TS batches
+ *
+ * Connects the capture stage of an EPG scan (reading the zap pipe) to
+ * its parse stage. The producer reads straight into a free slot and
+ * publishes it; the consumer parses the slot in place and hands it
+ * back. Slot ownership moves with two atomic indices, so the data path
+ * takes no locks.
+ *
+ * Each slot reserves headroom in front of the data so the consumer can
+ * prepend an unparsed tail from the previous batch without copying the
+ * batch itself.
+ *
+ * The consumer sleeps on a condition variable only when the ring is
+ * empty, and a producer waiting for space only when it is full. Each
+ * side touches the mutex only if the other is asleep.
+ */
+
+#ifndef TS_RING_H
+#define TS_RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define TS_RING_SLOTS 16                 /**< Batches in flight (power of two) */
+#define TS_RING_SLOT_BYTES (32 * 1024)   /**< Capture bytes per batch */
+#define TS_RING_HEADROOM 1024            /**< Room for a carried-over tail */
+
+/**
+ * One batch of captured bytes
+ * Data written by the producer starts at data + TS_RING_HEADROOM.
+ */
+typedef struct {
+    size_t len;
+    unsigned char data[TS_RING_HEADROOM + TS_RING_SLOT_BYTES];
+} TsBatch;
+
+typedef struct {
+    _Alignas(64) atomic_size_t head;    /**< Next slot to publish (producer) */
+    _Alignas(64) atomic_size_t tail;    /**< Next slot to consume (consumer) */
+    _Alignas(64) atomic_int closed;     /**< Producer is done */
+    atomic_int sleeping;                /**< Consumer waiting on wake */
+    atomic_int producer_sleeping;       /**< Producer waiting on space */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t space;
+    TsBatch slots[TS_RING_SLOTS];
+} TsRing;
+
+/**
+ * Initialize an empty, open ring
+ */
+void ts_ring_init(TsRing *r);
+
+/**
+ * Release the ring's synchronization objects
+ */
+void ts_ring_destroy(TsRing *r);
+
+/**
+ * Producer: get the next free slot
+ * @return Slot to fill, or NULL if the ring is full
+ */
+TsBatch *ts_ring_reserve(TsRing *r);
+
+/**
+ * Producer: get the next free slot, waiting for the consumer to release
+ * one if the ring is full
+ */
+TsBatch *ts_ring_reserve_wait(TsRing *r);
+
+/**
+ * Producer: publish the slot from ts_ring_reserve()
+ */
+void ts_ring_publish(TsRing *r);
+
+/**
+ * Producer: mark the end of input and wake the consumer
+ */
+void ts_ring_close(TsRing *r);
+
+/**
+ * Consumer: wait for the next published slot
+ * @return Oldest published slot, or NULL once closed and drained
+ */
+TsBatch *ts_ring_next(TsRing *r);
+
+/**
+ * Consumer: return the slot from ts_ring_next() to the producer
+ */
+void ts_ring_release(TsRing *r);
+
+#endif
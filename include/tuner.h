@@ -5,6 +5,11 @@
  * Manages access to DVB tuner hardware (/dev/dvb/adapter*).
  * Implements a priority-based acquisition system where live streams
  * can preempt background EPG scans.
+ *
+ * Every hand-over of a tuner bumps its generation. Holders keep the
+ * generation they acquired and release through release_tuner_if(), so
+ * a holder that was preempted can never release (or kill the process
+ * of) the tuner's new user.
  */
 
 #ifndef TUNER_H
@@ -19,7 +24,8 @@
 typedef enum {
     USER_NONE = 0,   /**< Tuner is idle */
     USER_STREAM,     /**< Live streaming (highest priority) */
-    USER_EPG         /**< EPG data collection (can be preempted) */
+    USER_EPG,        /**< EPG data collection (can be preempted) */
+    USER_LINGER      /**< Stream capture kept warm after its viewers left (reclaimable) */
 } TunerUser;
 
 /**
@@ -31,6 +37,7 @@ typedef struct {
     int in_use;          /**< Whether tuner is currently acquired */
     pid_t zap_pid;       /**< PID of dvbv5-zap process using this tuner */
     TunerUser user_type; /**< Current usage type */
+    unsigned generation; /**< Bumped on every acquisition */
 } Tuner;
 
 /** Array of discovered tuners */
@@ -50,18 +57,38 @@ void discover_tuners();
  * 
  * Acquisition priority:
  * 1. First, try to find an idle tuner
- * 2. If purpose is USER_STREAM, preempt a USER_EPG tuner
+ * 2. Reclaim a lingering (warm) tuner, stopping its capture
+ * 3. If purpose is USER_STREAM, preempt a USER_EPG tuner
  * 
  * @param purpose The intended use for the tuner
+ * @param generation Receives the tuner's new generation (may be NULL)
  * @return Pointer to acquired Tuner, or NULL if none available
  */
-Tuner *acquire_tuner(TunerUser purpose);
+Tuner *acquire_tuner(TunerUser purpose, unsigned *generation);
 
 /**
- * Release a tuner back to the pool
- * Terminates any child processes (zap) and marks tuner as available
- * @param t Pointer to tuner to release
+ * Release a tuner back to the pool, unless it has been handed to someone
+ * else since the given acquisition
+ * Terminates its zap process and marks the tuner as available.
+ * @return 1 if released, 0 if it had already changed hands
  */
-void release_tuner(Tuner *t);
+int release_tuner_if(Tuner *t, unsigned generation);
+
+/**
+ * Mark a held stream tuner as lingering (reclaimable) or back in use
+ * @return 1 on success, 0 if the tuner has changed hands
+ */
+int tuner_linger(Tuner *t, unsigned generation, int linger);
+
+/**
+ * Record the zap process running on a held tuner
+ * @return 1 on success, 0 if the tuner has changed hands (pid is not recorded)
+ */
+int tuner_set_zap(Tuner *t, unsigned generation, pid_t pid);
+
+/**
+ * Count tuners currently held for a purpose (USER_NONE counts idle ones)
+ */
+int tuner_count_by_user(TunerUser user);
 
 #endif
@@ -0,0 +1,741 @@
+/**
+ * @file capture.c
+ * @brief Shared per-mux tuner captures with a warm linger period
+ *
+ * Lock order: capture_list_mutex, then a capture's lock, then the tuner
+ * mutex (inside the tuner_* calls). The reader thread never holds a
+ * capture lock while calling into the tuner layer.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "capture.h"
+#include "config.h"
+#include "tuner.h"
+#include "metrics.h"
+#include "log.h"
+#include "timeshift.h"
+
+#define TS_PACKET 188
+
+/* Keep this much ring ahead of a keyframe start so the viewer is not
+ * overrun before it has caught up */
+#define CAPTURE_KEY_MARGIN (CAPTURE_RING_BYTES / 4)
+
+/* Largest copy the spill thread makes per lock hold */
+#define SPILL_CHUNK (TS_PACKET * 7 * 64)
+
+/* PID roles in the startup cache */
+#define PID_PMT   1
+#define PID_VIDEO 2
+
+int stream_linger_secs = STREAM_LINGER_SECS;
+
+/* PSI and newest keyframe of one program */
+typedef struct {
+    int program;                /* program_number, 0 = unused slot */
+    int pmt_pid;
+    int video_pid;              /* -1 until the PMT names one */
+    int video_type;             /* PMT stream_type of video_pid */
+    unsigned char pmt[TS_PACKET];
+    int have_pmt;
+    uint64_t key_pos;           /* Ring offset of the keyframe's first packet */
+    int have_key;
+    unsigned char key_pat[TS_PACKET];   /* PSI as it stood before key_pos */
+    unsigned char key_pmt[TS_PACKET];
+} CaptureProgram;
+
+struct Capture {
+    uint32_t freq_hz;
+    char number[32];            /* Channel that started the capture (logging) */
+    Tuner *tuner;
+    unsigned generation;        /* Our hold on the tuner */
+    pid_t pid;
+    int fd;                     /* zap stdout */
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* Signalled on new data and on death */
+    unsigned char *ring;
+    uint64_t head;              /* Absolute bytes committed, always whole packets */
+    int viewers;
+    int refs;                   /* Reader thread + viewers */
+    int dead;
+    time_t linger_until;        /* Set while nobody watches */
+
+    Timeshift *timeshift;       /* NULL unless -T */
+    uint64_t spill_pos;         /* Next ring offset to spill to it */
+
+    /* Startup cache, guarded by lock */
+    unsigned char pat[TS_PACKET];
+    int have_pat;
+    int pat_version;
+    int program_count;
+    CaptureProgram programs[CAPTURE_MAX_PROGRAMS];
+    uint8_t pid_role[8192];
+
+    struct Capture *next;
+};
+
+static Capture *captures = NULL;
+static pthread_mutex_t capture_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void capture_unref(Capture *cap) {
+    pthread_mutex_lock(&cap->lock);
+    int left = --cap->refs;
+    pthread_mutex_unlock(&cap->lock);
+    if (left) return;
+    pthread_mutex_destroy(&cap->lock);
+    pthread_cond_destroy(&cap->cond);
+    timeshift_destroy(cap->timeshift);
+    free(cap->ring);
+    free(cap);
+}
+
+// -----------------------------------------------------------------------------
+// Startup cache (PAT, PMT, keyframe offsets); called with the lock held
+// -----------------------------------------------------------------------------
+
+// Payload of a packet, or NULL; *len receives its size
+static const unsigned char *ts_payload(const unsigned char *p, int *len) {
+    int afc = (p[3] >> 4) & 0x3;
+    if (!(afc & 0x1)) return NULL;
+    int offset = 4;
+    if (afc & 0x2) offset += 1 + p[4];
+    if (offset >= TS_PACKET) return NULL;
+    *len = TS_PACKET - offset;
+    return p + offset;
+}
+
+// A whole PSI section of the given table starting in this packet, or NULL
+static const unsigned char *single_section(const unsigned char *payload, int len, int table_id, int *sec_len) {
+    int pointer = payload[0];
+    if (1 + pointer + 3 > len) return NULL;
+    const unsigned char *sec = payload + 1 + pointer;
+    if (sec[0] != table_id) return NULL;
+    *sec_len = ((sec[1] & 0x0F) << 8) | sec[2];
+    // Sections spanning packets cannot be replayed from one cached packet
+    if (1 + pointer + 3 + *sec_len > len || *sec_len < 9) return NULL;
+    return sec;
+}
+
+static void cache_pat(Capture *cap, const unsigned char *p, const unsigned char *payload, int len) {
+    int sec_len;
+    const unsigned char *sec = single_section(payload, len, 0x00, &sec_len);
+    if (!sec || !(sec[5] & 0x01)) return;   /* current_next_indicator */
+    memcpy(cap->pat, p, TS_PACKET);
+    cap->have_pat = 1;
+
+    int version = (sec[5] >> 1) & 0x1F;
+    if (cap->program_count && version == cap->pat_version) return;
+
+    // New lineup: forget every program
+    cap->pat_version = version;
+    cap->program_count = 0;
+    memset(cap->programs, 0, sizeof(cap->programs));
+    memset(cap->pid_role, 0, sizeof(cap->pid_role));
+    int end = 3 + sec_len - 4;
+    for (int i = 8; i + 4 <= end && cap->program_count < CAPTURE_MAX_PROGRAMS; i += 4) {
+        int program = (sec[i] << 8) | sec[i + 1];
+        int pid = ((sec[i + 2] & 0x1F) << 8) | sec[i + 3];
+        if (program == 0) continue;   /* Network PID */
+        CaptureProgram *prog = &cap->programs[cap->program_count++];
+        prog->program = program;
+        prog->pmt_pid = pid;
+        prog->video_pid = -1;
+        cap->pid_role[pid] = PID_PMT;
+    }
+}
+
+static int is_video_type(int stream_type) {
+    return stream_type == 0x02 || stream_type == 0x1B || stream_type == 0x24;
+}
+
+static void cache_pmt(Capture *cap, int pid, const unsigned char *p, const unsigned char *payload, int len) {
+    int sec_len;
+    const unsigned char *sec = single_section(payload, len, 0x02, &sec_len);
+    if (!sec || !(sec[5] & 0x01)) return;
+    int program = (sec[3] << 8) | sec[4];
+
+    for (int i = 0; i < cap->program_count; i++) {
+        CaptureProgram *prog = &cap->programs[i];
+        if (prog->program != program || prog->pmt_pid != pid) continue;
+        memcpy(prog->pmt, p, TS_PACKET);
+        prog->have_pmt = 1;
+
+        int end = 3 + sec_len - 4;
+        int pos = 12 + (((sec[10] & 0x0F) << 8) | sec[11]);
+        int video_pid = -1, video_type = 0;
+        while (pos + 5 <= end) {
+            int type = sec[pos];
+            int es_pid = ((sec[pos + 1] & 0x1F) << 8) | sec[pos + 2];
+            if (video_pid < 0 && is_video_type(type)) {
+                video_pid = es_pid;
+                video_type = type;
+            }
+            pos += 5 + (((sec[pos + 3] & 0x0F) << 8) | sec[pos + 4]);
+        }
+        if (video_pid != prog->video_pid) {
+            if (prog->video_pid >= 0 && cap->pid_role[prog->video_pid] == PID_VIDEO) {
+                cap->pid_role[prog->video_pid] = 0;
+            }
+            prog->video_pid = video_pid;
+            prog->have_key = 0;
+            if (video_pid >= 0) cap->pid_role[video_pid] = PID_VIDEO;
+        }
+        prog->video_type = video_type;
+        return;
+    }
+}
+
+// Does the start of this PES carry a random access point?
+static int pes_starts_keyframe(const unsigned char *payload, int len, int stream_type) {
+    if (len < 9 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1) return 0;
+    int start = 9 + payload[8];
+    // Start codes in the first packet: sequence headers and parameter sets
+    // come right after the PES header (behind an access unit delimiter)
+    for (int i = start; i + 3 < len; i++) {
+        if (payload[i] != 0 || payload[i + 1] != 0 || payload[i + 2] != 1) continue;
+        int code = payload[i + 3];
+        switch (stream_type) {
+            case 0x02:  /* MPEG-2: sequence header */
+                if (code == 0xB3) return 1;
+                break;
+            case 0x1B:  /* H.264: SPS or IDR slice */
+                if ((code & 0x1F) == 7 || (code & 0x1F) == 5) return 1;
+                break;
+            case 0x24:  /* HEVC: VPS/SPS or IRAP slice */
+                if (((code >> 1) & 0x3F) >= 16 && ((code >> 1) & 0x3F) <= 33) return 1;
+                break;
+        }
+        i += 3;
+    }
+    return 0;
+}
+
+static void cache_packet(Capture *cap, const unsigned char *p, uint64_t pos) {
+    if (p[0] != 0x47 || (p[1] & 0x80) || !(p[1] & 0x40)) return;   /* Only PUSI packets matter */
+    int pid = ((p[1] & 0x1F) << 8) | p[2];
+    if (pid != 0 && !cap->pid_role[pid]) return;
+
+    int len;
+    const unsigned char *payload = ts_payload(p, &len);
+    if (!payload) return;
+
+    if (pid == 0) {
+        cache_pat(cap, p, payload, len);
+    } else if (cap->pid_role[pid] == PID_PMT) {
+        cache_pmt(cap, pid, p, payload, len);
+    } else {
+        for (int i = 0; i < cap->program_count; i++) {
+            CaptureProgram *prog = &cap->programs[i];
+            if (prog->video_pid != pid || !prog->have_pmt || !cap->have_pat) continue;
+            if (!pes_starts_keyframe(payload, len, prog->video_type)) continue;
+            prog->key_pos = pos;
+            memcpy(prog->key_pat, cap->pat, TS_PACKET);
+            memcpy(prog->key_pmt, prog->pmt, TS_PACKET);
+            prog->have_key = 1;
+        }
+    }
+}
+
+// Position a new viewer of a running capture; called with the lock held
+static void viewer_start(Capture *cap, CaptureViewer *v, int service_id) {
+    v->pos = cap->head;
+    const CaptureProgram *prog = NULL;
+    for (int i = 0; i < cap->program_count; i++) {
+        if (cap->programs[i].program == service_id) prog = &cap->programs[i];
+    }
+    if (!prog || !prog->have_pmt || !cap->have_pat) return;
+
+    if (prog->have_key && cap->head - prog->key_pos <= CAPTURE_RING_BYTES - CAPTURE_KEY_MARGIN) {
+        // Back up to the keyframe, preceded by the PSI that came before it
+        v->pos = prog->key_pos;
+        memcpy(v->prefix, prog->key_pat, TS_PACKET);
+        memcpy(v->prefix + TS_PACKET, prog->key_pmt, TS_PACKET);
+        metrics_add(METRIC_STREAM_KEYFRAME_STARTS, 1);
+    } else {
+        // No usable keyframe: at least spare the wait for PAT and PMT
+        memcpy(v->prefix, cap->pat, TS_PACKET);
+        memcpy(v->prefix + TS_PACKET, prog->pmt, TS_PACKET);
+    }
+    v->prefix_len = 2 * TS_PACKET;
+}
+
+// Append whole packets to the ring
+static void capture_commit(Capture *cap, const unsigned char *buf, size_t len) {
+    pthread_mutex_lock(&cap->lock);
+    for (size_t i = 0; i < len; i += TS_PACKET) {
+        cache_packet(cap, buf + i, cap->head + i);
+    }
+    size_t off = cap->head % CAPTURE_RING_BYTES;
+    size_t first = CAPTURE_RING_BYTES - off;
+    if (first > len) first = len;
+    memcpy(cap->ring + off, buf, first);
+    memcpy(cap->ring, buf + first, len - first);
+    cap->head += len;
+    pthread_cond_broadcast(&cap->cond);
+    pthread_mutex_unlock(&cap->lock);
+}
+
+// Copy ring bytes [pos, pos + len) out; called with the lock held
+static void ring_copy(const Capture *cap, uint64_t pos, unsigned char *buf, size_t len) {
+    size_t off = pos % CAPTURE_RING_BYTES;
+    size_t first = CAPTURE_RING_BYTES - off;
+    if (first > len) first = len;
+    memcpy(buf, cap->ring + off, first);
+    memcpy(buf + first, cap->ring, len - first);
+}
+
+// Oldest ring offset still held in memory; called with the lock held
+static uint64_t ring_start(const Capture *cap) {
+    return cap->head > CAPTURE_RING_BYTES ? cap->head - CAPTURE_RING_BYTES : 0;
+}
+
+// Drain the ring to the timeshift file behind the live readers
+static void *capture_spill(void *arg) {
+    Capture *cap = arg;
+    unsigned char *buf = malloc(SPILL_CHUNK);
+
+    pthread_mutex_lock(&cap->lock);
+    while (buf) {
+        while (cap->spill_pos == cap->head && !cap->dead) {
+            pthread_cond_wait(&cap->cond, &cap->lock);
+        }
+        if (cap->spill_pos == cap->head) break;   /* Dead and drained */
+        if (cap->spill_pos < ring_start(cap)) cap->spill_pos = ring_start(cap);
+
+        uint64_t pos = cap->spill_pos;
+        size_t n = cap->head - pos;
+        if (n > SPILL_CHUNK) n = SPILL_CHUNK;
+        ring_copy(cap, pos, buf, n);
+        pthread_mutex_unlock(&cap->lock);
+
+        // Disk latency lands here, never on the reader or the viewers
+        timeshift_append(cap->timeshift, buf, n, pos);
+
+        pthread_mutex_lock(&cap->lock);
+        cap->spill_pos = pos + n;
+    }
+    pthread_mutex_unlock(&cap->lock);
+
+    free(buf);
+    capture_unref(cap);
+    return NULL;
+}
+
+// Unpublish first so nobody attaches to a capture that is going away.
+// With if_idle the linger check is repeated under both locks, since a
+// viewer may have attached after the reader saw it expire; returns 0
+// and leaves the capture live in that case.
+static int capture_unpublish(Capture *cap, int if_idle) {
+    pthread_mutex_lock(&capture_list_mutex);
+    pthread_mutex_lock(&cap->lock);
+    if (if_idle && (cap->viewers > 0 || time(NULL) < cap->linger_until)) {
+        pthread_mutex_unlock(&cap->lock);
+        pthread_mutex_unlock(&capture_list_mutex);
+        return 0;
+    }
+    for (Capture **pp = &captures; *pp; pp = &(*pp)->next) {
+        if (*pp == cap) {
+            *pp = cap->next;
+            break;
+        }
+    }
+    cap->dead = 1;
+    pthread_cond_broadcast(&cap->cond);
+    pthread_mutex_unlock(&cap->lock);
+    pthread_mutex_unlock(&capture_list_mutex);
+    return 1;
+}
+
+static void *capture_reader(void *arg) {
+    Capture *cap = arg;
+    unsigned char buf[TS_PACKET * 64];
+    size_t fill = 0;
+    const char *why = "zap exited";
+    int unpublished = 0;
+
+    for (;;) {
+        struct pollfd pfd = { .fd = cap->fd, .events = POLLIN };
+        int pr = poll(&pfd, 1, 1000);
+        if (pr < 0 && errno != EINTR) {
+            why = "poll failed";
+            break;
+        }
+        if (pr > 0) {
+            ssize_t n = read(cap->fd, buf + fill, sizeof(buf) - fill);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            fill += n;
+            // Commit whole packets so every viewer starts on a boundary
+            size_t whole = fill - fill % TS_PACKET;
+            if (whole) {
+                capture_commit(cap, buf, whole);
+                memmove(buf, buf + whole, fill - whole);
+                fill -= whole;
+            }
+        }
+
+        pthread_mutex_lock(&cap->lock);
+        int expired = cap->viewers == 0 && time(NULL) >= cap->linger_until;
+        pthread_mutex_unlock(&cap->lock);
+        if (expired && capture_unpublish(cap, 1)) {
+            why = "linger expired";
+            unpublished = 1;
+            break;
+        }
+    }
+    if (!unpublished) capture_unpublish(cap, 0);
+
+    close(cap->fd);
+    // No-op if the tuner was reclaimed; its new owner already stopped zap
+    if (!release_tuner_if(cap->tuner, cap->generation)) why = "tuner reclaimed";
+    LOG_DEBUG("CAPTURE", "Mux %u (%s) on Tuner %d closed: %s",
+              cap->freq_hz, cap->number, cap->tuner->id, why);
+    capture_unref(cap);
+    return NULL;
+}
+
+// Fork dvbv5-zap on the tuner; returns its stdout, or -1
+static int spawn_zap(Tuner *t, const Channel *chan, pid_t *pid_out) {
+    // execfd reports exec failure (an errno) or, by closing on exec, success
+    int pipefd[2];
+    int execfd[2];
+    if (pipe(pipefd) == -1) {
+        LOG_ERROR("CAPTURE", "pipe: %s", strerror(errno));
+        return -1;
+    }
+    if (pipe2(execfd, O_CLOEXEC) == -1) {
+        LOG_ERROR("CAPTURE", "pipe: %s", strerror(errno));
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+
+    char adapter_id[8];
+    snprintf(adapter_id, sizeof(adapter_id), "%d", t->id);
+    LOG_DEBUG("CAPTURE", "Executing: dvbv5-zap -c %s -P -a %s -o - \"%s\"", channels_conf_path, adapter_id, chan->number);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Child: exec dvbv5-zap (no logging here: the log writer thread
+        // does not exist in the child)
+        close(pipefd[0]);
+        close(execfd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+
+        execlp("dvbv5-zap", "dvbv5-zap", "-c", channels_conf_path, "-P", "-a", adapter_id, "-o", "-", chan->number, NULL);
+        int err = errno;
+        write(execfd[1], &err, sizeof(err));
+        _exit(1);
+    }
+    close(pipefd[1]);
+    close(execfd[1]);
+    if (pid < 0) {
+        LOG_ERROR("CAPTURE", "fork: %s", strerror(errno));
+        close(pipefd[0]);
+        close(execfd[0]);
+        return -1;
+    }
+
+    int exec_err = 0;
+    ssize_t r;
+    while ((r = read(execfd[0], &exec_err, sizeof(exec_err))) < 0 && errno == EINTR) {}
+    close(execfd[0]);
+    if (r > 0) {
+        LOG_ERROR("CAPTURE", "Cannot run dvbv5-zap: %s", strerror(exec_err));
+        waitpid(pid, NULL, 0);
+        close(pipefd[0]);
+        return -1;
+    }
+    *pid_out = pid;
+    return pipefd[0];
+}
+
+static CaptureViewer *viewer_new(Capture *cap, int warm) {
+    CaptureViewer *v = calloc(1, sizeof(CaptureViewer));
+    if (!v) return NULL;
+    v->cap = cap;
+    v->tuner_id = cap->tuner->id;
+    v->tuner_index = (int)(cap->tuner - tuners);
+    v->warm = warm;
+    return v;
+}
+
+// Join a live or lingering capture of the mux; called with the list locked
+static CaptureViewer *attach_existing(uint32_t freq_hz, int service_id) {
+    for (Capture *cap = captures; cap; cap = cap->next) {
+        if (cap->freq_hz != freq_hz) continue;
+        pthread_mutex_lock(&cap->lock);
+        if (cap->dead) {
+            pthread_mutex_unlock(&cap->lock);
+            continue;
+        }
+        // A lingering tuner may have just been reclaimed; then zap is
+        // gone and the reader will notice EOF shortly
+        if (cap->viewers == 0 && !tuner_linger(cap->tuner, cap->generation, 0)) {
+            pthread_mutex_unlock(&cap->lock);
+            continue;
+        }
+        CaptureViewer *v = viewer_new(cap, 1);
+        if (!v) {
+            if (cap->viewers == 0) tuner_linger(cap->tuner, cap->generation, 1);
+            pthread_mutex_unlock(&cap->lock);
+            return NULL;
+        }
+        cap->viewers++;
+        cap->refs++;
+        viewer_start(cap, v, service_id);
+        pthread_mutex_unlock(&cap->lock);
+        return v;
+    }
+    return NULL;
+}
+
+CaptureViewer *capture_open(const Channel *chan, StreamTrace *tr, CaptureError *err) {
+    if (err) *err = CAPTURE_OK;
+
+    pthread_mutex_lock(&capture_list_mutex);
+    CaptureViewer *v = attach_existing(chan->freq_hz, chan->sid);
+    pthread_mutex_unlock(&capture_list_mutex);
+    if (v) {
+        metrics_add(METRIC_STREAM_WARM_STARTS, 1);
+        tr->warm = 1;
+        tr->tuner_id = v->tuner_id;
+        trace_mark(tr, TRACE_TUNER);
+        trace_mark(tr, TRACE_SPAWNED);
+        LOG_DEBUG("CAPTURE", "%s attached to running capture of mux %u on Tuner %d (%s)",
+                  chan->number, chan->freq_hz, v->tuner_id,
+                  v->prefix_len ? "cached PSI" : "live");
+        return v;
+    }
+
+    // Cold start: acquire a tuner for STREAM
+    unsigned gen = 0;
+    Tuner *t = acquire_tuner(USER_STREAM, &gen);
+    if (!t) {
+        uint64_t wait_start = metrics_now_ns();
+        metrics_add(METRIC_TUNER_WAITS, 1);
+        int retries = 5;
+        while (!t && retries-- > 0) {
+            usleep(500000); // 500ms
+            tr->retries++;
+            t = acquire_tuner(USER_STREAM, &gen);
+        }
+        metrics_observe(METRIC_TUNER_WAIT, metrics_now_ns() - wait_start);
+    }
+    if (!t) {
+        metrics_add(METRIC_TUNER_UNAVAILABLE, 1);
+        if (err) *err = CAPTURE_NO_TUNER;
+        return NULL;
+    }
+    trace_mark(tr, TRACE_TUNER);
+    tr->tuner_id = t->id;
+
+    Capture *cap = calloc(1, sizeof(Capture));
+    if (cap) cap->ring = malloc(CAPTURE_RING_BYTES);
+    if (!cap || !cap->ring) {
+        if (cap) free(cap);
+        release_tuner_if(t, gen);
+        if (err) *err = CAPTURE_SPAWN_FAILED;
+        return NULL;
+    }
+    cap->freq_hz = chan->freq_hz;
+    snprintf(cap->number, sizeof(cap->number), "%s", chan->number);
+    cap->tuner = t;
+    cap->generation = gen;
+    cap->refs = 1;
+    pthread_mutex_init(&cap->lock, NULL);
+    pthread_cond_init(&cap->cond, NULL);
+
+    cap->fd = spawn_zap(t, chan, &cap->pid);
+    if (cap->fd < 0 || !tuner_set_zap(t, gen, cap->pid)) {
+        // Not recording the pid means release_tuner_if() won't kill it
+        if (cap->fd >= 0) {
+            close(cap->fd);
+            kill(cap->pid, SIGTERM);
+            waitpid(cap->pid, NULL, 0);
+        }
+        release_tuner_if(t, gen);
+        capture_unref(cap);
+        if (err) *err = CAPTURE_SPAWN_FAILED;
+        return NULL;
+    }
+    trace_mark(tr, TRACE_SPAWNED);
+
+    v = viewer_new(cap, 0);
+    if (!v) {
+        release_tuner_if(t, gen);
+        close(cap->fd);
+        capture_unref(cap);
+        if (err) *err = CAPTURE_SPAWN_FAILED;
+        return NULL;
+    }
+    cap->viewers = 1;
+    cap->refs = 2;
+
+    if (timeshift_minutes > 0) {
+        pthread_t spill;
+        cap->timeshift = timeshift_create(cap->freq_hz, timeshift_minutes);
+        if (cap->timeshift && pthread_create(&spill, NULL, capture_spill, cap) == 0) {
+            pthread_detach(spill);
+            cap->refs++;
+        } else if (cap->timeshift) {
+            timeshift_destroy(cap->timeshift);
+            cap->timeshift = NULL;
+        }
+    }
+
+    // Published before the reader runs so its unlink always finds it
+    pthread_mutex_lock(&capture_list_mutex);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, capture_reader, cap) != 0) {
+        pthread_mutex_unlock(&capture_list_mutex);
+        release_tuner_if(t, gen);
+        close(cap->fd);
+        free(v);
+        // The spill thread, if any, drops its own reference once woken
+        pthread_mutex_lock(&cap->lock);
+        cap->dead = 1;
+        pthread_cond_broadcast(&cap->cond);
+        pthread_mutex_unlock(&cap->lock);
+        capture_unref(cap);
+        capture_unref(cap);
+        if (err) *err = CAPTURE_SPAWN_FAILED;
+        return NULL;
+    }
+    pthread_detach(thread);
+    cap->next = captures;
+    captures = cap;
+    pthread_mutex_unlock(&capture_list_mutex);
+    return v;
+}
+
+// Move a viewer that is no longer in the ring; called with the lock held
+static void viewer_overrun(Capture *cap, CaptureViewer *v, uint64_t oldest) {
+    v->overruns++;
+    v->pos = oldest;
+    v->prefix_len = 0;
+    if (v->overruns == 1 || v->overruns % 100 == 0) {
+        LOG_WARN("CAPTURE", "Viewer of mux %u fell behind (%lu overruns)",
+                 cap->freq_hz, (unsigned long)v->overruns);
+    }
+}
+
+ssize_t capture_read(CaptureViewer *v, unsigned char *buf, size_t len) {
+    Capture *cap = v->cap;
+    if (v->prefix_sent < v->prefix_len) {
+        size_t n = v->prefix_len - v->prefix_sent;
+        if (n > len) n = len;
+        memcpy(buf, v->prefix + v->prefix_sent, n);
+        v->prefix_sent += n;
+        return n;
+    }
+    if (v->limit) {
+        if (v->pos >= v->limit) return 0;
+        if (len > v->limit - v->pos) len = v->limit - v->pos;
+    }
+
+    pthread_mutex_lock(&cap->lock);
+    while (v->pos == cap->head && !cap->dead) {
+        pthread_cond_wait(&cap->cond, &cap->lock);
+    }
+    if (v->pos < ring_start(cap)) {
+        // Paused or rewound past memory: serve from the timeshift file
+        if (cap->timeshift) {
+            pthread_mutex_unlock(&cap->lock);
+            ssize_t n = timeshift_read(cap->timeshift, v->pos, buf, len);
+            if (n > 0) {
+                v->pos += n;
+                return n;
+            }
+            uint64_t start, end;
+            timeshift_window(cap->timeshift, &start, &end);
+            pthread_mutex_lock(&cap->lock);
+            // Fell out of the window: resume at the oldest data we still have
+            viewer_overrun(cap, v, v->pos < start && start < end ? start : cap->head);
+        } else {
+            // Overwritten while the client stalled; resume at live
+            viewer_overrun(cap, v, cap->head);
+        }
+        pthread_mutex_unlock(&cap->lock);
+        return capture_read(v, buf, len);
+    }
+    size_t avail = cap->head - v->pos;
+    if (len > avail) len = avail;
+    ring_copy(cap, v->pos, buf, len);
+    v->pos += len;
+    pthread_mutex_unlock(&cap->lock);
+    return len;
+}
+
+void capture_window(CaptureViewer *v, uint64_t *start, uint64_t *end) {
+    Capture *cap = v->cap;
+    pthread_mutex_lock(&cap->lock);
+    *start = ring_start(cap);
+    *end = cap->head;
+    pthread_mutex_unlock(&cap->lock);
+    if (cap->timeshift) {
+        uint64_t ts_start, ts_end;
+        timeshift_window(cap->timeshift, &ts_start, &ts_end);
+        if (ts_start < ts_end && ts_end >= *start && ts_start < *start) *start = ts_start;
+    }
+}
+
+int capture_seek_time(CaptureViewer *v, double seconds) {
+    uint64_t pos;
+    if (!v->cap->timeshift || !timeshift_seek(v->cap->timeshift, seconds, &pos)) return 0;
+    v->pos = pos;
+    v->prefix_len = 0;
+    return 1;
+}
+
+int capture_seek_range(CaptureViewer *v, uint64_t start, uint64_t end) {
+    uint64_t first, last;
+    capture_window(v, &first, &last);
+    // Capture offsets are packet aligned; a player's range need not be
+    start -= start % TS_PACKET;
+    if (start < first || start >= last) return 0;
+    if (end > last) end = last;
+    end -= end % TS_PACKET;
+    if (end <= start) end = start + TS_PACKET;
+    v->pos = start;
+    v->limit = end;
+    v->prefix_len = 0;
+    return 1;
+}
+
+void capture_close(CaptureViewer *v) {
+    if (!v) return;
+    Capture *cap = v->cap;
+    int release_now = 0;
+
+    pthread_mutex_lock(&cap->lock);
+    if (--cap->viewers == 0 && !cap->dead) {
+        if (stream_linger_secs > 0 && tuner_linger(cap->tuner, cap->generation, 1)) {
+            cap->linger_until = time(NULL) + stream_linger_secs;
+            LOG_DEBUG("CAPTURE", "Mux %u idle; keeping Tuner %d tuned for %ds",
+                      cap->freq_hz, cap->tuner->id, stream_linger_secs);
+        } else {
+            // Stop zap now; the reader sees EOF and tears down
+            cap->linger_until = 0;
+            release_now = 1;
+        }
+    }
+    pthread_mutex_unlock(&cap->lock);
+
+    if (release_now) release_tuner_if(cap->tuner, cap->generation);
+    free(v);
+    capture_unref(cap);
+}
@@ -15,20 +15,47 @@
  * - By virtual channel number (e.g., "15.1")
  * - By frequency + service_id (for accurate EPG mapping)
  * - Duplicate VCN detection (same virtual channel on different frequencies)
+ *
+ * After loading, channels are indexed by two open hash tables (number and
+ * frequency+service_id) with index-based chains, and each channel's
+ * integer fields and XMLTV unique ID are precomputed.
+ *
+ * Publication (RCU-style):
+ * The current ChannelTable is an atomic pointer. Readers enter the active
+ * epoch, load the pointer, take a reference and leave the epoch; none of
+ * this takes a lock. A reload swaps the pointer, flips the epoch and waits
+ * for readers still in the old epoch before dropping the published
+ * reference, so a table is never freed under a reader about to pin it.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <libgen.h>
+#include <sys/inotify.h>
 #include "channels.h"
 #include "config.h"
+#include "log.h"
 
-/* Global channel storage */
-Channel channels[MAX_CHANNELS];
-int channel_count = 0;
 char channels_conf_path[512] = CHANNELS_CONF;
 
+/* Published snapshot and reader epochs */
+static ChannelTable *_Atomic current_table = NULL;
+static atomic_uint table_epoch = 0;
+static atomic_int epoch_readers[2];
+static int empty_bucket = -1;
+static ChannelTable empty_table = {
+    .refs = 1, .count = 0, .hash_mask = 0,
+    .number_buckets = &empty_bucket, .freq_sid_buckets = &empty_bucket
+};
+
+/* Serializes writers (load/reload) */
+static pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 // Safe string copy with null termination
 static void safe_strcpy(char *dest, size_t dest_size, const char *src) {
     if (!dest || dest_size == 0) return;
@@ -73,23 +100,95 @@ static int compare_channels(const void *a, const void *b) {
     const Channel *cha = (const Channel *)a;
     const Channel *chb = (const Channel *)b;
     
-    int a_major = 0, a_minor = 0;
-    int b_major = 0, b_minor = 0;
-    
-    sscanf(cha->number, "%d.%d", &a_major, &a_minor);
-    sscanf(chb->number, "%d.%d", &b_major, &b_minor);
-    
-    if (a_major != b_major) return a_major - b_major;
-    return a_minor - b_minor;
+    if (cha->major != chb->major) return cha->major - chb->major;
+    return cha->minor - chb->minor;
 }
 
-int load_channels(const char *filename) {
+// FNV-1a over the channel number string
+static unsigned hash_number(const ChannelTable *t, const char *number) {
+    unsigned h = 2166136261u;
+    while (*number) h = (h ^ (unsigned char)*number++) * 16777619u;
+    return h & t->hash_mask;
+}
+
+static unsigned hash_freq_sid(const ChannelTable *t, uint32_t freq_hz, int sid) {
+    uint32_t h = (freq_hz ^ ((uint32_t)sid * 0x9E3779B1u)) * 0x85EBCA6Bu;
+    return (h >> 16) & t->hash_mask;
+}
+
+// Fill integer fields from the parsed strings
+static void channel_parse_fields(Channel *ch) {
+    ch->freq_hz = (uint32_t)strtoul(ch->frequency, NULL, 10);
+    ch->sid = atoi(ch->service_id);
+    ch->major = 0;
+    ch->minor = 0;
+    sscanf(ch->number, "%d.%d", &ch->major, &ch->minor);
+}
+
+static int is_vcn_duplicated(const ChannelTable *t, const char *number);
+
+static void free_table(ChannelTable *t) {
+    if (!t || t == &empty_table) return;
+    free(t->channels);
+    free(t->number_buckets);
+    free(t->number_next);
+    free(t->freq_sid_buckets);
+    free(t->freq_sid_next);
+    free(t);
+}
+
+// Build hash indexes and unique IDs once the array is sorted
+static int build_channel_index(ChannelTable *t) {
+    int buckets = 64;
+    while (buckets < t->count * 2) buckets <<= 1;
+    t->hash_mask = buckets - 1;
+
+    t->number_buckets = malloc(buckets * sizeof(int));
+    t->freq_sid_buckets = malloc(buckets * sizeof(int));
+    t->number_next = malloc((t->count + 1) * sizeof(int));
+    t->freq_sid_next = malloc((t->count + 1) * sizeof(int));
+    if (!t->number_buckets || !t->freq_sid_buckets || !t->number_next || !t->freq_sid_next) return 0;
+
+    memset(t->number_buckets, 0xFF, buckets * sizeof(int));
+    memset(t->freq_sid_buckets, 0xFF, buckets * sizeof(int));
+
+    // Insert in reverse so chains preserve array (sorted) order
+    for (int i = t->count - 1; i >= 0; i--) {
+        unsigned nb = hash_number(t, t->channels[i].number);
+        t->number_next[i] = t->number_buckets[nb];
+        t->number_buckets[nb] = i;
+
+        unsigned fb = hash_freq_sid(t, t->channels[i].freq_hz, t->channels[i].sid);
+        t->freq_sid_next[i] = t->freq_sid_buckets[fb];
+        t->freq_sid_buckets[fb] = i;
+    }
+
+    for (int i = 0; i < t->count; i++) {
+        Channel *ch = &t->channels[i];
+        if (is_vcn_duplicated(t, ch->number)) {
+            // MHz suffix disambiguates, e.g. 527000000 -> "16.1-527"
+            char id[sizeof(ch->unique_id)];
+            snprintf(id, sizeof(id), "%s-%d", ch->number, (int)(ch->freq_hz / 1000000));
+            safe_strcpy(ch->unique_id, sizeof(ch->unique_id), id);
+        } else {
+            safe_strcpy(ch->unique_id, sizeof(ch->unique_id), ch->number);
+        }
+    }
+    return 1;
+}
+
+// Parse channels.conf into a new, unpublished table
+static ChannelTable *parse_channels_file(const char *filename) {
     FILE *f = fopen(filename, "r");
-    if (!f) return -1;
+    if (!f) return NULL;
 
-    // Reset channel count for new load
-    channel_count = 0;
+    ChannelTable *t = calloc(1, sizeof(ChannelTable));
+    if (!t) {
+        fclose(f);
+        return NULL;
+    }
 
+    int cap = 0;
     char line[512];
     Channel *current = NULL;
 
@@ -104,13 +203,19 @@ int load_channels(const char *filename) {
         // Check for section header [ChannelName]
         if (line[0] == '[' && len > 2 && line[len-1] == ']') {
             // Save previous channel if valid
-            if (current && current->frequency[0] != '\0' && channel_count < MAX_CHANNELS) {
-                channel_count++;
+            if (current && current->frequency[0] != '\0') {
+                t->count++;
+            }
+            if (t->count == cap) {
+                int new_cap = cap ? cap * 2 : 64;
+                Channel *tmp = realloc(t->channels, new_cap * sizeof(Channel));
+                if (!tmp) break;
+                t->channels = tmp;
+                cap = new_cap;
             }
-            if (channel_count >= MAX_CHANNELS) break;
             
             // Start new channel
-            current = &channels[channel_count];
+            current = &t->channels[t->count];
             memset(current, 0, sizeof(Channel));
             
             // Extract name between [ and ]
@@ -138,53 +243,170 @@ int load_channels(const char *filename) {
             }
         }
     }
+    fclose(f);
     
-    if (current && current->frequency[0] != '\0' && channel_count < MAX_CHANNELS) {
-        channel_count++;
+    if (current && current->frequency[0] != '\0' && t->count < cap) {
+        t->count++;
     }
 
-    if (channel_count > 1) {
-        qsort(channels, channel_count, sizeof(Channel), compare_channels);
+    for (int i = 0; i < t->count; i++) {
+        channel_parse_fields(&t->channels[i]);
     }
 
-    fclose(f);
-    return channel_count;
+    if (t->count > 1) {
+        qsort(t->channels, t->count, sizeof(Channel), compare_channels);
+    }
+    if (!build_channel_index(t)) {
+        free_table(t);
+        return NULL;
+    }
+    atomic_init(&t->refs, 1);
+    return t;
+}
+
+// Swap in a new table; caller holds publish_mutex
+static void publish_table(ChannelTable *t) {
+    ChannelTable *old = atomic_exchange(&current_table, t);
+
+    // Flip the epoch and wait out readers that may still hold the old pointer
+    unsigned e = atomic_fetch_add(&table_epoch, 1);
+    while (atomic_load(&epoch_readers[e & 1]) > 0) {
+        sched_yield();
+    }
+    if (old) channels_release(old);
+}
+
+int load_channels(const char *filename) {
+    ChannelTable *t = parse_channels_file(filename);
+    if (!t) return -1;
+
+    pthread_mutex_lock(&publish_mutex);
+    publish_table(t);
+    pthread_mutex_unlock(&publish_mutex);
+    return t->count;
 }
 
-Channel *find_channel_by_number(const char *number) {
-    if (!number) return NULL;
-    for (int i = 0; i < channel_count; i++) {
-        if (strcmp(channels[i].number, number) == 0) {
-            return &channels[i];
+int channels_reload() {
+    int count = load_channels(channels_conf_path);
+    if (count < 0) {
+        LOG_WARN("CHANNELS", "Reload of %s failed, keeping current lineup", channels_conf_path);
+    } else {
+        LOG_INFO("CHANNELS", "Reloaded %d channels from %s", count, channels_conf_path);
+    }
+    return count;
+}
+
+ChannelTable *channels_acquire() {
+    unsigned e;
+    for (;;) {
+        e = atomic_load(&table_epoch);
+        atomic_fetch_add(&epoch_readers[e & 1], 1);
+        if (atomic_load(&table_epoch) == e) break;
+        atomic_fetch_sub(&epoch_readers[e & 1], 1);
+    }
+    ChannelTable *t = atomic_load(&current_table);
+    if (t) atomic_fetch_add(&t->refs, 1);
+    atomic_fetch_sub(&epoch_readers[e & 1], 1);
+
+    // Nothing loaded yet: hand out the static empty lineup
+    return t ? t : &empty_table;
+}
+
+void channels_release(ChannelTable *t) {
+    if (!t || t == &empty_table) return;
+    if (atomic_fetch_sub(&t->refs, 1) == 1) free_table(t);
+}
+
+// inotify watcher: reload when channels.conf is rewritten or replaced
+static void *channels_watch_thread(void *arg) {
+    (void)arg;
+    char dir_buf[512], file_buf[512];
+    safe_strcpy(dir_buf, sizeof(dir_buf), channels_conf_path);
+    safe_strcpy(file_buf, sizeof(file_buf), channels_conf_path);
+    const char *dir = dirname(dir_buf);
+    const char *file = basename(file_buf);
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        LOG_WARN("CHANNELS", "inotify unavailable, hot reload disabled");
+        return NULL;
+    }
+    // Watch the directory: editors and dvbv5-scan replace the file by rename
+    if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        LOG_WARN("CHANNELS", "Cannot watch %s, hot reload disabled", dir);
+        close(fd);
+        return NULL;
+    }
+    LOG_DEBUG("CHANNELS", "Watching %s/%s for changes", dir, file);
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) break;
+
+        int changed = 0;
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if (ev->len && strcmp(ev->name, file) == 0) changed = 1;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        if (changed) {
+            usleep(200000); // Let a burst of writes settle
+            channels_reload();
         }
     }
+    close(fd);
     return NULL;
 }
 
-Channel *find_channel_by_freq_sid(const char *freq, int service_id) {
-    if (!freq) return NULL;
-    char sid_str[32];
-    snprintf(sid_str, sizeof(sid_str), "%d", service_id);
-    
-    for (int i = 0; i < channel_count; i++) {
-        if (strcmp(channels[i].frequency, freq) == 0 &&
-            strcmp(channels[i].service_id, sid_str) == 0) {
-            return &channels[i];
+void channels_watch_start() {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, channels_watch_thread, NULL) == 0) {
+        pthread_detach(tid);
+    }
+}
+
+Channel *find_channel_by_number(const ChannelTable *t, const char *number) {
+    if (!t || !number || t->count == 0) return NULL;
+    for (int i = t->number_buckets[hash_number(t, number)]; i >= 0; i = t->number_next[i]) {
+        if (strcmp(t->channels[i].number, number) == 0) {
+            return &t->channels[i];
+        }
+    }
+    return NULL;
+}
+
+Channel *find_channel_by_freq_sid(const ChannelTable *t, uint32_t freq_hz, int service_id) {
+    if (!t || t->count == 0) return NULL;
+    for (int i = t->freq_sid_buckets[hash_freq_sid(t, freq_hz, service_id)]; i >= 0; i = t->freq_sid_next[i]) {
+        if (t->channels[i].freq_hz == freq_hz && t->channels[i].sid == service_id) {
+            return &t->channels[i];
+        }
+    }
+    return NULL;
+}
+
+Channel *find_channel_by_freq_number(const ChannelTable *t, uint32_t freq_hz, const char *number) {
+    if (!t || !number || t->count == 0) return NULL;
+    for (int i = t->number_buckets[hash_number(t, number)]; i >= 0; i = t->number_next[i]) {
+        if (t->channels[i].freq_hz == freq_hz && strcmp(t->channels[i].number, number) == 0) {
+            return &t->channels[i];
         }
     }
     return NULL;
 }
 
 // Check if a virtual channel number exists on multiple frequencies
-int is_vcn_duplicated(const char *number) {
+// This can happen when receiving stations from different markets
+static int is_vcn_duplicated(const ChannelTable *t, const char *number) {
     if (!number) return 0;
-    const char *first_freq = NULL;
-    
-    for (int i = 0; i < channel_count; i++) {
-        if (strcmp(channels[i].number, number) == 0) {
-            if (!first_freq) {
-                first_freq = channels[i].frequency;
-            } else if (strcmp(channels[i].frequency, first_freq) != 0) {
+    int first = -1;
+
+    for (int i = t->number_buckets[hash_number(t, number)]; i >= 0; i = t->number_next[i]) {
+        if (strcmp(t->channels[i].number, number) == 0) {
+            if (first < 0) {
+                first = i;
+            } else if (t->channels[i].freq_hz != t->channels[first].freq_hz) {
                 return 1; // Found same VCN on different frequency
             }
         }
@@ -193,22 +415,8 @@ int is_vcn_duplicated(const char *number) {
 }
 
 // Get unique channel ID for a channel
-// Returns "16.1" normally, or "16.1-527" if duplicates exist (uses first 3 digits of freq)
-const char *get_unique_channel_id(Channel *ch) {
-    static char id_buf[64];
-    
+// Returns "16.1" normally, or "16.1-527" if duplicates exist (uses MHz of freq)
+const char *get_unique_channel_id(const Channel *ch) {
     if (!ch) return "";
-    
-    if (is_vcn_duplicated(ch->number)) {
-        // Extract first 3 significant digits from frequency for disambiguation
-        // e.g., 527000000 -> 527, 581000000 -> 581
-        long freq = atol(ch->frequency);
-        int prefix = (int)(freq / 1000000); // MHz value
-        snprintf(id_buf, sizeof(id_buf), "%s-%d", ch->number, prefix);
-    } else {
-        snprintf(id_buf, sizeof(id_buf), "%s", ch->number);
-    }
-    
-    return id_buf;
+    return ch->unique_id;
 }
-
@@ -0,0 +1,25 @@
+/**
+ * @file crc32.c
+ * @brief MPEG-2 CRC32 of PSI sections
+ */
+
+#include <pthread.h>
+#include "crc32.h"
+
+static uint32_t crc32_table[256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i << 24;
+        for (int k = 0; k < 8; k++) c = (c & 0x80000000) ? (c << 1) ^ 0x04C11DB7 : c << 1;
+        crc32_table[i] = c;
+    }
+}
+
+uint32_t crc32_mpeg(const unsigned char *data, size_t len) {
+    pthread_once(&crc32_once, crc32_init_table);
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++) crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ data[i]) & 0xFF];
+    return crc;
+}
@@ -9,9 +9,21 @@
  * Output formats:
  * - XMLTV: Standard format for EPG interchange, compatible with Jellyfin/Plex
  * - JSON: Lightweight format for web clients like ZapLinkWeb
+ *
+ * Titles and descriptions are stored as multi-language buffers (mls.h);
+ * the builders select a language at output time.
  * 
  * The database is stored in the working directory as epg.db.
  * Expired entries (ended > 24 hours ago) are periodically cleaned up.
+ *
+ * The EPG writer thread (epg_writer.h) has a connection of its own, so
+ * its batch transactions never take in statements from HTTP, cleanup or
+ * DVR threads. The database runs in WAL mode: guide queries keep
+ * reading during a batch, and writers wait DB_BUSY_TIMEOUT_MS for each
+ * other instead of failing with SQLITE_BUSY.
+ *
+ * Statement latency is recorded in the zaplink_db_statement_seconds
+ * histogram (metrics.h); guide queries include row formatting.
  */
 
 #include <stdio.h>
@@ -22,16 +34,26 @@
 #include "db.h"
 #include "config.h"
 #include "channels.h"
+#include "mls.h"
+#include "metrics.h"
 
 /* SQLite database connection handle */
 sqlite3 *db = NULL;
+/* Connection of the EPG writer thread (db itself for ":memory:") */
+static sqlite3 *writer_db = NULL;
 
 int db_init() {
-    int rc = sqlite3_open(DB_PATH, &db);
+    return db_init_at(DB_PATH);
+}
+
+int db_init_at(const char *path) {
+    int rc = sqlite3_open(path, &db);
     if (rc) {
         fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
         return 0;
     }
+    sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL", 0, 0, 0);
     
     // Create Table if not exists
     char *sql = "CREATE TABLE IF NOT EXISTS programs ("
@@ -52,11 +74,44 @@ int db_init() {
         sqlite3_free(err_msg);
         return 0;
     }
-    
+
+    // Recordings copy their program row so guide cleanup cannot orphan them
+    sql = "CREATE TABLE IF NOT EXISTS recordings ("
+          "id INTEGER PRIMARY KEY, "
+          "frequency TEXT, "
+          "channel_service_id TEXT, "
+          "start_time INTEGER, "
+          "end_time INTEGER, "
+          "title TEXT, "
+          "status TEXT, "
+          "path TEXT, "
+          "bytes INTEGER DEFAULT 0, "
+          "UNIQUE (frequency, channel_service_id, start_time));";
+    rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        return 0;
+    }
+
+    // Each ":memory:" connection is a separate database; share that one
+    if (strcmp(path, ":memory:") == 0) {
+        writer_db = db;
+        return 1;
+    }
+    if (sqlite3_open(path, &writer_db) != SQLITE_OK) {
+        fprintf(stderr, "Can't open writer connection: %s\n", sqlite3_errmsg(writer_db));
+        sqlite3_close(writer_db);
+        writer_db = NULL;
+        return 0;
+    }
+    sqlite3_busy_timeout(writer_db, DB_BUSY_TIMEOUT_MS);
     return 1;
 }
 
 void db_close() {
+    if (writer_db && writer_db != db) sqlite3_close(writer_db);
+    writer_db = NULL;
     if (db) sqlite3_close(db);
 }
 
@@ -87,9 +142,9 @@ void append_str(char **dest, size_t *size, size_t *cap, const char *src) {
     *size += len;
 }
 
-static void xml_escape_append(char **dest, size_t *size, size_t *cap, const char *src) {
+static void xml_escape_append(char **dest, size_t *size, size_t *cap, const char *src, size_t len) {
     if (!src) return;
-    for (const char *p = src; *p; p++) {
+    for (const char *p = src; p < src + len; p++) {
         switch (*p) {
             case '&':  append_str(dest, size, cap, "&amp;"); break;
             case '<':  append_str(dest, size, cap, "&lt;"); break;
@@ -101,8 +156,33 @@ static void xml_escape_append(char **dest, size_t *size, size_t *cap, const char
     }
 }
 
-char *db_get_xmltv_programs() {
+static void xml_append_variant(char **dest, size_t *size, size_t *cap, const char *tag, const MlsVariant *v) {
+    char buf[64];
+    if (v->lang[0]) snprintf(buf, sizeof(buf), "    <%s lang=\"%s\">", tag, v->lang);
+    else snprintf(buf, sizeof(buf), "    <%s>", tag);
+    append_str(dest, size, cap, buf);
+    xml_escape_append(dest, size, cap, v->text, v->len);
+    snprintf(buf, sizeof(buf), "</%s>\n", tag);
+    append_str(dest, size, cap, buf);
+}
+
+// Emit a <tag lang="..."> element per language variant, or only the
+// requested one (first variant as fallback)
+static void xml_append_mls(char **dest, size_t *size, size_t *cap, const char *tag, const char *mls, const char *lang) {
+    MlsVariant v;
+    if ((lang && lang[0]) || !mls || !mls[0]) {
+        // Single element: the requested language, or an empty one
+        mls_select(mls, lang, &v);
+        xml_append_variant(dest, size, cap, tag, &v);
+        return;
+    }
+    const char *cur = mls;
+    while (mls_next(&cur, &v)) xml_append_variant(dest, size, cap, tag, &v);
+}
+
+char *db_get_xmltv_programs(const char *lang) {
     if (!db) return NULL;
+    uint64_t t0 = metrics_now_ns();
 
     sqlite3_stmt *stmt;
     // Order by Major.Minor numerical sort, include frequency for unique ID generation
@@ -115,18 +195,23 @@ char *db_get_xmltv_programs() {
     size_t cap = 512 * 1024; // 512KB for XMLTV
     size_t size = 0;
     char *xml = malloc(cap);
-    if (!xml) return NULL;
+    if (!xml) {
+        sqlite3_finalize(stmt);
+        return NULL;
+    }
     xml[0] = '\0';
 
+    ChannelTable *lineup = channels_acquire();
+
     append_str(&xml, &size, &cap, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!DOCTYPE tv SYSTEM \"xmltv.dtd\">\n<tv generator-info-name=\"ZapLinkCore\">\n");
 
     // Channel list - use unique IDs
-    for (int i = 0; i < channel_count; i++) {
-        const char *unique_id = get_unique_channel_id(&channels[i]);
+    for (int i = 0; i < lineup->count; i++) {
+        const char *unique_id = get_unique_channel_id(&lineup->channels[i]);
         char buf[256];
         snprintf(buf, sizeof(buf), "  <channel id=\"%s\">\n    <display-name>", unique_id);
         append_str(&xml, &size, &cap, buf);
-        xml_escape_append(&xml, &size, &cap, channels[i].name);
+        xml_escape_append(&xml, &size, &cap, lineup->channels[i].name, strlen(lineup->channels[i].name));
         append_str(&xml, &size, &cap, "</display-name>\n  </channel>\n");
     }
 
@@ -141,14 +226,7 @@ char *db_get_xmltv_programs() {
         // Look up channel to get unique ID
         Channel *ch = NULL;
         if (freq && svc_id) {
-            // Try to find by frequency, fall back to basic lookup
-            for (int i = 0; i < channel_count; i++) {
-                if (strcmp(channels[i].frequency, freq) == 0 && 
-                    strcmp(channels[i].number, svc_id) == 0) {
-                    ch = &channels[i];
-                    break;
-                }
-            }
+            ch = find_channel_by_freq_number(lineup, (uint32_t)strtoul(freq, NULL, 10), svc_id);
         }
         const char *channel_id = ch ? get_unique_channel_id(ch) : (svc_id ? svc_id : "");
 
@@ -168,28 +246,26 @@ char *db_get_xmltv_programs() {
                  start_str, end_str, channel_id);
         append_str(&xml, &size, &cap, buf);
 
-        append_str(&xml, &size, &cap, "    <title>");
-        xml_escape_append(&xml, &size, &cap, title);
-        append_str(&xml, &size, &cap, "</title>\n");
-
-        append_str(&xml, &size, &cap, "    <desc>");
-        xml_escape_append(&xml, &size, &cap, desc);
-        append_str(&xml, &size, &cap, "</desc>\n  </programme>\n");
+        xml_append_mls(&xml, &size, &cap, "title", title, lang);
+        xml_append_mls(&xml, &size, &cap, "desc", desc, lang);
+        append_str(&xml, &size, &cap, "  </programme>\n");
     }
 
     append_str(&xml, &size, &cap, "</tv>");
     
     sqlite3_finalize(stmt);
+    channels_release(lineup);
+    metrics_observe(METRIC_DB_XMLTV, metrics_now_ns() - t0);
     return xml;
 }
 
 // Helper to escape JSON strings
-static void json_escape_append(char **dest, size_t *size, size_t *cap, const char *src) {
+static void json_escape_append(char **dest, size_t *size, size_t *cap, const char *src, size_t len) {
     if (!src) {
         append_str(dest, size, cap, "");
         return;
     }
-    for (const char *p = src; *p; p++) {
+    for (const char *p = src; p < src + len; p++) {
         char buf[8];
         switch (*p) {
             case '"':  append_str(dest, size, cap, "\\\""); break;
@@ -210,8 +286,9 @@ static void json_escape_append(char **dest, size_t *size, size_t *cap, const cha
     }
 }
 
-char *db_get_json_programs() {
+char *db_get_json_programs(const char *lang) {
     if (!db) return NULL;
+    uint64_t t0 = metrics_now_ns();
 
     char *sql = "SELECT title, description, start_time, end_time, channel_service_id FROM programs "
                 "WHERE end_time > ? "
@@ -235,23 +312,29 @@ char *db_get_json_programs() {
     size_t cap = 1024 * 1024; // 1MB start
     size_t size = 0;
     char *json = malloc(cap);
-    if (!json) return NULL;
+    if (!json) {
+        sqlite3_finalize(stmt);
+        return NULL;
+    }
     json[0] = '\0';
 
+    ChannelTable *lineup = channels_acquire();
+
     append_str(&json, &size, &cap, "{\n  \"channels\": [\n");
 
     // Channels array
-    for (int i = 0; i < channel_count; i++) {
+    for (int i = 0; i < lineup->count; i++) {
         char buf[256];
-        snprintf(buf, sizeof(buf), "    {\"id\": \"%s\", \"name\": \"", channels[i].number);
+        snprintf(buf, sizeof(buf), "    {\"id\": \"%s\", \"name\": \"", lineup->channels[i].number);
         append_str(&json, &size, &cap, buf);
-        json_escape_append(&json, &size, &cap, channels[i].name);
+        json_escape_append(&json, &size, &cap, lineup->channels[i].name, strlen(lineup->channels[i].name));
         append_str(&json, &size, &cap, "\"}");
-        if (i < channel_count - 1) append_str(&json, &size, &cap, ",");
+        if (i < lineup->count - 1) append_str(&json, &size, &cap, ",");
         append_str(&json, &size, &cap, "\n");
     }
 
     append_str(&json, &size, &cap, "  ],\n  \"programs\": [\n");
+    channels_release(lineup);
 
     // Programs array
     int first = 1;
@@ -269,21 +352,28 @@ char *db_get_json_programs() {
         snprintf(buf, sizeof(buf), "    {\"channel\": \"%s\", \"start\": %lld, \"end\": %lld, \"title\": \"",
             svc_id ? svc_id : "", start, end);
         append_str(&json, &size, &cap, buf);
-        json_escape_append(&json, &size, &cap, title);
+        MlsVariant t, d;
+        mls_select(title, lang, &t);
+        mls_select(desc, lang, &d);
+        json_escape_append(&json, &size, &cap, t.text, t.len);
         append_str(&json, &size, &cap, "\", \"description\": \"");
-        json_escape_append(&json, &size, &cap, desc);
+        json_escape_append(&json, &size, &cap, d.text, d.len);
+        append_str(&json, &size, &cap, "\", \"lang\": \"");
+        append_str(&json, &size, &cap, t.lang);
         append_str(&json, &size, &cap, "\"}");
     }
 
     append_str(&json, &size, &cap, "\n  ]\n}");
     
     sqlite3_finalize(stmt);
+    metrics_observe(METRIC_DB_JSON, metrics_now_ns() - t0);
     return json;
 }
 
 
 void db_upsert_program(const char *frequency, const char *channel_service_id, long long start_time, long long end_time, const char *title, int event_id, int source_id) {
-    if (!db) return;
+    if (!writer_db) return;
+    uint64_t t0 = metrics_now_ns();
 
     char *sql = "INSERT INTO programs (frequency, channel_service_id, start_time, end_time, title, description, event_id, source_id) "
                 "VALUES (?, ?, ?, ?, ?, ?, ?, ?) "
@@ -291,9 +381,9 @@ void db_upsert_program(const char *frequency, const char *channel_service_id, lo
                 "DO UPDATE SET title=excluded.title, end_time=excluded.end_time, event_id=excluded.event_id, source_id=excluded.source_id";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = sqlite3_prepare_v2(writer_db, sql, -1, &stmt, 0);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "Prepare error: %s\n", sqlite3_errmsg(db));
+        fprintf(stderr, "Prepare error: %s\n", sqlite3_errmsg(writer_db));
         return;
     }
 
@@ -308,17 +398,19 @@ void db_upsert_program(const char *frequency, const char *channel_service_id, lo
 
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    metrics_observe(METRIC_DB_UPSERT, metrics_now_ns() - t0);
 }
 
 void db_update_program_description(const char *frequency, const char *channel_service_id, int event_id, const char *description) {
-    if (!db || !description || description[0] == '\0') return;
+    if (!writer_db || !description || description[0] == '\0') return;
+    uint64_t t0 = metrics_now_ns();
 
     char *sql = "UPDATE programs SET description = ? WHERE frequency = ? AND channel_service_id = ? AND event_id = ?";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = sqlite3_prepare_v2(writer_db, sql, -1, &stmt, 0);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "Prepare error: %s\n", sqlite3_errmsg(db));
+        fprintf(stderr, "Prepare error: %s\n", sqlite3_errmsg(writer_db));
         return;
     }
 
@@ -329,6 +421,30 @@ void db_update_program_description(const char *frequency, const char *channel_se
 
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    metrics_observe(METRIC_DB_DESCRIPTION, metrics_now_ns() - t0);
+}
+
+void db_begin_batch() {
+    if (!writer_db) return;
+    char *err_msg = 0;
+    // IMMEDIATE takes the write lock now, where the busy timeout applies
+    if (sqlite3_exec(writer_db, "BEGIN IMMEDIATE", 0, 0, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "Begin error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+    }
+}
+
+void db_commit_batch() {
+    if (!writer_db || sqlite3_get_autocommit(writer_db)) return;
+    uint64_t t0 = metrics_now_ns();
+    char *err_msg = 0;
+    if (sqlite3_exec(writer_db, "COMMIT", 0, 0, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "Commit error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        // Don't let the next batch nest inside a transaction left open
+        sqlite3_exec(writer_db, "ROLLBACK", 0, 0, 0);
+    }
+    metrics_observe(METRIC_DB_COMMIT, metrics_now_ns() - t0);
 }
 
 // Delete program entries that ended more than 24 hours ago
@@ -341,6 +457,7 @@ int db_cleanup_expired() {
     long long now_ms = (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
     long long cutoff_ms = now_ms - (24LL * 60 * 60 * 1000); // 24 hours ago
 
+    uint64_t t0 = metrics_now_ns();
     char *sql = "DELETE FROM programs WHERE end_time < ?";
     sqlite3_stmt *stmt;
     int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
@@ -353,9 +470,153 @@ int db_cleanup_expired() {
     rc = sqlite3_step(stmt);
     int deleted = sqlite3_changes(db);
     sqlite3_finalize(stmt);
+    metrics_observe(METRIC_DB_CLEANUP, metrics_now_ns() - t0);
 
     if (deleted > 0) {
         printf("[DB] Cleaned up %d expired program entries\n", deleted);
     }
     return deleted;
 }
+
+int db_add_recording(const char *channel_service_id, long long start_time) {
+    if (!db) return -1;
+
+    const char *sql = "INSERT OR IGNORE INTO recordings "
+                      "(frequency, channel_service_id, start_time, end_time, title, status) "
+                      "SELECT frequency, channel_service_id, start_time, end_time, title, 'scheduled' "
+                      "FROM programs WHERE channel_service_id = ? AND start_time = ? LIMIT 1";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        fprintf(stderr, "Prepare error: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    sqlite3_bind_text(stmt, 1, channel_service_id, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, start_time);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+
+    // Scheduling twice returns the existing recording
+    sql = "SELECT id FROM recordings WHERE channel_service_id = ? AND start_time = ?";
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) return -1;
+    sqlite3_bind_text(stmt, 1, channel_service_id, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, start_time);
+    int id = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return id;
+}
+
+static void recording_from_row(sqlite3_stmt *stmt, DbRecording *r) {
+    memset(r, 0, sizeof(*r));
+    r->id = sqlite3_column_int(stmt, 0);
+    snprintf(r->frequency, sizeof(r->frequency), "%s", (const char *)sqlite3_column_text(stmt, 1) ?: "");
+    snprintf(r->channel, sizeof(r->channel), "%s", (const char *)sqlite3_column_text(stmt, 2) ?: "");
+    r->start_time = sqlite3_column_int64(stmt, 3);
+    r->end_time = sqlite3_column_int64(stmt, 4);
+    MlsVariant t;
+    mls_select((const char *)sqlite3_column_text(stmt, 5), NULL, &t);
+    snprintf(r->title, sizeof(r->title), "%.*s", (int)t.len, t.text ? t.text : "");
+    snprintf(r->status, sizeof(r->status), "%s", (const char *)sqlite3_column_text(stmt, 6) ?: "");
+    snprintf(r->path, sizeof(r->path), "%s", (const char *)sqlite3_column_text(stmt, 7) ?: "");
+    r->bytes = sqlite3_column_int64(stmt, 8);
+}
+
+#define RECORDING_COLUMNS "id, frequency, channel_service_id, start_time, end_time, title, status, path, bytes"
+
+int db_due_recordings(long long until_ms, DbRecording *out, int max) {
+    if (!db) return 0;
+    const char *sql = "SELECT " RECORDING_COLUMNS " FROM recordings "
+                      "WHERE status = 'scheduled' AND start_time <= ? ORDER BY start_time LIMIT ?";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) return 0;
+    sqlite3_bind_int64(stmt, 1, until_ms);
+    sqlite3_bind_int(stmt, 2, max);
+    int n = 0;
+    while (n < max && sqlite3_step(stmt) == SQLITE_ROW) recording_from_row(stmt, &out[n++]);
+    sqlite3_finalize(stmt);
+    return n;
+}
+
+int db_get_recording(int id, DbRecording *out) {
+    if (!db) return 0;
+    const char *sql = "SELECT " RECORDING_COLUMNS " FROM recordings WHERE id = ?";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) return 0;
+    sqlite3_bind_int(stmt, 1, id);
+    int found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) recording_from_row(stmt, out);
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+void db_update_recording(int id, const char *status, const char *path, long long bytes) {
+    if (!db) return;
+    const char *sql = "UPDATE recordings SET status = ?, path = COALESCE(?, path), bytes = ? WHERE id = ?";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        fprintf(stderr, "Prepare error: %s\n", sqlite3_errmsg(db));
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, status, -1, SQLITE_STATIC);
+    if (path) sqlite3_bind_text(stmt, 2, path, -1, SQLITE_STATIC);
+    else sqlite3_bind_null(stmt, 2);
+    sqlite3_bind_int64(stmt, 3, bytes);
+    sqlite3_bind_int(stmt, 4, id);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+int db_delete_recording(int id) {
+    if (!db) return 0;
+    const char *sql = "DELETE FROM recordings WHERE id = ?";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) return 0;
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return sqlite3_changes(db) > 0;
+}
+
+char *db_get_recordings_json() {
+    if (!db) return NULL;
+    const char *sql = "SELECT " RECORDING_COLUMNS " FROM recordings ORDER BY start_time";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) return NULL;
+
+    size_t cap = 4096, size = 0;
+    char *json = malloc(cap);
+    if (!json) {
+        sqlite3_finalize(stmt);
+        return NULL;
+    }
+    json[0] = '\0';
+    append_str(&json, &size, &cap, "{\n  \"recordings\": [");
+
+    int first = 1;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        DbRecording r;
+        recording_from_row(stmt, &r);
+        char buf[256];
+        snprintf(buf, sizeof(buf), "%s\n    {\"id\": %d, \"channel\": \"%s\", \"start\": %lld, \"end\": %lld, "
+                 "\"status\": \"%s\", \"bytes\": %lld, \"title\": \"",
+                 first ? "" : ",", r.id, r.channel, r.start_time, r.end_time, r.status, r.bytes);
+        append_str(&json, &size, &cap, buf);
+        json_escape_append(&json, &size, &cap, r.title, strlen(r.title));
+        append_str(&json, &size, &cap, "\"}");
+        first = 0;
+    }
+    sqlite3_finalize(stmt);
+    append_str(&json, &size, &cap, "\n  ]\n}\n");
+    return json;
+}
+
+int db_fail_interrupted_recordings() {
+    if (!db) return 0;
+    char *err_msg = 0;
+    if (sqlite3_exec(db, "UPDATE recordings SET status = 'failed' WHERE status = 'recording'", 0, 0, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        return 0;
+    }
+    return sqlite3_changes(db);
+}
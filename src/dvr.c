@@ -0,0 +1,367 @@
+/**
+ * @file dvr.c
+ * @brief Recording engine for programs in the guide
+ *
+ * Threads per recording: the recorder (capture viewer, fills blocks) and
+ * its writer (drains blocks to disk). They meet at a small queue of
+ * aligned blocks, so a slow write only ever blocks the recorder.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "dvr.h"
+#include "db.h"
+#include "config.h"
+#include "channels.h"
+#include "capture.h"
+#include "spts.h"
+#include "metrics.h"
+#include "log.h"
+
+#define DVR_BLOCK_BYTES (1 << 20)
+#define DVR_BLOCKS 16
+#define DVR_ALIGN 4096
+#define DVR_SCHEDULE_POLL_SECS 5
+#define DVR_DB_UPDATE_SECS 10
+
+typedef struct {
+    int fd;
+    int direct;                      /* Opened with O_DIRECT */
+    unsigned char *blocks[DVR_BLOCKS];
+    size_t fill[DVR_BLOCKS];
+    int first;                       /* Oldest queued block */
+    int queued;                      /* Blocks waiting for the writer */
+    int current;                     /* Block the recorder is filling */
+    int closing;
+    int failed;                      /* A write failed; stop recording */
+    uint64_t written;                /* Bytes on disk */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+} RecWriter;
+
+typedef struct ActiveRecording {
+    int id;
+    volatile int stop;
+    volatile int remove;             /* Delete file and row when stopped */
+    DbRecording rec;
+    struct ActiveRecording *next;
+} ActiveRecording;
+
+static ActiveRecording *active = NULL;
+static pthread_mutex_t active_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// -----------------------------------------------------------------------------
+// Block writer
+// -----------------------------------------------------------------------------
+
+static void *writer_thread(void *arg) {
+    RecWriter *w = arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->queued == 0 && !w->closing) pthread_cond_wait(&w->cond, &w->lock);
+        if (w->queued == 0) break;
+        int b = w->first;
+        size_t len = w->fill[b];
+        pthread_mutex_unlock(&w->lock);
+
+        // O_DIRECT needs whole sectors; the tail is trimmed at close
+        size_t io_len = w->direct ? (len + DVR_ALIGN - 1) & ~(size_t)(DVR_ALIGN - 1) : len;
+        if (io_len > len) memset(w->blocks[b] + len, 0, io_len - len);
+        size_t done = 0;
+        while (done < io_len) {
+            ssize_t n = pwrite(w->fd, w->blocks[b] + done, io_len - done, w->written + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        if (done < io_len) {
+            LOG_ERROR("DVR", "Write failed: %s", strerror(errno));
+            w->failed = 1;
+        } else {
+            w->written += len;
+            metrics_add(METRIC_DVR_BYTES, len);
+        }
+        w->fill[b] = 0;
+        w->first = (w->first + 1) % DVR_BLOCKS;
+        w->queued--;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static int writer_open(RecWriter *w, const char *path, long long expected) {
+    memset(w, 0, sizeof(*w));
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+    w->direct = w->fd >= 0;
+    if (w->fd < 0 && errno == EINVAL) {
+        // tmpfs and some filesystems refuse O_DIRECT
+        w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (w->fd < 0) {
+        LOG_ERROR("DVR", "Cannot create %s: %s", path, strerror(errno));
+        return 0;
+    }
+    // Contiguous extents up front; trimmed to the real size at close. Not
+    // posix_fallocate: without filesystem support (vfat, exFAT, NFSv3) it
+    // writes out every block before the first packet is recorded.
+    if (expected > 0 && fallocate(w->fd, 0, 0, expected) != 0 && errno != EOPNOTSUPP) {
+        LOG_WARN("DVR", "Cannot preallocate %s: %s", path, strerror(errno));
+    }
+
+    for (int i = 0; i < DVR_BLOCKS; i++) {
+        if (posix_memalign((void **)&w->blocks[i], DVR_ALIGN, DVR_BLOCK_BYTES) != 0) {
+            while (i-- > 0) free(w->blocks[i]);
+            close(w->fd);
+            unlink(path);
+            return 0;
+        }
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+        for (int i = 0; i < DVR_BLOCKS; i++) free(w->blocks[i]);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+        close(w->fd);
+        unlink(path);
+        return 0;
+    }
+    return 1;
+}
+
+// Hand the current block to the writer and take the next free one
+static void writer_queue_current(RecWriter *w) {
+    pthread_mutex_lock(&w->lock);
+    w->queued++;
+    pthread_cond_broadcast(&w->cond);
+    // The writer drains the queue even after a failed write
+    while (w->queued == DVR_BLOCKS) pthread_cond_wait(&w->cond, &w->lock);
+    w->current = (w->first + w->queued) % DVR_BLOCKS;
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void writer_append(RecWriter *w, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        size_t room = DVR_BLOCK_BYTES - w->fill[w->current];
+        size_t n = len < room ? len : room;
+        memcpy(w->blocks[w->current] + w->fill[w->current], buf, n);
+        w->fill[w->current] += n;
+        buf += n;
+        len -= n;
+        if (w->fill[w->current] == DVR_BLOCK_BYTES) writer_queue_current(w);
+    }
+}
+
+static uint64_t writer_close(RecWriter *w) {
+    if (w->fill[w->current] > 0) writer_queue_current(w);
+    pthread_mutex_lock(&w->lock);
+    w->closing = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    if (ftruncate(w->fd, w->written) != 0) {
+        LOG_WARN("DVR", "Cannot trim recording: %s", strerror(errno));
+    }
+    fsync(w->fd);
+    close(w->fd);
+    for (int i = 0; i < DVR_BLOCKS; i++) free(w->blocks[i]);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    return w->written;
+}
+
+// -----------------------------------------------------------------------------
+// Recorder
+// -----------------------------------------------------------------------------
+
+// Copy the recording's channel out of the current lineup
+static int find_recording_channel(const DbRecording *r, Channel *out) {
+    ChannelTable *lineup = channels_acquire();
+    Channel *c = find_channel_by_freq_number(lineup, (uint32_t)strtoul(r->frequency, NULL, 10), r->channel);
+    if (!c) c = find_channel_by_number(lineup, r->channel);
+    if (c) *out = *c;
+    channels_release(lineup);
+    return c != NULL;
+}
+
+static void *recorder_thread(void *arg) {
+    ActiveRecording *ar = arg;
+    const DbRecording *r = &ar->rec;
+    long long stop_ms = r->end_time + DVR_PADDING_SECS * 1000LL;
+
+    char path[512];
+    char stamp[32];
+    time_t start_s = r->start_time / 1000;
+    struct tm tm;
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M", localtime_r(&start_s, &tm));
+    mkdir(RECORDINGS_DIR, 0755);
+    snprintf(path, sizeof(path), "%s/%d-%s-%s.ts", RECORDINGS_DIR, r->id, r->channel, stamp);
+
+    long long secs = (stop_ms - now_ms()) / 1000;
+    RecWriter w;
+    if (!writer_open(&w, path, secs > 0 ? secs * DVR_BYTES_PER_SEC : 0)) {
+        db_update_recording(r->id, "failed", NULL, 0);
+        goto out;
+    }
+    db_update_recording(r->id, "recording", path, 0);
+    LOG_INFO("DVR", "Recording %s \"%s\" to %s", r->channel, r->title, path);
+
+    unsigned char buf[188 * 7 * 32];
+    time_t last_update = time(NULL);
+    int attempts = 0;
+    while (!ar->stop && !w.failed && now_ms() < stop_ms) {
+        Channel chan;
+        CaptureError err = CAPTURE_OK;
+        StreamTrace trace;
+        trace_begin(&trace, metrics_now_ns());
+        CaptureViewer *v = find_recording_channel(r, &chan) ? capture_open(&chan, &trace, &err) : NULL;
+        if (!v) {
+            // No tuner (or no channel) right now; keep trying until the end
+            if (attempts++ % 12 == 0) LOG_WARN("DVR", "Recording %d waiting for a tuner", r->id);
+            sleep(DVR_SCHEDULE_POLL_SECS);
+            continue;
+        }
+
+        // Only the recorded program goes to disk; fresh PSI state per attach
+        SptsFilter *spts = spts_open(chan.sid);
+        ssize_t n;
+        while (!ar->stop && !w.failed && now_ms() < stop_ms && (n = capture_read(v, buf, sizeof(buf))) > 0) {
+            if (spts) n = spts_filter(spts, buf, n);
+            if (n > 0) writer_append(&w, buf, n);
+            if (time(NULL) - last_update >= DVR_DB_UPDATE_SECS) {
+                last_update = time(NULL);
+                pthread_mutex_lock(&w.lock);
+                long long written = w.written;
+                pthread_mutex_unlock(&w.lock);
+                db_update_recording(r->id, "recording", NULL, written);
+            }
+        }
+        if (v->overruns) metrics_add(METRIC_DVR_OVERRUNS, v->overruns);
+        spts_close(spts);
+        capture_close(v);
+    }
+
+    int failed = w.failed;
+    uint64_t bytes = writer_close(&w);
+    if (ar->remove) {
+        unlink(path);
+        db_delete_recording(r->id);
+    } else {
+        db_update_recording(r->id, failed || bytes == 0 ? "failed" : "done", NULL, bytes);
+        LOG_INFO("DVR", "Recording %d finished: %llu MB", r->id, (unsigned long long)(bytes >> 20));
+    }
+
+out:
+    pthread_mutex_lock(&active_mutex);
+    for (ActiveRecording **pp = &active; *pp; pp = &(*pp)->next) {
+        if (*pp == ar) {
+            *pp = ar->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&active_mutex);
+    free(ar);
+    return NULL;
+}
+
+static void start_recording(const DbRecording *r) {
+    ActiveRecording *ar = calloc(1, sizeof(ActiveRecording));
+    if (!ar) return;
+    ar->id = r->id;
+    ar->rec = *r;
+
+    // Claimed before the thread runs so the next poll cannot start it twice
+    db_update_recording(r->id, "recording", NULL, 0);
+    pthread_mutex_lock(&active_mutex);
+    ar->next = active;
+    active = ar;
+    pthread_mutex_unlock(&active_mutex);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, recorder_thread, ar) != 0) {
+        pthread_mutex_lock(&active_mutex);
+        active = ar->next;
+        pthread_mutex_unlock(&active_mutex);
+        db_update_recording(r->id, "failed", NULL, 0);
+        free(ar);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static void *scheduler_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        DbRecording due[8];
+        long long now = now_ms();
+        int n = db_due_recordings(now + DVR_PADDING_SECS * 1000LL, due, 8);
+        for (int i = 0; i < n; i++) {
+            if (due[i].end_time + DVR_PADDING_SECS * 1000LL <= now) {
+                LOG_WARN("DVR", "Recording %d (%s \"%s\") was missed", due[i].id, due[i].channel, due[i].title);
+                db_update_recording(due[i].id, "missed", NULL, 0);
+            } else {
+                start_recording(&due[i]);
+            }
+        }
+        sleep(DVR_SCHEDULE_POLL_SECS);
+    }
+    return NULL;
+}
+
+void dvr_start() {
+    int interrupted = db_fail_interrupted_recordings();
+    if (interrupted > 0) LOG_WARN("DVR", "%d recordings were interrupted by the last exit", interrupted);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, scheduler_thread, NULL) != 0) {
+        LOG_ERROR("DVR", "Cannot start recording scheduler");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+int dvr_delete(int id) {
+    pthread_mutex_lock(&active_mutex);
+    for (ActiveRecording *ar = active; ar; ar = ar->next) {
+        if (ar->id == id) {
+            // The recorder cleans up once it notices
+            ar->remove = 1;
+            ar->stop = 1;
+            pthread_mutex_unlock(&active_mutex);
+            return 1;
+        }
+    }
+    pthread_mutex_unlock(&active_mutex);
+
+    DbRecording r;
+    if (!db_get_recording(id, &r)) return 0;
+    if (r.path[0]) unlink(r.path);
+    return db_delete_recording(id);
+}
+
+int dvr_active_count() {
+    int n = 0;
+    pthread_mutex_lock(&active_mutex);
+    for (ActiveRecording *ar = active; ar; ar = ar->next) n++;
+    pthread_mutex_unlock(&active_mutex);
+    return n;
+}
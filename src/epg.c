@@ -29,8 +29,13 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <signal.h>
 #include <time.h>
+#include <stdint.h>
 #include <ctype.h> 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "epg.h"
 #include "config.h"
 #include "log.h"
@@ -38,49 +43,123 @@
 #include "channels.h"
 #include "db.h"
 #include "huffman.h"
+#include "mss_cache.h"
+#include "mls.h"
+#include "ts_ring.h"
+#include "epg_writer.h"
+#include "metrics.h"
+#include "crc32.h"
 
 /* ============================================================================
  * Data Structures
  * ============================================================================ */
 
 #define TS_PACKET_SIZE 188   /* MPEG-TS packet size */
-#define MAX_EIT_PIDS 8       /* Max EIT PIDs to track per mux */
+#define TS_SYNC_BYTE 0x47    /* First byte of every TS packet */
+#define TS_SYNC_CONFIRM 3    /* Consecutive sync bytes required to (re)lock */
+#define TS_HEADER_BATCH 64   /* Packet headers extracted per batch */
+#define TS_FLAG_TEI 0x80     /* TsPacketInfo.flags: transport error indicator */
+#define TS_FLAG_PUSI 0x40    /* TsPacketInfo.flags: payload unit start */
+#define TS_PID_COUNT 8192    /* 13-bit PID space */
+#define PSIP_BASE_PID 0x1FFB /* ATSC base PID (MGT, VCT, STT, RRT) */
+
+#define MAX_SECTION_SIZE 4096 /* Private section limit (A/65, ISO 13818-1) */
 
 /**
  * Buffer for accumulating PSI/SI section data across TS packets
  * Sections can span multiple packets; this tracks reassembly state
  */
 typedef struct {
-    unsigned char buffer[4096];  /* Section data accumulator */
+    unsigned char buffer[MAX_SECTION_SIZE];  /* Section data accumulator */
     int len;                     /* Current accumulated length */
-    int expected_len;            /* Total expected section length */
+    int expected_len;            /* Total section length, 0 until header seen */
     int active;                  /* Whether we're mid-section */
+    int last_cc;                 /* Last continuity counter, -1 if unknown */
 } SectionBuffer;
 
+/**
+ * Header fields of one TS packet, extracted in batches ahead of dispatch
+ * flags packs TEI/PUSI (bits 7-6) with adaptation control and CC (bits 5-0)
+ */
+typedef struct {
+    uint16_t pid;
+    uint8_t flags;
+} TsPacketInfo;
+
+typedef struct ScanContext ScanContext;
+
+/** Per-PID section handler, selected from the MGT table type */
+typedef void (*SectionHandler)(ScanContext *ctx, int pid, unsigned char *section, int len);
+
 /**
  * Per-scan context - allows concurrent scanning on multiple tuners
  * Each worker thread gets its own context to avoid shared state
+ *
+ * PID dispatch is O(1): pid_bitmap marks PIDs worth reassembling and
+ * pid_handlers holds the table parser for each. Both are filled in from
+ * the MGT as it arrives, covering every EIT/ETT instance up to
+ * epg_guide_depth.
+ *
+ * A scan runs as a pipeline: the worker thread captures from the zap
+ * pipe into ring, a parse thread owns everything from packets to
+ * events, and finished event batches go to the shared EPG writer.
  */
-typedef struct {
-    SectionBuffer pid_buffers[8192];  /* Buffer per possible PID */
-    int eit_pids[MAX_EIT_PIDS];       /* Discovered EIT PIDs from MGT */
-    int eit_pid_count;                /* Number of EIT PIDs found */
-    const char *freq;                 /* Current frequency being scanned */
-} ScanContext;
+struct ScanContext {
+    SectionBuffer pid_buffers[TS_PID_COUNT];     /* Buffer per possible PID */
+    uint32_t pid_bitmap[TS_PID_COUNT / 32];      /* 1 bit per tracked PID */
+    SectionHandler pid_handlers[TS_PID_COUNT];   /* Parser per tracked PID */
+    int eit_pid_count;                           /* EIT PIDs registered from MGT */
+    int ett_pid_count;                           /* ETT PIDs registered from MGT */
+    long packet_count;                           /* Aligned packets seen */
+    long sync_losses;                            /* Resynchronizations performed */
+    long section_count;                          /* Sections delivered to handlers */
+    long cc_errors;                              /* Continuity counter discontinuities */
+    long crc_errors;                             /* Sections dropped on CRC mismatch */
+    const char *freq;                            /* Current frequency being scanned */
+    ChannelTable *lineup;                        /* Channel snapshot pinned for the scan */
+    uint32_t freq_hz;                            /* freq parsed once for map lookups */
+    TsRing *ring;                                /* Capture -> parse handoff */
+    EpgEventBatch *events;                       /* Parse -> writer batch being filled */
+    long events_queued;                          /* Updates handed to the writer */
+    long events_dropped;                         /* Updates lost to a full writer queue */
+    long capture_bytes;                          /* Bytes read from the zap pipe */
+    long capture_stalls;                         /* Times the ring was full */
+    uint64_t capture_wait_ns;                    /* Capture: blocked in read() */
+    uint64_t capture_stall_ns;                   /* Capture: waiting for a free slot */
+    uint64_t parse_ns;                           /* Parse: busy time */
+};
 
 /**
  * Source ID to channel number mapping entry
  * Built from VCT during scan, used by EIT/ETT parsers
  */
 typedef struct {
-    char key[64];   /* Format: "frequency_sourceid" */
-    char val[16];   /* Virtual channel number (e.g., "15.1") */
-} SourceMap;
+    uint32_t freq;      /* Mux frequency in Hz */
+    int source_id;      /* ATSC source_id from the VCT */
+    int next;           /* Next entry index in bucket chain, -1 terminates */
+    char val[16];       /* Virtual channel number (e.g., "15.1") */
+} SourceMapEntry;
+
+#define SOURCE_MAP_SHARDS 16    /* Sharded by frequency: one mux per worker */
+#define SOURCE_MAP_BUCKETS 64   /* Hash buckets per shard */
+
+/**
+ * One shard of the source map
+ * Entries live in a growable array in insertion order, so chains are
+ * index-based and survive realloc; the first entry for a frequency is
+ * the first one found when walking the array.
+ */
+typedef struct {
+    pthread_rwlock_t lock;
+    int buckets[SOURCE_MAP_BUCKETS];
+    SourceMapEntry *entries;
+    int count;
+    int cap;
+} SourceMapShard;
 
 /* VCT source_id → channel mapping (fallback, prefer channels.conf) */
-static SourceMap source_map[256];
-static int source_map_count = 0;
-static pthread_mutex_t source_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SourceMapShard source_map[SOURCE_MAP_SHARDS];
+static pthread_once_t source_map_once = PTHREAD_ONCE_INIT;
 
 /**
  * Mux scan job - represents one frequency to scan
@@ -103,6 +182,7 @@ static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
 /* EPG thread state */
 int epg_running = 0;
 int epg_skip_first = 0;
+int epg_guide_depth = EPG_GUIDE_DEPTH;
 static int epg_completed_cycles = 0;
 static pthread_mutex_t cycle_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t cycle_cond = PTHREAD_COND_INITIALIZER;
@@ -112,9 +192,10 @@ static pthread_t worker_threads[MAX_TUNERS];
 // Prototypes
 // -----------------------------------------------------------------------------
 
-void scan_mux(Tuner *t, ScanContext *ctx, const char *channel_number, const char *channel_name);
+void scan_mux(Tuner *t, unsigned gen, ScanContext *ctx, const char *channel_number, const char *channel_name);
 void handle_section(ScanContext *ctx, int pid, unsigned char *section, int len);
-int parse_ts_chunk(ScanContext *ctx, const unsigned char *buf, size_t len);
+void scan_context_init(ScanContext *ctx, const char *freq);
+size_t parse_ts_chunk(ScanContext *ctx, const unsigned char *buf, size_t len);
 void parse_atsc_vct(ScanContext *ctx, unsigned char *section, int len);
 void parse_atsc_eit(ScanContext *ctx, unsigned char *section, int len);
 void parse_atsc_ett(ScanContext *ctx, unsigned char *section, int len);
@@ -123,54 +204,106 @@ void parse_atsc_ett(ScanContext *ctx, unsigned char *section, int len);
 // Source Map Helpers (Thread-Safe)
 // -----------------------------------------------------------------------------
 
-void add_source_map(const char *freq, int source_id, const char *chan_num) {
-    char key[64];
-    snprintf(key, sizeof(key), "%s_%d", freq, source_id);
-    
-    pthread_mutex_lock(&source_map_mutex);
-    for(int i=0; i<source_map_count; i++) {
-        if (strcmp(source_map[i].key, key) == 0) {
-            pthread_mutex_unlock(&source_map_mutex);
-            return;
-        }
+static void source_map_init(void) {
+    for (int i = 0; i < SOURCE_MAP_SHARDS; i++) {
+        pthread_rwlock_init(&source_map[i].lock, NULL);
+        memset(source_map[i].buckets, 0xFF, sizeof(source_map[i].buckets));
+        source_map[i].entries = NULL;
+        source_map[i].count = 0;
+        source_map[i].cap = 0;
     }
-    if (source_map_count < 256) {
-        strcpy(source_map[source_map_count].key, key);
-        strcpy(source_map[source_map_count].val, chan_num);
-        source_map_count++;
+}
+
+static inline SourceMapShard *source_map_shard(uint32_t freq) {
+    // ATSC muxes sit on 6 MHz raster; fold MHz so neighbours spread across shards
+    return &source_map[(freq / 1000000) % SOURCE_MAP_SHARDS];
+}
+
+static inline int source_map_bucket(uint32_t freq, int source_id) {
+    uint32_t h = (freq ^ ((uint32_t)source_id * 0x9E3779B1u)) * 0x85EBCA6Bu;
+    return (h >> 16) % SOURCE_MAP_BUCKETS;
+}
+
+// Caller holds the shard lock
+static SourceMapEntry *source_map_find(SourceMapShard *sh, uint32_t freq, int source_id) {
+    for (int i = sh->buckets[source_map_bucket(freq, source_id)]; i >= 0; i = sh->entries[i].next) {
+        if (sh->entries[i].freq == freq && sh->entries[i].source_id == source_id) return &sh->entries[i];
     }
-    pthread_mutex_unlock(&source_map_mutex);
+    return NULL;
 }
 
-const char *get_source_map(const char *freq, int source_id) {
-    static char result[16];
-    char key[64];
-    snprintf(key, sizeof(key), "%s_%d", freq, source_id);
-    
-    pthread_mutex_lock(&source_map_mutex);
-    for(int i=0; i<source_map_count; i++) {
-        if (strcmp(source_map[i].key, key) == 0) {
-            strncpy(result, source_map[i].val, sizeof(result));
-            pthread_mutex_unlock(&source_map_mutex);
-            return result;
+static void add_source_map(uint32_t freq, int source_id, const char *chan_num) {
+    pthread_once(&source_map_once, source_map_init);
+    SourceMapShard *sh = source_map_shard(freq);
+
+    pthread_rwlock_wrlock(&sh->lock);
+    if (!source_map_find(sh, freq, source_id)) {
+        if (sh->count == sh->cap) {
+            int new_cap = sh->cap ? sh->cap * 2 : 64;
+            SourceMapEntry *tmp = realloc(sh->entries, new_cap * sizeof(SourceMapEntry));
+            if (!tmp) {
+                pthread_rwlock_unlock(&sh->lock);
+                return;
+            }
+            sh->entries = tmp;
+            sh->cap = new_cap;
         }
+        int b = source_map_bucket(freq, source_id);
+        SourceMapEntry *e = &sh->entries[sh->count];
+        e->freq = freq;
+        e->source_id = source_id;
+        snprintf(e->val, sizeof(e->val), "%s", chan_num);
+        e->next = sh->buckets[b];
+        sh->buckets[b] = sh->count++;
     }
-    pthread_mutex_unlock(&source_map_mutex);
-    return NULL;
+    pthread_rwlock_unlock(&sh->lock);
+}
+
+/**
+ * Look up the VCT channel number for a source_id on a mux
+ * @param out Caller buffer receiving the channel number
+ * @return 1 if found, 0 otherwise
+ */
+static int get_source_map(uint32_t freq, int source_id, char *out, size_t out_len) {
+    pthread_once(&source_map_once, source_map_init);
+    SourceMapShard *sh = source_map_shard(freq);
+    int found = 0;
+
+    pthread_rwlock_rdlock(&sh->lock);
+    SourceMapEntry *e = source_map_find(sh, freq, source_id);
+    if (e) {
+        snprintf(out, out_len, "%s", e->val);
+        found = 1;
+    }
+    pthread_rwlock_unlock(&sh->lock);
+    return found;
 }
 
-const char *get_first_channel_on_freq(const char *freq) {
-    static char result[16];
-    pthread_mutex_lock(&source_map_mutex);
-    for(int i=0; i<source_map_count; i++) {
-        if (strncmp(source_map[i].key, freq, strlen(freq)) == 0 && source_map[i].key[strlen(freq)] == '_') {
-            strncpy(result, source_map[i].val, sizeof(result));
-            pthread_mutex_unlock(&source_map_mutex);
-            return result;
+static int get_first_channel_on_freq(uint32_t freq, char *out, size_t out_len) {
+    pthread_once(&source_map_once, source_map_init);
+    SourceMapShard *sh = source_map_shard(freq);
+    int found = 0;
+
+    pthread_rwlock_rdlock(&sh->lock);
+    for (int i = 0; i < sh->count; i++) {
+        if (sh->entries[i].freq == freq) {
+            snprintf(out, out_len, "%s", sh->entries[i].val);
+            found = 1;
+            break;
         }
     }
-    pthread_mutex_unlock(&source_map_mutex);
-    return NULL;
+    pthread_rwlock_unlock(&sh->lock);
+    return found;
+}
+
+static void clear_source_map(void) {
+    pthread_once(&source_map_once, source_map_init);
+    for (int i = 0; i < SOURCE_MAP_SHARDS; i++) {
+        pthread_rwlock_wrlock(&source_map[i].lock);
+        memset(source_map[i].buckets, 0xFF, sizeof(source_map[i].buckets));
+        source_map[i].count = 0;
+        pthread_rwlock_unlock(&source_map[i].lock);
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -216,7 +349,8 @@ void *scanner_worker(void *arg) {
         MuxJob job;
         if (!dequeue_mux(&job)) break;
 
-        Tuner *t = acquire_tuner(USER_EPG);
+        unsigned gen;
+        Tuner *t = acquire_tuner(USER_EPG, &gen);
         if (!t) {
             // Should not happen as we have as many threads as tuners, 
             // but just in case, requeue and wait
@@ -225,19 +359,21 @@ void *scanner_worker(void *arg) {
             continue;
         }
 
-        ScanContext *ctx = calloc(1, sizeof(ScanContext));
-        ctx->freq = job.freq;
-        
-        scan_mux(t, ctx, job.number, job.name);
+        ScanContext *ctx = malloc(sizeof(ScanContext));
+        if (!ctx) {
+            release_tuner_if(t, gen);
+            continue;
+        }
+        scan_context_init(ctx, job.freq);
         
-        // Re-check if we were preempted (zap_pid will be 0 if killed by release_tuner)
-        // Actually, scan_mux returns when the read fails.
-        // If we want to requeue, we should check if we finished or were killed.
-        // For simplicity, we'll requeue if scan_mux didn't finish the 15s.
-        // But scan_mux is synchronous and waitpid happens inside.
+        ctx->lineup = channels_acquire();
+        scan_mux(t, gen, ctx, job.number, job.name);
+        channels_release(ctx->lineup);
         
+        // If a stream preempted the scan the tuner is no longer ours;
+        // releasing it by generation leaves the stream's zap alone
         free(ctx);
-        release_tuner(t);
+        release_tuner_if(t, gen);
     }
     return NULL;
 }
@@ -267,26 +403,27 @@ void *epg_orchestrator(void *arg) {
         fflush(stdout);
         db_cleanup_expired();
 
-        pthread_mutex_lock(&source_map_mutex);
-        source_map_count = 0;
-        pthread_mutex_unlock(&source_map_mutex);
+        clear_source_map();
 
-        // 1. Identify unique muxes and enqueue
-        char scanned_freqs[MAX_CHANNELS][32];
+        // 1. Identify unique muxes and enqueue (lineup may change between cycles)
+        ChannelTable *lineup = channels_acquire();
+        uint32_t *scanned_freqs = malloc((lineup->count + 1) * sizeof(uint32_t));
         int scanned_count = 0;
 
-        for (int i = 0; i < channel_count; i++) {
-            Channel *c = &channels[i];
+        for (int i = 0; scanned_freqs && i < lineup->count; i++) {
+            Channel *c = &lineup->channels[i];
             int already = 0;
             for(int k=0; k<scanned_count; k++) {
-                if (strcmp(scanned_freqs[k], c->frequency) == 0) {
+                if (scanned_freqs[k] == c->freq_hz) {
                     already = 1; break;
                 }
             }
             if (already) continue;
-            strcpy(scanned_freqs[scanned_count++], c->frequency);
+            scanned_freqs[scanned_count++] = c->freq_hz;
             enqueue_mux(c->frequency, c->name, c->number);
         }
+        free(scanned_freqs);
+        channels_release(lineup);
 
         // Wait for all jobs to be processed
         while (1) {
@@ -298,7 +435,19 @@ void *epg_orchestrator(void *arg) {
             if (!epg_running) break;
         }
 
+        // Guide data is only complete once the writer has caught up
+        epg_writer_flush();
+
         LOG_INFO("EPG", "Scan cycle complete");
+        EpgWriterStats ws;
+        epg_writer_stats(&ws);
+        LOG_DEBUG("EPG", "Writer: %lu updates in %lu batches / %lu transactions, %.1f ms in SQLite, queue high water %d, %lu dropped",
+                  ws.events, ws.batches, ws.transactions, ws.db_ns / 1e6, ws.queue_high_water, ws.dropped_events);
+        MssCacheStats cs;
+        mss_cache_stats(&cs);
+        unsigned long lookups = cs.hits + cs.misses;
+        LOG_DEBUG("EPG", "String cache: %lu entries (%zu KB), %.1f%% hit rate over %lu lookups, %lu evictions",
+                  cs.entries, cs.bytes / 1024, lookups ? 100.0 * cs.hits / lookups : 0.0, lookups, cs.evictions);
         fflush(stdout);
 
         // Notify that a cycle has completed
@@ -332,6 +481,7 @@ void wait_for_first_epg_scan() {
 void start_epg_thread() {
     if (epg_running) return;
     epg_running = 1;
+    epg_writer_start();
 
     // Start scanner threads (one per tuner)
     for (int i = 0; i < tuner_count; i++) {
@@ -352,193 +502,405 @@ void stop_epg_thread() {
     for (int i = 0; i < tuner_count; i++) {
         pthread_join(worker_threads[i], NULL);
     }
+    epg_writer_stop();
 }
 
-// Decode ATSC Multiple String Structure (MSS)
-// Ref: A/65 Section 6.10
-static void atsc_mss_to_string(const unsigned char *buf, int len, char *dest, size_t dest_len) {
-    if (len < 1 || !dest || dest_len == 0) return;
+// Append one Unicode code point as UTF-8; control characters become spaces
+static size_t mss_put_char(char *dest, size_t pos, size_t cap, unsigned int cp) {
+    if (cp < 0x20 || (cp >= 0x7F && cp < 0xA0) || (cp >= 0xD800 && cp < 0xE000)) cp = ' ';
+    if (cp < 0x80) {
+        if (pos + 1 > cap) return pos;
+        dest[pos++] = (char)cp;
+    } else if (cp < 0x800) {
+        if (pos + 2 > cap) return pos;
+        dest[pos++] = (char)(0xC0 | (cp >> 6));
+        dest[pos++] = (char)(0x80 | (cp & 0x3F));
+    } else {
+        if (pos + 3 > cap) return pos;
+        dest[pos++] = (char)(0xE0 | (cp >> 12));
+        dest[pos++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        dest[pos++] = (char)(0x80 | (cp & 0x3F));
+    }
+    return pos;
+}
+
+// Decode ATSC Multiple String Structure (MSS) into a multi-language buffer
+// Ref: A/65 Section 6.10. Every string is kept, tagged with its language
+// (see mls.h). The output length is tracked explicitly so each input byte
+// is visited once, and text is written as UTF-8 in that same pass.
+// Results are memoized by raw bytes: repeat airings and every later EIT/ETT
+// cycle resend identical strings
+static size_t atsc_mss_to_string(const unsigned char *buf, int len, char *dest, size_t dest_len) {
+    if (len < 1 || !dest || dest_len == 0) return 0;
     dest[0] = '\0';
+    int cached = mss_cache_get(buf, len, dest, dest_len);
+    if (cached >= 0) return (size_t)cached;
 
+    size_t cap = dest_len - 1;  // Reserve the terminator
+    size_t out = 0;
     int num_strings = buf[0];
     int pos = 1;
 
-    // We take the first string for simplicity (usually there's only one, or first is preferred)
     for (int i = 0; i < num_strings; i++) {
         if (pos + 4 > len) break;
-        // ISO_639_language_code (3 bytes)
-        // char lang[4] = { buf[pos], buf[pos+1], buf[pos+2], 0 };
         int num_segments = buf[pos+3];
+
+        // Variant header: separator + ISO_639_language_code
+        size_t variant_start = out;
+        if (out + 1 + MLS_LANG_LEN < cap) {
+            int valid = isalpha(buf[pos]) && isalpha(buf[pos+1]) && isalpha(buf[pos+2]);
+            dest[out++] = MLS_SEP;
+            for (int k = 0; k < MLS_LANG_LEN; k++) {
+                dest[out++] = valid ? (char)tolower(buf[pos + k]) : "und"[k];
+            }
+        }
+        size_t text_start = out;
         pos += 4;
 
         for (int j = 0; j < num_segments; j++) {
             if (pos + 3 > len) break;
             unsigned char compr = buf[pos];
-            // unsigned char mode = buf[pos+1];
+            unsigned char mode = buf[pos+1];
             int n_bytes = buf[pos+2];
             pos += 3;
 
             if (pos + n_bytes > len) break;
+            if (text_start == variant_start) {
+                pos += n_bytes;  // No room left for this variant
+                continue;
+            }
 
-            if (compr == 0x00) {
-                // No compression
-                int to_copy = (n_bytes < (int)(dest_len - strlen(dest) - 1)) ? n_bytes : (int)(dest_len - strlen(dest) - 1);
-                if (to_copy > 0) {
-                    size_t cur_len = strlen(dest);
-                    memcpy(dest + cur_len, buf + pos, to_copy);
-                    dest[cur_len + to_copy] = '\0';
+            if (compr == 0x00 && mode <= 0x33) {
+                // Uncompressed: mode selects the Unicode page of each byte
+                for (int k = 0; k < n_bytes; k++) {
+                    out = mss_put_char(dest, out, cap, ((unsigned int)mode << 8) | buf[pos + k]);
+                }
+            } else if (compr == 0x00 && mode == 0x3F) {
+                // UTF-16 (BMP only)
+                for (int k = 0; k + 1 < n_bytes; k += 2) {
+                    out = mss_put_char(dest, out, cap, ((unsigned int)buf[pos + k] << 8) | buf[pos + k + 1]);
                 }
             } else if (compr == 0x01 || compr == 0x02) {
-                // Huffman (A/65 Annex C)
-                if (!huffman_decode(compr, buf + pos, n_bytes, dest, dest_len)) {
+                // Huffman (A/65 Annex C): 7-bit output, decoded in place
+                int n = huffman_decode(compr, buf + pos, n_bytes, dest + out, (int)(cap - out + 1));
+                if (n < 0) {
                     LOG_WARN("EPG", "Failed to decode Huffman segment type 0x%02X", compr);
-                    const char *msg = "[Compressed]";
-                    if (dest_len - strlen(dest) > strlen(msg) + 1) strcat(dest, msg);
+                    static const char msg[] = "[Compressed]";
+                    if (cap - out >= sizeof(msg) - 1) {
+                        memcpy(dest + out, msg, sizeof(msg) - 1);
+                        out += sizeof(msg) - 1;
+                    }
+                } else {
+                    for (int k = 0; k < n; k++, out++) {
+                        if ((unsigned char)dest[out] < 0x20 || (unsigned char)dest[out] > 0x7E) dest[out] = ' ';
+                    }
                 }
             }
-            
+
             pos += n_bytes;
         }
-        
-        // If we processed one string, we stop (usually one lang is enough)
-        break;
-    }
 
-    // Sanitize
-    for (int i = 0; dest[i]; i++) {
-        if ((unsigned char)dest[i] < 0x20 || (unsigned char)dest[i] > 0x7E) dest[i] = ' ';
-    }
-    // Trim
-    int d_len = strlen(dest);
-    while (d_len > 0 && dest[d_len-1] == ' ') {
-        dest[--d_len] = '\0';
+        // Trim; drop the variant entirely if nothing is left
+        while (out > text_start && dest[out-1] == ' ') out--;
+        if (out == text_start) out = variant_start;
     }
+
+    dest[out] = '\0';
+    mss_cache_put(buf, len, dest_len, dest, out);
+    return out;
 }
 
 // -----------------------------------------------------------------------------
 // TS / PSI Parser Implementation
 // -----------------------------------------------------------------------------
 
+static inline int pid_is_tracked(const ScanContext *ctx, int pid) {
+    return (ctx->pid_bitmap[pid >> 5] >> (pid & 31)) & 1;
+}
+
+static void track_pid(ScanContext *ctx, int pid, SectionHandler handler) {
+    ctx->pid_bitmap[pid >> 5] |= 1u << (pid & 31);
+    ctx->pid_handlers[pid] = handler;
+}
+
+static void handle_eit_section(ScanContext *ctx, int pid, unsigned char *section, int len) {
+    (void)pid;
+    if (section[0] == 0xCB) parse_atsc_eit(ctx, section, len);
+}
+
+static void handle_ett_section(ScanContext *ctx, int pid, unsigned char *section, int len) {
+    (void)pid;
+    if (section[0] == 0xCC) parse_atsc_ett(ctx, section, len);
+}
+
+// MGT (A/65 Section 6.2): register every EIT/ETT instance within the guide depth
+static void parse_atsc_mgt(ScanContext *ctx, unsigned char *section, int len) {
+    if (len < 11) return;
+    int tables_defined = (section[9] << 8) | section[10];
+    int loop_offset = 11;
+    for (int i = 0; i < tables_defined; i++) {
+        if (loop_offset + 11 > len) break;
+        int type = (section[loop_offset] << 8) | section[loop_offset+1];
+        int t_pid = ((section[loop_offset+2] & 0x1F) << 8) | section[loop_offset+3];
+        int instance = type & 0x7F;
+
+        if (t_pid != PSIP_BASE_PID && !pid_is_tracked(ctx, t_pid) && instance < epg_guide_depth) {
+            if (type >= 0x0100 && type <= 0x017F) {
+                track_pid(ctx, t_pid, handle_eit_section);
+                ctx->eit_pid_count++;
+            } else if (type >= 0x0200 && type <= 0x027F) {
+                track_pid(ctx, t_pid, handle_ett_section);
+                ctx->ett_pid_count++;
+            }
+        }
+        int desc_len = ((section[loop_offset+9] & 0x0F) << 8) | section[loop_offset+10];
+        loop_offset += 11 + desc_len;
+    }
+}
+
+static void handle_base_section(ScanContext *ctx, int pid, unsigned char *section, int len) {
+    (void)pid;
+    unsigned char table_id = section[0];
+    if (table_id == 0xC7) {
+        parse_atsc_mgt(ctx, section, len);
+    } else if (table_id == 0xC8 || table_id == 0xC9) {
+        parse_atsc_vct(ctx, section, len);
+    }
+}
+
+void scan_context_init(ScanContext *ctx, const char *freq) {
+    for (int i = 0; i < TS_PID_COUNT; i++) {
+        ctx->pid_buffers[i].active = 0;
+        ctx->pid_buffers[i].last_cc = -1;
+    }
+    memset(ctx->pid_bitmap, 0, sizeof(ctx->pid_bitmap));
+    memset(ctx->pid_handlers, 0, sizeof(ctx->pid_handlers));
+    ctx->eit_pid_count = 0;
+    ctx->ett_pid_count = 0;
+    ctx->packet_count = 0;
+    ctx->sync_losses = 0;
+    ctx->section_count = 0;
+    ctx->cc_errors = 0;
+    ctx->crc_errors = 0;
+    ctx->freq = freq;
+    ctx->freq_hz = (uint32_t)strtoul(freq, NULL, 10);
+    ctx->lineup = NULL;
+    ctx->ring = NULL;
+    ctx->events = NULL;
+    ctx->events_queued = 0;
+    ctx->events_dropped = 0;
+    ctx->capture_bytes = 0;
+    ctx->capture_stalls = 0;
+    ctx->capture_wait_ns = 0;
+    ctx->capture_stall_ns = 0;
+    ctx->parse_ns = 0;
+    track_pid(ctx, PSIP_BASE_PID, handle_base_section);
+}
+
 void handle_section(ScanContext *ctx, int pid, unsigned char *section, int len) {
     if (len < 3) return;
-    unsigned char table_id = section[0];
-    
-    int is_eit_pid = 0;
-    for (int k = 0; k < ctx->eit_pid_count; k++) {
-        if (ctx->eit_pids[k] == pid) { is_eit_pid = 1; break; }
+    SectionHandler handler = ctx->pid_handlers[pid];
+    if (handler) handler(ctx, pid, section, len);
+}
+
+// Find the next 0x47 candidate; SSE2 compares 16 bytes per step where available
+static const unsigned char *ts_scan_sync_byte(const unsigned char *p, const unsigned char *end) {
+#ifdef __SSE2__
+    const __m128i sync = _mm_set1_epi8(TS_SYNC_BYTE);
+    while (p + 16 <= end) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, sync));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
     }
-    
-    if (pid == 0x1FFB || is_eit_pid) {
-        if (table_id == 0xC7) {
-            // MGT
-            int tables_defined = (section[9] << 8) | section[10];
-            int loop_offset = 11;
-            for(int i=0; i<tables_defined; i++) {
-                if(loop_offset + 11 > len) break;
-                int type = (section[loop_offset] << 8) | section[loop_offset+1];
-                int t_pid = ((section[loop_offset+2] & 0x1F) << 8) | section[loop_offset+3];
-                
-                if (type >= 0x0100 && type <= 0x017F) {
-                    if (ctx->eit_pid_count < MAX_EIT_PIDS) {
-                        int found = 0;
-                        for (int k = 0; k < ctx->eit_pid_count; k++) {
-                            if (ctx->eit_pids[k] == t_pid) { found = 1; break; }
-                        }
-                        if (!found) ctx->eit_pids[ctx->eit_pid_count++] = t_pid;
-                    }
-                }
-                int desc_len = ((section[loop_offset+9] & 0x0F) << 8) | section[loop_offset+10];
-                loop_offset += 11 + desc_len;
-            }
+#endif
+    if (p >= end) return NULL;
+    return memchr(p, TS_SYNC_BYTE, end - p);
+}
+
+/**
+ * Locate 188-byte packet alignment within buf
+ * A candidate is accepted once TS_SYNC_CONFIRM consecutive sync bytes are
+ * seen at packet stride. If a candidate cannot be confirmed because the
+ * buffer ends first, its offset is returned with *need_more set so the
+ * caller can retry once more data has been read.
+ * @return Offset of the aligned packet, or len if no candidate exists
+ */
+static size_t ts_find_sync(const unsigned char *buf, size_t len, int *need_more) {
+    const unsigned char *end = buf + len;
+    const unsigned char *p = buf;
+    *need_more = 0;
+
+    while ((p = ts_scan_sync_byte(p, end)) != NULL) {
+        int confirmed = 1;
+        const unsigned char *q = p + TS_PACKET_SIZE;
+        while (confirmed < TS_SYNC_CONFIRM && q < end && *q == TS_SYNC_BYTE) {
+            confirmed++;
+            q += TS_PACKET_SIZE;
         }
-        if (table_id == 0xC8 || table_id == 0xC9) {
-            parse_atsc_vct(ctx, section, len);
-        } else if (table_id == 0xCB) {
-            parse_atsc_eit(ctx, section, len);
-        } else if (table_id == 0xCC) {
-            parse_atsc_ett(ctx, section, len);
+        if (confirmed == TS_SYNC_CONFIRM) return p - buf;
+        if (q >= end) {
+            *need_more = 1;
+            return p - buf;
         }
+        p++;
     }
+    return len;
 }
 
-int parse_ts_chunk(ScanContext *ctx, const unsigned char *buf, size_t len) {
-    int packet_count = 0;
-    for (size_t i = 0; i + TS_PACKET_SIZE <= len; i += TS_PACKET_SIZE) {
-        if (buf[i] != 0x47) continue;
+/**
+ * Extract header fields for up to max consecutive aligned packets
+ * Stops at the first packet whose sync byte is missing or that would
+ * run past the buffer, so the caller can resynchronize from there.
+ */
+static int ts_extract_headers(const unsigned char *buf, size_t len, TsPacketInfo *out, int max) {
+    int n = 0;
+    size_t avail = len / TS_PACKET_SIZE;
+    if ((size_t)max > avail) max = (int)avail;
+    for (; n < max; n++) {
+        const unsigned char *pkt = buf + (size_t)n * TS_PACKET_SIZE;
+        if (pkt[0] != TS_SYNC_BYTE) break;
+        out[n].pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
+        out[n].flags = (pkt[1] & 0xC0) | (pkt[3] & 0x3F);
+    }
+    return n;
+}
 
-        int tei = buf[i+1] & 0x80;
-        if (tei) continue;
+static void section_deliver(ScanContext *ctx, int pid, unsigned char *section, int len) {
+    // Long-form sections (syntax indicator set) carry a CRC32; PSIP always does
+    if ((section[1] & 0x80) && (len < 7 || crc32_mpeg(section, len) != 0)) {
+        ctx->crc_errors++;
+        return;
+    }
+    ctx->section_count++;
+    handle_section(ctx, pid, section, len);
+}
 
-        int pusi = buf[i+1] & 0x40;
-        int pid = ((buf[i+1] & 0x1F) << 8) | buf[i+2];
-        int adap = (buf[i+3] >> 4) & 0x3;
-        int payload_offset = 4;
+/**
+ * Append payload bytes to the section being reassembled on a PID
+ * Completed sections are delivered immediately. Oversized sections are
+ * abandoned.
+ * @return Number of bytes consumed from data, or -1 if the section header
+ *         gave an invalid length
+ */
+static int section_feed(ScanContext *ctx, int pid, SectionBuffer *sb, const unsigned char *data, int len) {
+    int used = 0;
+    while (used < len && sb->active) {
+        int want = sb->expected_len ? sb->expected_len - sb->len : 3 - sb->len;
+        int take = (len - used < want) ? len - used : want;
+        memcpy(sb->buffer + sb->len, data + used, take);
+        sb->len += take;
+        used += take;
+
+        if (!sb->expected_len) {
+            if (sb->len < 3) break;
+            sb->expected_len = (((sb->buffer[1] & 0x0F) << 8) | sb->buffer[2]) + 3;
+            if (sb->expected_len > MAX_SECTION_SIZE) {
+                sb->active = 0;
+                return -1;
+            }
+        } else if (sb->len == sb->expected_len) {
+            sb->active = 0;
+            section_deliver(ctx, pid, sb->buffer, sb->len);
+        }
+    }
+    return used;
+}
+
+/**
+ * Reassemble PSI sections from one TS packet
+ *
+ * Follows ISO 13818-1 section packetization: bytes before the pointer
+ * field finish the pending section, then any number of new sections may
+ * start in the same packet until 0xFF stuffing. A continuity counter gap
+ * abandons the pending section rather than splicing unrelated data.
+ */
+static void ts_handle_packet(ScanContext *ctx, const unsigned char *pkt, const TsPacketInfo *info) {
+    int pid = info->pid;
+    int pusi = info->flags & TS_FLAG_PUSI;
+    int adap = (info->flags >> 4) & 0x3;
+    int cc = info->flags & 0x0F;
+    int payload_offset = 4;
+    int discontinuity = 0;
+    SectionBuffer *sb = &ctx->pid_buffers[pid];
+
+    if (!(adap & 0x1)) return;  // No payload; CC does not advance
+
+    if (adap == 0x3) {
+        int adap_len = pkt[4];
+        if (adap_len > 0) discontinuity = pkt[5] & 0x80;
+        payload_offset += adap_len + 1;
+    }
 
-        if (adap == 0x2 || adap == 0x3) {
-            int adap_len = buf[i+4];
-            payload_offset += adap_len + 1;
+    if (sb->last_cc >= 0 && !discontinuity) {
+        if (cc == sb->last_cc) return;  // Duplicate packet
+        if (cc != ((sb->last_cc + 1) & 0x0F)) {
+            ctx->cc_errors++;
+            sb->active = 0;
         }
+    }
+    sb->last_cc = cc;
 
-        if (payload_offset >= TS_PACKET_SIZE) continue;
+    if (payload_offset >= TS_PACKET_SIZE) return;
 
-        unsigned char *payload = (unsigned char*)buf + i + payload_offset;
-        int payload_len = TS_PACKET_SIZE - payload_offset;
+    const unsigned char *payload = pkt + payload_offset;
+    int payload_len = TS_PACKET_SIZE - payload_offset;
 
-        int interesting = (pid == 0x1FFB);
-        if (!interesting) {
-            for (int k = 0; k < ctx->eit_pid_count; k++) {
-                if (ctx->eit_pids[k] == pid) { interesting = 1; break; }
-            }
-        }
-        if (!interesting) continue; 
-
-        if (pusi) {
-            if (payload_len < 1) continue;
-            int pointer = payload[0];
-            payload++; payload_len--;
-            
-            if (pointer < payload_len) {
-                if (ctx->pid_buffers[pid].active) {
-                    if (ctx->pid_buffers[pid].len + pointer < 4096) {
-                        memcpy(ctx->pid_buffers[pid].buffer + ctx->pid_buffers[pid].len, payload, pointer);
-                        handle_section(ctx, pid, ctx->pid_buffers[pid].buffer, ctx->pid_buffers[pid].len + pointer);
-                    }
-                    ctx->pid_buffers[pid].active = 0;
-                }
+    if (!pusi) {
+        section_feed(ctx, pid, sb, payload, payload_len);
+        return;
+    }
 
-                unsigned char *sec_start = payload + pointer;
-                int sec_rem = payload_len - pointer;
-                if (sec_rem >= 3) {
-                    int section_len = ((sec_start[1] & 0x0F) << 8) | sec_start[2];
-                    int total_len = section_len + 3;
-                    
-                    if (sec_rem >= total_len) {
-                        handle_section(ctx, pid, sec_start, total_len);
-                    } else {
-                        ctx->pid_buffers[pid].len = 0;
-                        memcpy(ctx->pid_buffers[pid].buffer, sec_start, sec_rem);
-                        ctx->pid_buffers[pid].len = sec_rem;
-                        ctx->pid_buffers[pid].expected_len = total_len;
-                        ctx->pid_buffers[pid].active = 1;
-                    }
-                }
-            }
-        } else {
-             if (ctx->pid_buffers[pid].active) {
-                 int needed = ctx->pid_buffers[pid].expected_len - ctx->pid_buffers[pid].len;
-                 int to_copy = (payload_len < needed) ? payload_len : needed;
-                 memcpy(ctx->pid_buffers[pid].buffer + ctx->pid_buffers[pid].len, payload, to_copy);
-                 ctx->pid_buffers[pid].len += to_copy;
-
-                 if (ctx->pid_buffers[pid].len >= ctx->pid_buffers[pid].expected_len) {
-                     handle_section(ctx, pid, ctx->pid_buffers[pid].buffer, ctx->pid_buffers[pid].len);
-                     ctx->pid_buffers[pid].active = 0;
-                 }
-             }
+    int pointer = payload[0];
+    payload++; payload_len--;
+    if (pointer > payload_len) {
+        sb->active = 0;
+        return;
+    }
+
+    if (sb->active) {
+        section_feed(ctx, pid, sb, payload, pointer);
+        sb->active = 0;  // Section did not end where the pointer says: drop it
+    }
+
+    int pos = pointer;
+    while (pos < payload_len && payload[pos] != 0xFF) {
+        sb->active = 1;
+        sb->len = 0;
+        sb->expected_len = 0;
+        int used = section_feed(ctx, pid, sb, payload + pos, payload_len - pos);
+        // After a bad length the rest of the packet cannot be framed
+        if (used < 0) break;
+        pos += used;
+        if (sb->active) break;  // Continues in the next packet
+    }
+}
+
+size_t parse_ts_chunk(ScanContext *ctx, const unsigned char *buf, size_t len) {
+    TsPacketInfo batch[TS_HEADER_BATCH];
+    size_t i = 0;
+
+    while (i + TS_PACKET_SIZE <= len) {
+        int n = ts_extract_headers(buf + i, len - i, batch, TS_HEADER_BATCH);
+
+        for (int k = 0; k < n; k++) {
+            if (batch[k].flags & TS_FLAG_TEI) continue;
+            if (!pid_is_tracked(ctx, batch[k].pid)) continue;
+            ts_handle_packet(ctx, buf + i + (size_t)k * TS_PACKET_SIZE, &batch[k]);
+        }
+        ctx->packet_count += n;
+        i += (size_t)n * TS_PACKET_SIZE;
+
+        if (n == 0) {
+            // Lost alignment: skip ahead to the next confirmed sync point
+            int need_more;
+            size_t skip = ts_find_sync(buf + i + 1, len - i - 1, &need_more) + 1;
+            ctx->sync_losses++;
+            i += skip;
+            if (need_more) break;
         }
-        packet_count++;
     }
-    return packet_count;
+    return i;
 }
 
 // -----------------------------------------------------------------------------
@@ -557,13 +919,32 @@ void parse_atsc_vct(ScanContext *ctx, unsigned char *section, int len) {
         
         char chan_num[16];
         snprintf(chan_num, sizeof(chan_num), "%d.%d", major, minor);
-        add_source_map(ctx->freq, source_id, chan_num);
+        add_source_map(ctx->freq_hz, source_id, chan_num);
 
         int desc_len = ((section[offset + 30] & 0x03) << 8) | section[offset + 31];
         offset += 32 + desc_len;
     }
 }
 
+// Hand the current event batch to the writer; never blocks
+static void flush_events(ScanContext *ctx) {
+    if (!ctx->events) return;
+    int n = ctx->events->count;
+    if (n > 0) {
+        if (epg_writer_submit(ctx->events)) ctx->events_queued += n;
+        else ctx->events_dropped += n;
+    } else {
+        epg_batch_free(ctx->events);
+    }
+    ctx->events = NULL;
+}
+
+static void emit_event(ScanContext *ctx, const EpgEvent *ev) {
+    if (ctx->events && ctx->events->count == EPG_BATCH_EVENTS) flush_events(ctx);
+    if (!ctx->events) ctx->events = epg_batch_new(ctx->freq);
+    if (!ctx->events || !epg_batch_add(ctx->events, ev)) ctx->events_dropped++;
+}
+
 void parse_atsc_eit(ScanContext *ctx, unsigned char *section, int len) {
     int source_id = (section[3] << 8) | section[4];
     int num_events = section[9];
@@ -571,12 +952,12 @@ void parse_atsc_eit(ScanContext *ctx, unsigned char *section, int len) {
 
     // Look up channel using channels.conf SERVICE_ID for accurate mapping
     // This avoids cross-frequency source_id collisions
-    Channel *ch = find_channel_by_freq_sid(ctx->freq, source_id);
+    Channel *ch = find_channel_by_freq_sid(ctx->lineup, ctx->freq_hz, source_id);
     if (!ch) {
         // Fall back to VCT map only for channels not in channels.conf
-        const char *vct_chan = get_source_map(ctx->freq, source_id);
-        if (!vct_chan) return;
-        ch = find_channel_by_number(vct_chan);
+        char vct_chan[16];
+        if (!get_source_map(ctx->freq_hz, source_id, vct_chan, sizeof(vct_chan))) return;
+        ch = find_channel_by_number(ctx->lineup, vct_chan);
         if (!ch) return;
     }
     const char *chan_num = ch->number;
@@ -601,7 +982,7 @@ void parse_atsc_eit(ScanContext *ctx, unsigned char *section, int len) {
             if (year < 2000 || year > current_year + 2) break;
         }
 
-        char title[256] = {0};
+        char title[512] = {0};
         if (title_len > 0) {
             int str_offset = offset + 10;
             if (str_offset + title_len <= len) {
@@ -610,7 +991,10 @@ void parse_atsc_eit(ScanContext *ctx, unsigned char *section, int len) {
         }
 
         if (title[0] != '\0' && start_ms > 0) {
-            db_upsert_program(ctx->freq, chan_num, start_ms, end_ms, title, event_id, source_id);
+            EpgEvent ev = { .kind = EPG_EVENT_PROGRAM, .start_ms = start_ms, .end_ms = end_ms,
+                            .event_id = event_id, .source_id = source_id, .text = title };
+            snprintf(ev.channel, sizeof(ev.channel), "%s", chan_num);
+            emit_event(ctx, &ev);
         }
 
         int after_title = offset + 10 + title_len;
@@ -628,16 +1012,16 @@ void parse_atsc_ett(ScanContext *ctx, unsigned char *section, int len) {
     int event_id = (etm_id >> 2) & 0x3FFF;
     
     // Use channels.conf SERVICE_ID for accurate mapping
-    Channel *ch = find_channel_by_freq_sid(ctx->freq, source_id_from_header);
+    Channel *ch = find_channel_by_freq_sid(ctx->lineup, ctx->freq_hz, source_id_from_header);
+    char vct_chan[16];
     const char *chan_num = NULL;
     if (ch) {
         chan_num = ch->number;
+    } else if (get_source_map(ctx->freq_hz, source_id_from_header, vct_chan, sizeof(vct_chan)) ||
+               get_first_channel_on_freq(ctx->freq_hz, vct_chan, sizeof(vct_chan))) {
+        chan_num = vct_chan;
     } else {
-        chan_num = get_source_map(ctx->freq, source_id_from_header);
-        if (!chan_num) {
-            const char *first = get_first_channel_on_freq(ctx->freq);
-            if (first) chan_num = first; else return;
-        }
+        return;
     }
     
     int section_length = ((section[1] & 0x0F) << 8) | section[2];
@@ -646,13 +1030,122 @@ void parse_atsc_ett(ScanContext *ctx, unsigned char *section, int len) {
     int mss_len = mss_end - mss_start;
     if (mss_len < 1 || mss_start + mss_len > len) return;
     
-    char desc[1024] = {0};
+    char desc[4096] = {0};
     atsc_mss_to_string(section + mss_start, mss_len, desc, sizeof(desc));
     
-    if (desc[0] != '\0') db_update_program_description(ctx->freq, chan_num, event_id, desc);
+    if (desc[0] != '\0') {
+        EpgEvent ev = { .kind = EPG_EVENT_DESCRIPTION, .event_id = event_id, .text = desc };
+        snprintf(ev.channel, sizeof(ev.channel), "%s", chan_num);
+        emit_event(ctx, &ev);
+    }
+}
+
+// Parse stage: packets -> sections -> events, one thread per scan
+static void *parse_stage(void *arg) {
+    ScanContext *ctx = arg;
+    unsigned char carry[TS_RING_HEADROOM];
+    size_t carry_len = 0;
+    TsBatch *b;
+
+    while ((b = ts_ring_next(ctx->ring)) != NULL) {
+        uint64_t t0 = metrics_now_ns();
+
+        // Put the previous batch's unparsed tail in front of this one
+        unsigned char *start = b->data + TS_RING_HEADROOM - carry_len;
+        memcpy(start, carry, carry_len);
+        size_t total = carry_len + b->len;
+        size_t consumed = parse_ts_chunk(ctx, start, total);
+
+        // parse_ts_chunk leaves less than TS_SYNC_CONFIRM packets unconsumed
+        carry_len = total - consumed;
+        if (carry_len > TS_RING_HEADROOM) {
+            consumed = total - TS_RING_HEADROOM;
+            carry_len = TS_RING_HEADROOM;
+        }
+        memcpy(carry, start + consumed, carry_len);
+        ts_ring_release(ctx->ring);
+
+        ctx->parse_ns += metrics_now_ns() - t0;
+    }
+
+    flush_events(ctx);
+    return NULL;
 }
 
-void scan_mux(Tuner *t, ScanContext *ctx, const char *channel_number, const char *channel_name) {
+// Run the capture and parse stages over fd until EOF
+// Capture happens on the calling thread: it only reads; parsing and
+// storage run behind the ring so a slow database never stalls input.
+// Returns 0 if the pipeline could not be started (nothing was read).
+static int run_scan_pipeline(ScanContext *ctx, int fd) {
+    TsRing *ring = malloc(sizeof(TsRing));
+    if (!ring) return 0;
+    ts_ring_init(ring);
+    ctx->ring = ring;
+
+    pthread_t parser;
+    if (pthread_create(&parser, NULL, parse_stage, ctx) != 0) {
+        LOG_ERROR("EPG", "Failed to start parse stage for %s", ctx->freq);
+        ts_ring_destroy(ring);
+        free(ring);
+        ctx->ring = NULL;
+        return 0;
+    }
+
+    for (;;) {
+        TsBatch *b = ts_ring_reserve(ring);
+        if (!b) {
+            uint64_t t0 = metrics_now_ns();
+            ctx->capture_stalls++;
+            b = ts_ring_reserve_wait(ring);
+            ctx->capture_stall_ns += metrics_now_ns() - t0;
+        }
+
+        uint64_t t0 = metrics_now_ns();
+        ssize_t n = read(fd, b->data + TS_RING_HEADROOM, TS_RING_SLOT_BYTES);
+        ctx->capture_wait_ns += metrics_now_ns() - t0;
+        if (n <= 0) break;
+
+        b->len = n;
+        ctx->capture_bytes += n;
+        ts_ring_publish(ring);
+    }
+
+    ts_ring_close(ring);
+    pthread_join(parser, NULL);
+    ts_ring_destroy(ring);
+    free(ring);
+    ctx->ring = NULL;
+    return 1;
+}
+
+int epg_replay_fd(int fd, const char *freq, EpgReplayStats *out) {
+    ScanContext *ctx = malloc(sizeof(ScanContext));
+    if (!ctx) return -1;
+    scan_context_init(ctx, freq);
+    ctx->lineup = channels_acquire();
+
+    int ok = run_scan_pipeline(ctx, fd);
+
+    if (out) {
+        out->bytes = ctx->capture_bytes;
+        out->packets = ctx->packet_count;
+        out->sections = ctx->section_count;
+        out->events_queued = ctx->events_queued;
+        out->events_dropped = ctx->events_dropped;
+        out->sync_losses = ctx->sync_losses;
+        out->cc_errors = ctx->cc_errors;
+        out->crc_errors = ctx->crc_errors;
+        out->read_ns = ctx->capture_wait_ns;
+        out->stall_ns = ctx->capture_stall_ns;
+        out->parse_ns = ctx->parse_ns;
+    }
+
+    channels_release(ctx->lineup);
+    free(ctx);
+    return ok ? 0 : -1;
+}
+
+void scan_mux(Tuner *t, unsigned gen, ScanContext *ctx, const char *channel_number, const char *channel_name) {
     int pipefd[2];
     if (pipe(pipefd) == -1) return;
     
@@ -669,28 +1162,40 @@ void scan_mux(Tuner *t, ScanContext *ctx, const char *channel_number, const char
         execlp("dvbv5-zap", "dvbv5-zap", "-c", channels_conf_path, "-a", adapter_id, "-P", "-t", "15", "-o", "-", channel_number, NULL);
         exit(1);
     } else if (pid > 0) {
-        t->zap_pid = pid;
+        // Preempted before we could record it: nobody else will stop it
+        if (!tuner_set_zap(t, gen, pid)) kill(pid, SIGTERM);
         close(pipefd[1]);
 
-        unsigned char buf[1024 * 32];
-        int leftover = 0;
-        ssize_t n;
-
-        while ((n = read(pipefd[0], buf + leftover, sizeof(buf) - leftover)) > 0) {
-            int total_len = leftover + n;
-            int packet_count = total_len / TS_PACKET_SIZE;
-            int bytes_to_process = packet_count * TS_PACKET_SIZE;
-            if (bytes_to_process > 0) parse_ts_chunk(ctx, buf, bytes_to_process);
-            leftover = total_len - bytes_to_process;
-            if (leftover > 0) memmove(buf, buf + bytes_to_process, leftover);
+        uint64_t scan_start = metrics_now_ns();
+        if (!run_scan_pipeline(ctx, pipefd[0])) {
+            // Closing our end makes the zap child exit on SIGPIPE; the
+            // mux is requeued below like a preempted scan
+            close(pipefd[0]);
+            pipefd[0] = -1;
         }
 
-        // If read returned < 0 and errno is not 0, we might have been preempted.
-        // Actually, if release_tuner kills the process, read will return 0 or error.
-        // Let's check if the child exited or was signaled.
+        // Reap zap (already reaped if a stream preempted us and killed it)
         int status;
         waitpid(pid, &status, 0);
-        t->zap_pid = 0;
+        tuner_set_zap(t, gen, 0);
+
+        metrics_observe(METRIC_EPG_SCAN, metrics_now_ns() - scan_start);
+        metrics_add(METRIC_EPG_SECTIONS, ctx->section_count);
+        metrics_add(METRIC_EPG_EVENTS, ctx->events_queued);
+        metrics_add(METRIC_EPG_EVENTS_DROPPED, ctx->events_dropped);
+        metrics_add(METRIC_EPG_CRC_ERRORS, ctx->crc_errors);
+        metrics_add(METRIC_EPG_CC_ERRORS, ctx->cc_errors);
+
+        LOG_DEBUG("EPG", "Mux %s: %ld packets, %ld sections, %ld resyncs, %ld CC / %ld CRC errors, tracked %d EIT / %d ETT PIDs",
+                  ctx->freq, ctx->packet_count, ctx->section_count, ctx->sync_losses,
+                  ctx->cc_errors, ctx->crc_errors, ctx->eit_pid_count, ctx->ett_pid_count);
+        LOG_DEBUG("EPG", "Mux %s stages: capture %ld KB (read wait %.1f ms, %ld stalls / %.1f ms), parse %.1f ms, %ld updates queued, %ld dropped",
+                  ctx->freq, ctx->capture_bytes / 1024, ctx->capture_wait_ns / 1e6,
+                  ctx->capture_stalls, ctx->capture_stall_ns / 1e6, ctx->parse_ns / 1e6,
+                  ctx->events_queued, ctx->events_dropped);
+        if (ctx->events_dropped > 0) {
+            LOG_WARN("EPG", "Mux %s: %ld guide updates dropped (writer queue full)", ctx->freq, ctx->events_dropped);
+        }
         
         if (WIFSIGNALED(status)) {
             LOG_DEBUG("EPG", "Scan of %s interrupted (likely preempted)", ctx->freq);
@@ -699,6 +1204,9 @@ void scan_mux(Tuner *t, ScanContext *ctx, const char *channel_number, const char
             enqueue_mux(ctx->freq, channel_name, channel_number);
         }
 
+        if (pipefd[0] >= 0) close(pipefd[0]);
+    } else {
         close(pipefd[0]);
+        close(pipefd[1]);
     }
 }
@@ -0,0 +1,166 @@
+/**
+ * @file epg_writer.c
+ * @brief Batched persistence stage for EPG scan results
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "epg_writer.h"
+#include "db.h"
+#include "metrics.h"
+#include "log.h"
+
+static EpgEventBatch *queue[EPG_WRITER_QUEUE];
+static int queue_head = 0;
+static int queue_count = 0;
+static int writer_busy = 0;
+static int writer_running = 0;
+static pthread_t writer_thread;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;   /* Work queued / stop */
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;     /* Queue drained */
+static EpgWriterStats stats;
+
+EpgEventBatch *epg_batch_new(const char *frequency) {
+    EpgEventBatch *b = malloc(sizeof(EpgEventBatch));
+    if (!b) return NULL;
+    snprintf(b->frequency, sizeof(b->frequency), "%s", frequency);
+    b->count = 0;
+    return b;
+}
+
+int epg_batch_add(EpgEventBatch *b, const EpgEvent *ev) {
+    if (b->count == EPG_BATCH_EVENTS) return 0;
+    char *text = strdup(ev->text ? ev->text : "");
+    if (!text) return 0;
+    b->events[b->count] = *ev;
+    b->events[b->count].text = text;
+    b->count++;
+    return 1;
+}
+
+void epg_batch_free(EpgEventBatch *b) {
+    if (!b) return;
+    for (int i = 0; i < b->count; i++) free(b->events[i].text);
+    free(b);
+}
+
+int epg_writer_submit(EpgEventBatch *b) {
+    pthread_mutex_lock(&writer_mutex);
+    if (!writer_running || queue_count == EPG_WRITER_QUEUE) {
+        stats.dropped_events += b->count;
+        pthread_mutex_unlock(&writer_mutex);
+        epg_batch_free(b);
+        return 0;
+    }
+    queue[(queue_head + queue_count) % EPG_WRITER_QUEUE] = b;
+    queue_count++;
+    if (queue_count > stats.queue_high_water) stats.queue_high_water = queue_count;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+    return 1;
+}
+
+static void apply_batch(const EpgEventBatch *b) {
+    for (int i = 0; i < b->count; i++) {
+        const EpgEvent *ev = &b->events[i];
+        if (ev->kind == EPG_EVENT_PROGRAM) {
+            db_upsert_program(b->frequency, ev->channel, ev->start_ms, ev->end_ms,
+                              ev->text, ev->event_id, ev->source_id);
+        } else {
+            db_update_program_description(b->frequency, ev->channel, ev->event_id, ev->text);
+        }
+    }
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    EpgEventBatch *work[EPG_WRITER_QUEUE];
+
+    pthread_mutex_lock(&writer_mutex);
+    for (;;) {
+        while (queue_count == 0 && writer_running) {
+            pthread_cond_wait(&writer_cond, &writer_mutex);
+        }
+        if (queue_count == 0) break;
+
+        // Take everything queued and write it as one transaction
+        int n = 0;
+        while (queue_count > 0) {
+            work[n++] = queue[queue_head];
+            queue_head = (queue_head + 1) % EPG_WRITER_QUEUE;
+            queue_count--;
+        }
+        writer_busy = 1;
+        pthread_mutex_unlock(&writer_mutex);
+
+        uint64_t t0 = metrics_now_ns();
+        unsigned long events = 0;
+        db_begin_batch();
+        for (int i = 0; i < n; i++) {
+            apply_batch(work[i]);
+            events += work[i]->count;
+        }
+        db_commit_batch();
+        uint64_t elapsed = metrics_now_ns() - t0;
+
+        for (int i = 0; i < n; i++) epg_batch_free(work[i]);
+
+        pthread_mutex_lock(&writer_mutex);
+        stats.batches += n;
+        stats.events += events;
+        stats.transactions++;
+        stats.db_ns += elapsed;
+        writer_busy = 0;
+        if (queue_count == 0) pthread_cond_broadcast(&idle_cond);
+    }
+    writer_busy = 0;
+    pthread_cond_broadcast(&idle_cond);
+    pthread_mutex_unlock(&writer_mutex);
+    return NULL;
+}
+
+void epg_writer_start() {
+    pthread_mutex_lock(&writer_mutex);
+    if (writer_running) {
+        pthread_mutex_unlock(&writer_mutex);
+        return;
+    }
+    writer_running = 1;
+    pthread_mutex_unlock(&writer_mutex);
+
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        LOG_ERROR("EPG", "Failed to start EPG writer thread");
+        pthread_mutex_lock(&writer_mutex);
+        writer_running = 0;
+        pthread_mutex_unlock(&writer_mutex);
+    }
+}
+
+void epg_writer_stop() {
+    pthread_mutex_lock(&writer_mutex);
+    if (!writer_running) {
+        pthread_mutex_unlock(&writer_mutex);
+        return;
+    }
+    writer_running = 0;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+    pthread_join(writer_thread, NULL);
+}
+
+void epg_writer_flush() {
+    pthread_mutex_lock(&writer_mutex);
+    while (writer_running && (queue_count > 0 || writer_busy)) {
+        pthread_cond_wait(&idle_cond, &writer_mutex);
+    }
+    pthread_mutex_unlock(&writer_mutex);
+}
+
+void epg_writer_stats(EpgWriterStats *out) {
+    pthread_mutex_lock(&writer_mutex);
+    *out = stats;
+    pthread_mutex_unlock(&writer_mutex);
+}
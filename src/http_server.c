@@ -4,21 +4,39 @@
  * 
  * Implements a simple HTTP/1.0 server with the following endpoints:
  * 
- *   GET /stream/{channel}  - Raw MPEG-TS stream from tuner
+ *   GET /stream/{channel}  - MPEG-TS of the channel's program (spts.h);
+ *                            ?mux=1 sends the whole mux,
+ *                            ?profile=latency|throughput (stream_out.h),
+ *                            ?pace=1 for PCR-paced output (pacer.h)
+ *                            (with -T: ?offset=<secs>, or Range with ?mux=1,
+                            to timeshift)
  *   GET /playlist.m3u      - M3U playlist of all channels  
+ *   GET /multicast.m3u     - M3U playlist of the channels' multicast groups (-M)
+ *   GET /multicast/{channel} - Publish a channel to its group (mcast.h),
+ *                            returns {"url": ...}
  *   GET /xmltv.xml         - EPG in XMLTV format
  *   GET /xmltv.json        - EPG in JSON format
+ *                            (both accept ?lang=xxx, an ISO 639 code)
+ *   GET /metrics           - Prometheus metrics (metrics.h)
+ *   GET /status            - Transport health of active streams (ts_health.h)
+ *   GET /startup           - Startup timelines of recent streams (stream_trace.h)
+ *   GET /recordings        - Scheduled and finished recordings (dvr.h)
+ *   GET /recordings/{id}   - Recording file (supports Range)
+ *   POST /recordings?channel=X.Y&start=<ms> - Record a program from the guide
+ *   DELETE /recordings/{id} - Cancel or delete a recording
+ *   POST /reload           - Reload channels.conf without restart
  * 
  * Architecture:
  * - Main thread accepts connections
  * - Each client is handled in a detached pthread
- * - Streaming uses fork() to spawn dvbv5-zap, piping TS to socket
+ * - Streaming reads from a shared per-mux capture (capture.h)
  * 
  * Flow for /stream/{channel}:
- * 1. Acquire tuner (may preempt EPG scan)
- * 2. Fork dvbv5-zap with channel number
- * 3. Read TS packets from pipe, write to socket
- * 4. On client disconnect, release tuner
+ * 1. Attach to a running or lingering capture of the channel's mux, or
+ *    acquire a tuner (may preempt EPG scan) and fork dvbv5-zap
+ * 2. Read TS packets from the capture, filter them down to the channel's
+ *    program, write to socket
+ * 3. On client disconnect, detach; the tuner lingers on the mux
  */
 
 #define _GNU_SOURCE
@@ -29,16 +47,32 @@
 #include <sys/types.h> 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <pthread.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <ctype.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 #include "http_server.h"
 #include "config.h"
 #include "log.h"
 #include "channels.h"
 #include "db.h"
 #include "tuner.h"
+#include "mls.h"
+#include "metrics.h"
+#include "ts_health.h"
+#include "stream_trace.h"
+#include "spts.h"
+#include "stream_out.h"
+#include "pacer.h"
+#include "capture.h"
+#include "timeshift.h"
+#include "dvr.h"
+#include "mcast.h"
 
 // Helper to find a specific header in the HTTP request buffer
 static char *find_header(const char *buffer, const char *header_name) {
@@ -80,6 +114,25 @@ static char *find_header(const char *buffer, const char *header_name) {
     return NULL;
 }
 
+// Copy a query string parameter value into out; returns 1 if present
+static int find_query_param(const char *query, const char *name, char *out, size_t out_len) {
+    size_t name_len = strlen(name);
+    const char *p = query;
+    while (p && *p) {
+        if (strncmp(p, name, name_len) == 0 && p[name_len] == '=') {
+            p += name_len + 1;
+            size_t len = strcspn(p, "&");
+            if (len >= out_len) len = out_len - 1;
+            memcpy(out, p, len);
+            out[len] = '\0';
+            return 1;
+        }
+        p = strchr(p, '&');
+        if (p) p++;
+    }
+    return 0;
+}
+
 void send_response(int sockfd, const char *status, const char *type, const char *body) {
     char header[1024];
     int len = body ? strlen(body) : 0;
@@ -126,7 +179,7 @@ void send_file(int sockfd, const char *filepath, const char *content_type) {
     fclose(f);
 }
 
-void handle_m3u(int sockfd, const char *host) {
+void handle_m3u(int sockfd, const char *host, int multicast) {
     // Dynamic allocation with bounds checking
     size_t cap = 1024 * 64; // Start with 64K
     size_t size = 0;
@@ -138,6 +191,7 @@ void handle_m3u(int sockfd, const char *host) {
     
     // Use provided host or fallback to localhost
     const char *display_host = (host && host[0] != '\0') ? host : "localhost";
+    ChannelTable *lineup = NULL;
     
     // Helper to append safely
     #define APPEND_M3U(str) do { \
@@ -145,7 +199,7 @@ void handle_m3u(int sockfd, const char *host) {
         while (size + slen + 1 > cap) { \
             cap *= 2; \
             char *tmp = realloc(m3u, cap); \
-            if (!tmp) { free(m3u); send_response(sockfd, "500 Internal Server Error", "text/plain", "Memory error"); return; } \
+            if (!tmp) { free(m3u); channels_release(lineup); send_response(sockfd, "500 Internal Server Error", "text/plain", "Memory error"); return; } \
             m3u = tmp; \
         } \
         strcpy(m3u + size, str); \
@@ -154,14 +208,23 @@ void handle_m3u(int sockfd, const char *host) {
     
     APPEND_M3U("#EXTM3U\n");
     
-    for (int i = 0; i < channel_count; i++) {
+    lineup = channels_acquire();
+    for (int i = 0; i < lineup->count; i++) {
+        const Channel *ch = &lineup->channels[i];
         char buf[1024];
-        // If host header didn't have port, but we're on a non-standard port, 
-        // strictly speaking we should probably include it, but Host usually has it.
-        snprintf(buf, sizeof(buf), "#EXTINF:-1 tvg-id=\"%s\" tvg-name=\"%s\",%s %s\nhttp://%s/stream/%s\n",
-            channels[i].number, channels[i].name, channels[i].number, channels[i].name, display_host, channels[i].number);
+        char url[320];
+        if (multicast) {
+            if (!mcast_url(ch, url, sizeof(url))) continue;
+        } else {
+            // If host header didn't have port, but we're on a non-standard port, 
+            // strictly speaking we should probably include it, but Host usually has it.
+            snprintf(url, sizeof(url), "http://%s/stream/%s", display_host, ch->number);
+        }
+        snprintf(buf, sizeof(buf), "#EXTINF:-1 tvg-id=\"%s\" tvg-name=\"%s\",%s %s\n%s\n",
+            ch->number, ch->name, ch->number, ch->name, url);
         APPEND_M3U(buf);
     }
+    channels_release(lineup);
     
     #undef APPEND_M3U
     
@@ -169,8 +232,8 @@ void handle_m3u(int sockfd, const char *host) {
     free(m3u);
 }
 
-void handle_xmltv(int sockfd) {
-    char *xml = db_get_xmltv_programs();
+void handle_xmltv(int sockfd, const char *lang) {
+    char *xml = db_get_xmltv_programs(lang);
     if (xml) {
         send_response(sockfd, "200 OK", "application/xml", xml);
         free(xml);
@@ -179,8 +242,87 @@ void handle_xmltv(int sockfd) {
     }
 }
 
-void handle_json(int sockfd) {
-    char *json = db_get_json_programs();
+void handle_json(int sockfd, const char *lang) {
+    char *json = db_get_json_programs(lang);
+    if (json) {
+        send_response(sockfd, "200 OK", "application/json", json);
+        free(json);
+    } else {
+        send_response(sockfd, "500 Internal Server Error", "text/plain", "Database Error");
+    }
+}
+
+
+void handle_metrics(int sockfd) {
+    char *text = metrics_render();
+    if (text) {
+        send_response(sockfd, "200 OK", "text/plain; version=0.0.4", text);
+        free(text);
+    } else {
+        send_response(sockfd, "500 Internal Server Error", "text/plain", "Memory error");
+    }
+}
+
+void handle_startup(int sockfd) {
+    char *json = trace_recent_json();
+    if (json) {
+        send_response(sockfd, "200 OK", "application/json", json);
+        free(json);
+    } else {
+        send_response(sockfd, "500 Internal Server Error", "text/plain", "Memory error");
+    }
+}
+
+void handle_status(int sockfd) {
+    char *json = ts_health_status_json();
+    if (json) {
+        send_response(sockfd, "200 OK", "application/json", json);
+        free(json);
+    } else {
+        send_response(sockfd, "500 Internal Server Error", "text/plain", "Memory error");
+    }
+}
+
+// Viewer address for /status, so a complaint can be matched to a session
+static void peer_name(int sockfd, char *out, size_t len) {
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    out[0] = '\0';
+    if (getpeername(sockfd, (struct sockaddr *)&addr, &alen) == 0 && addr.sin_family == AF_INET) {
+        char ip[INET_ADDRSTRLEN];
+        if (inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip))) {
+            snprintf(out, len, "%s:%d", ip, ntohs(addr.sin_port));
+        }
+    }
+}
+
+void handle_reload(int sockfd) {
+    int count = channels_reload();
+    if (count < 0) {
+        send_response(sockfd, "500 Internal Server Error", "text/plain", "Reload failed");
+        return;
+    }
+    char body[64];
+    snprintf(body, sizeof(body), "Loaded %d channels\n", count);
+    send_response(sockfd, "200 OK", "text/plain", body);
+}
+
+// Parse "bytes=N-" or "bytes=N-M" into [start, end); end 0 = open
+static int parse_range(const char *range, uint64_t *start, uint64_t *end) {
+    unsigned long long a, b;
+    char dash;
+    *end = 0;
+    if (sscanf(range, "bytes=%llu%c%llu", &a, &dash, &b) == 3 && dash == '-' && b >= a) {
+        *end = b + 1;
+    } else if (sscanf(range, "bytes=%llu%c", &a, &dash) != 2 || dash != '-') {
+        return 0;
+    }
+    *start = a;
+    return 1;
+}
+
+void handle_recordings(int sockfd) {
+    char *json = db_get_recordings_json();
     if (json) {
         send_response(sockfd, "200 OK", "application/json", json);
         free(json);
@@ -189,93 +331,299 @@ void handle_json(int sockfd) {
     }
 }
 
+// POST /recordings?channel=X.Y&start=<ms>: record a program from the guide
+void handle_recording_schedule(int sockfd, const char *query) {
+    char channel[32], start[24];
+    if (!query || !find_query_param(query, "channel", channel, sizeof(channel)) ||
+        !find_query_param(query, "start", start, sizeof(start))) {
+        send_response(sockfd, "400 Bad Request", "text/plain", "channel and start are required");
+        return;
+    }
+    int id = db_add_recording(channel, strtoll(start, NULL, 10));
+    if (id < 0) {
+        send_response(sockfd, "500 Internal Server Error", "text/plain", "Database Error");
+    } else if (id == 0) {
+        send_response(sockfd, "404 Not Found", "text/plain", "No such program in the guide");
+    } else {
+        char body[64];
+        snprintf(body, sizeof(body), "{\"id\": %d}\n", id);
+        send_response(sockfd, "201 Created", "application/json", body);
+    }
+}
+
+// GET /multicast/{channel}: publish the channel and say where
+void handle_multicast(int sockfd, const char *channel) {
+    ChannelTable *lineup = channels_acquire();
+    Channel *found = find_channel_by_number(lineup, channel);
+    Channel chan;
+    if (found) chan = *found;
+    channels_release(lineup);
 
-void handle_stream(int sockfd, const char *channel) {
-    // 1. Validate Channel
-    Channel *c = find_channel_by_number(channel);
-    if (!c) {
+    char url[64];
+    if (mcast_mode == MCAST_OFF) {
+        send_response(sockfd, "404 Not Found", "text/plain", "Multicast is disabled (-M)");
+    } else if (!found) {
         send_response(sockfd, "404 Not Found", "text/plain", "Channel not found");
+    } else if (!mcast_url(&chan, url, sizeof(url)) || !mcast_request(&chan)) {
+        send_response(sockfd, "404 Not Found", "text/plain", "Channel has no multicast group");
+    } else {
+        char body[96];
+        snprintf(body, sizeof(body), "{\"url\": \"%s\"}\n", url);
+        send_response(sockfd, "200 OK", "application/json", body);
+    }
+}
+
+void handle_recording_delete(int sockfd, int id) {
+    if (dvr_delete(id)) send_response(sockfd, "200 OK", "text/plain", "Deleted");
+    else send_response(sockfd, "404 Not Found", "text/plain", "Recording not found");
+}
+
+// GET /recordings/{id}: the file, with Range, straight from the page cache
+void handle_recording_file(int sockfd, int id, const char *range) {
+    DbRecording r;
+    if (!db_get_recording(id, &r) || !r.path[0]) {
+        send_response(sockfd, "404 Not Found", "text/plain", "Recording not found");
         return;
     }
+    int fd = open(r.path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        send_response(sockfd, "404 Not Found", "text/plain", "Recording file missing");
+        return;
+    }
+    // An active recording is preallocated; only what was written counts
+    uint64_t size = strcmp(r.status, "recording") == 0 ? (uint64_t)r.bytes : (uint64_t)st.st_size;
 
-    // 2. Acquire Tuner for STREAM
-    Tuner *t = acquire_tuner(USER_STREAM);
-    int retries = 5;
-    while (!t && retries-- > 0) {
-        usleep(500000); // 500ms
-        t = acquire_tuner(USER_STREAM);
+    uint64_t start = 0, end = size;
+    int ranged = range && parse_range(range, &start, &end);
+    if (ranged) {
+        if (!end || end > size) end = size;
+        if (start >= size) {
+            char resp[160];
+            snprintf(resp, sizeof(resp),
+                "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                "Content-Range: bytes */%llu\r\n"
+                "Content-Length: 0\r\n"
+                "Connection: close\r\n"
+                "\r\n", (unsigned long long)size);
+            write(sockfd, resp, strlen(resp));
+            close(fd);
+            return;
+        }
     }
-    
-    if (!t) {
-        send_response(sockfd, "503 Service Unavailable", "text/plain", "No tuners available");
+
+    char headers[512];
+    int len = snprintf(headers, sizeof(headers),
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: video/mp2t\r\n"
+        "Content-Length: %llu\r\n"
+        "Accept-Ranges: bytes\r\n",
+        ranged ? "206 Partial Content" : "200 OK", (unsigned long long)(end - start));
+    if (ranged) {
+        len += snprintf(headers + len, sizeof(headers) - len, "Content-Range: bytes %llu-%llu/%llu\r\n",
+                        (unsigned long long)start, (unsigned long long)end - 1, (unsigned long long)size);
+    }
+    snprintf(headers + len, sizeof(headers) - len,
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n"
+        "\r\n");
+    write(sockfd, headers, strlen(headers));
+
+    off_t off = start;
+    while ((uint64_t)off < end) {
+        size_t chunk = end - off > (1 << 30) ? (1 << 30) : (size_t)(end - off);
+        ssize_t n = sendfile(sockfd, fd, &off, chunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+    }
+    close(fd);
+}
+
+void handle_stream(int sockfd, const char *channel, const char *query, const char *range, StreamTrace *tr) {
+    snprintf(tr->channel, sizeof(tr->channel), "%s", channel);
+    peer_name(sockfd, tr->client, sizeof(tr->client));
+
+    // 1. Validate Channel (copied out so a reload mid-stream cannot affect us)
+    ChannelTable *lineup = channels_acquire();
+    Channel *found = find_channel_by_number(lineup, channel);
+    if (!found) {
+        channels_release(lineup);
+        send_response(sockfd, "404 Not Found", "text/plain", "Channel not found");
+        trace_finish(tr, "404");
         return;
     }
+    Channel chan = *found;
+    Channel *c = &chan;
+    channels_release(lineup);
 
-    // 3. Setup Pipes and Fork
-    int pipefd[2];
-    if (pipe(pipefd) == -1) {
-        perror("pipe");
-        send_response(sockfd, "500 Internal Server Error", "text/plain", "Pipe creation failed");
-        release_tuner(t);
+    // 2. Attach to the mux capture (warm, or acquire a tuner and spawn zap)
+    CaptureError err;
+    CaptureViewer *v = capture_open(c, tr, &err);
+    if (!v) {
+        if (err == CAPTURE_NO_TUNER) {
+            send_response(sockfd, "503 Service Unavailable", "text/plain", "No tuners available");
+            trace_finish(tr, "503");
+        } else {
+            send_response(sockfd, "500 Internal Server Error", "text/plain", "Tuner process failed to start");
+            trace_finish(tr, "spawn failed");
+        }
         return;
     }
 
-    // Fork for zap
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child: exec dvbv5-zap
-        close(pipefd[0]);
-        dup2(pipefd[1], STDOUT_FILENO);
-        close(pipefd[1]);
-        
-        char adapter_id[8];
-        snprintf(adapter_id, sizeof(adapter_id), "%d", t->id);
-        
-        LOG_DEBUG("HTTP", "Executing: dvbv5-zap -c %s -P -a %s -o - \"%s\"", channels_conf_path, adapter_id, c->number);
+    // 3. Timeshift: ?offset=<seconds behind live>, or with ?mux=1 a byte
+    // Range of the capture. The offsets address the whole mux, so they mean
+    // nothing against a filtered body: there Range is ignored, as is
+    // "bytes=0-", which players send for any stream.
+    char mux_buf[8];
+    int whole_mux = query && find_query_param(query, "mux", mux_buf, sizeof(mux_buf)) && atoi(mux_buf);
+    char offset_buf[16];
+    uint64_t range_start = 0, range_end = 0;
+    int ranged = 0;
+    if (timeshift_minutes > 0 && query && find_query_param(query, "offset", offset_buf, sizeof(offset_buf))) {
+        capture_seek_time(v, atof(offset_buf));
+    }
+    if (timeshift_minutes > 0 && whole_mux && range && parse_range(range, &range_start, &range_end) && range_start > 0) {
+        uint64_t first, last;
+        capture_window(v, &first, &last);
+        if (!capture_seek_range(v, range_start, range_end ? range_end : last)) {
+            char resp[256];
+            snprintf(resp, sizeof(resp),
+                "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                "Content-Range: bytes */%llu\r\n"
+                "Content-Length: 0\r\n"
+                "Connection: close\r\n"
+                "\r\n", (unsigned long long)last);
+            write(sockfd, resp, strlen(resp));
+            capture_close(v);
+            trace_finish(tr, "416");
+            return;
+        }
+        ranged = 1;
+    }
 
-        execlp("dvbv5-zap", "dvbv5-zap", "-c", channels_conf_path, "-P", "-a", adapter_id, "-o", "-", c->number, NULL);
-        perror("exec zap failed");
-        exit(1);
-    } else if (pid > 0) {
-        // Parent
-        t->zap_pid = pid;
-        close(pipefd[1]); // Close write end
-        
-        // 4. Send Headers
-        const char *headers = 
+    // 4. Only the channel's program, unless the client asks for the mux;
+    // socket batching per ?profile=, or PCR pacing with ?pace=1
+    SptsFilter *spts = whole_mux ? NULL : spts_open(c->sid);
+    char pace_buf[8];
+    PaceSession *pace = NULL;
+    if (query && find_query_param(query, "pace", pace_buf, sizeof(pace_buf)) && atoi(pace_buf)) {
+        pace = pace_open(sockfd);
+    }
+    // A paced stream only reads into the StreamOut buffer; the pacer sends,
+    // and wants no Nagle delay on its small, evenly spaced writes
+    char profile_buf[16];
+    StreamOut out;
+    if (!stream_out_open(&out, sockfd, pace ? STREAM_PROFILE_LATENCY : stream_profile_parse(
+            query && find_query_param(query, "profile", profile_buf, sizeof(profile_buf)) ? profile_buf : NULL))) {
+        send_response(sockfd, "500 Internal Server Error", "text/plain", "Out of memory");
+        if (pace) pace_close(pace);
+        spts_close(spts);
+        capture_close(v);
+        trace_finish(tr, "500");
+        return;
+    }
+
+    // 5. Send Headers
+    char headers[512];
+    if (ranged) {
+        // The range as served: rounded to whole packets, clamped to live
+        snprintf(headers, sizeof(headers),
+            "HTTP/1.1 206 Partial Content\r\n"
+            "Content-Type: video/mp2t\r\n"
+            "Content-Range: bytes %llu-%llu/*\r\n"
+            "Content-Length: %llu\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Connection: close\r\n"
+            "\r\n", (unsigned long long)v->pos, (unsigned long long)v->limit - 1,
+            (unsigned long long)(v->limit - v->pos));
+    } else if (timeshift_minutes > 0) {
+        uint64_t first, last;
+        capture_window(v, &first, &last);
+        snprintf(headers, sizeof(headers),
             "HTTP/1.1 200 OK\r\n"
             "Content-Type: video/mp2t\r\n"
+            "%s"
+            "X-Timeshift-Window: %llu-%llu\r\n"
             "Access-Control-Allow-Origin: *\r\n"
             "Connection: keep-alive\r\n"
-            "\r\n";
-        write(sockfd, headers, strlen(headers));
-        
-        // Loop: Read from pipe, Write to socket
-        char buffer[4096];
-        ssize_t n;
-        while ((n = read(pipefd[0], buffer, sizeof(buffer))) > 0) {
-            ssize_t sent = write(sockfd, buffer, n);
-            if (sent < 0) {
-                // Client disconnected
-                break;
+            "\r\n", whole_mux ? "Accept-Ranges: bytes\r\n" : "",
+            (unsigned long long)first, (unsigned long long)last);
+    } else {
+        snprintf(headers, sizeof(headers),
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: video/mp2t\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Connection: keep-alive\r\n"
+            "\r\n");
+    }
+    write(sockfd, headers, strlen(headers));
+    
+    // 6. Loop: Read from capture, Write to socket
+    MetricsStream *ms = metrics_stream_open(c->number);
+    TsHealth *health = ts_health_open(c->number, v->tuner_id, v->tuner_index, tr->client, ms);
+    uint64_t paced_bytes = 0;
+    for (;;) {
+        // Read straight into the output buffer, always whole packets
+        size_t room;
+        unsigned char *buffer = stream_out_space(&out, &room);
+        ssize_t n = capture_read(v, buffer, room);
+        if (n <= 0) break;
+        trace_mark(tr, TRACE_FIRST_BYTE);
+        if (spts) {
+            size_t kept = spts_filter(spts, buffer, n);
+            metrics_add(METRIC_STREAM_FILTERED_BYTES, n - kept);
+            n = kept;
+        }
+        ts_health_feed(health, buffer, n);
+        ssize_t sent;
+        if (pace) {
+            // The pacer sends on its own schedule; report what it has sent since
+            uint64_t total = pace_sent_bytes(pace);
+            sent = pace_push(pace, buffer, n) ? (ssize_t)(total - paced_bytes) : -1;
+            paced_bytes = total;
+        } else {
+            sent = stream_out_commit(&out, n);
+        }
+        if (sent < 0) {
+            // Client disconnected
+            break;
+        }
+        if (sent > 0) {
+            trace_mark(tr, TRACE_FIRST_SENT);
+            metrics_stream_relayed(ms, sent);
+        }
+
+        // Startup is over once the player has everything it needs
+        if (!tr->outcome[0] && health) {
+            if (health->pat_seen) trace_mark(tr, TRACE_FIRST_PAT);
+            if (health->pmt_seen) {
+                trace_mark(tr, TRACE_FIRST_PMT);
+                if (tr->t[TRACE_FIRST_SENT]) trace_finish(tr, "ok");
             }
         }
-        
-        // Cleanup - release_tuner handles process termination
-        close(pipefd[0]);
-        release_tuner(t);
-    } else {
-        perror("fork");
-        close(pipefd[0]);
-        close(pipefd[1]);
-        send_response(sockfd, "500 Internal Server Error", "text/plain", "Fork failed");
-        release_tuner(t);
     }
+    trace_finish(tr, tr->t[TRACE_FIRST_BYTE] ? "ok" : "no data");
+    if (pace) metrics_stream_relayed(ms, pace_close(pace) - paced_bytes);
+    stream_out_close(&out);
+    ts_health_close(health);
+    metrics_stream_close(ms);
+    spts_close(spts);
+    
+    // The tuner lingers on the mux for a while (capture.h)
+    capture_close(v);
 }
 
+typedef struct {
+    int sockfd;
+    uint64_t accepted_ns;
+} ClientConn;
+
 void *client_thread(void *arg) {
-    int sockfd = *(int*)arg;
-    free(arg);
+    ClientConn *conn = arg;
+    int sockfd = conn->sockfd;
+    uint64_t accepted_ns = conn->accepted_ns;
+    free(conn);
     
     // Set read timeout to prevent indefinite blocking
     struct timeval tv;
@@ -303,30 +651,79 @@ void *client_thread(void *arg) {
     }
     
     LOG_DEBUG("HTTP", "%s %s", method, path);
+    uint64_t t0 = accepted_ns;
+    MetricHistogram route = METRIC_HTTP_OTHER;
 
     // Strip query string
     char *query = strchr(path, '?');
-    if (query) *query = '\0';
+    if (query) *query++ = '\0';
+
+    // Guide language (?lang=spa); ignored unless it looks like ISO 639
+    char lang_buf[8];
+    const char *lang = NULL;
+    if (query && find_query_param(query, "lang", lang_buf, sizeof(lang_buf)) && mls_valid_lang(lang_buf)) {
+        lang = lang_buf;
+    }
 
     // Find Host header
     char *host = find_header(buffer, "Host");
 
     if (strcmp(method, "GET") == 0) {
         if (strcmp(path, "/playlist.m3u") == 0) {
-            handle_m3u(sockfd, host);
+            route = METRIC_HTTP_PLAYLIST;
+            handle_m3u(sockfd, host, 0);
+        } else if (strcmp(path, "/multicast.m3u") == 0 && mcast_mode != MCAST_OFF) {
+            route = METRIC_HTTP_PLAYLIST;
+            handle_m3u(sockfd, host, 1);
+        } else if (strncmp(path, "/multicast/", 11) == 0) {
+            handle_multicast(sockfd, path + 11);
         } else if (strcmp(path, "/xmltv.xml") == 0) {
-            handle_xmltv(sockfd);
+            route = METRIC_HTTP_XMLTV;
+            handle_xmltv(sockfd, lang);
         } else if (strcmp(path, "/xmltv.json") == 0) {
-            handle_json(sockfd);
+            route = METRIC_HTTP_JSON;
+            handle_json(sockfd, lang);
+        } else if (strcmp(path, "/metrics") == 0) {
+            route = METRIC_HTTP_METRICS;
+            handle_metrics(sockfd);
+        } else if (strcmp(path, "/status") == 0) {
+            route = METRIC_HTTP_STATUS;
+            handle_status(sockfd);
+        } else if (strcmp(path, "/startup") == 0) {
+            route = METRIC_HTTP_STARTUP;
+            handle_startup(sockfd);
+        } else if (strcmp(path, "/recordings") == 0) {
+            handle_recordings(sockfd);
+        } else if (strncmp(path, "/recordings/", 12) == 0) {
+            // Lasts as long as the download; not a latency sample
+            route = METRIC_HISTOGRAM_COUNT;
+            char *range = find_header(buffer, "Range");
+            handle_recording_file(sockfd, atoi(path + 12), range);
+            free(range);
         } else if (strncmp(path, "/stream/", 8) == 0) {
+            // Lasts as long as the viewer watches; not a latency sample
+            route = METRIC_HISTOGRAM_COUNT;
+            StreamTrace trace;
+            trace_begin(&trace, accepted_ns);
+            trace_mark(&trace, TRACE_PARSED);
             char *chan = path + 8;
-            handle_stream(sockfd, chan);
+            char *range = find_header(buffer, "Range");
+            handle_stream(sockfd, chan, query, range, &trace);
+            free(range);
         } else {
             send_response(sockfd, "404 Not Found", "text/plain", "Not Found");
         }
+    } else if (strcmp(method, "POST") == 0 && strcmp(path, "/reload") == 0) {
+        route = METRIC_HTTP_RELOAD;
+        handle_reload(sockfd);
+    } else if (strcmp(method, "POST") == 0 && strcmp(path, "/recordings") == 0) {
+        handle_recording_schedule(sockfd, query);
+    } else if (strcmp(method, "DELETE") == 0 && strncmp(path, "/recordings/", 12) == 0) {
+        handle_recording_delete(sockfd, atoi(path + 12));
     } else {
         send_response(sockfd, "405 Method Not Allowed", "text/plain", "Method Not Allowed");
     }
+    if (route != METRIC_HISTOGRAM_COUNT) metrics_observe(route, metrics_now_ns() - t0);
 
     if (host) free(host);
     close(sockfd);
@@ -371,12 +768,13 @@ void start_http_server(int port) {
         }
 
         pthread_t t;
-        int *arg = malloc(sizeof(int));
+        ClientConn *arg = malloc(sizeof(ClientConn));
         if (!arg) {
             close(newsockfd);
             continue;
         }
-        *arg = newsockfd;
+        arg->sockfd = newsockfd;
+        arg->accepted_ns = metrics_now_ns();
         if (pthread_create(&t, NULL, client_thread, arg) != 0) {
             perror("ERROR creating thread");
             close(newsockfd);
@@ -1,129 +1,78 @@
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/stat.h>
-#include <pthread.h>
 #include "huffman.h"
-#include "log.h"
 
-#define HUFFMAN_MAGIC "ATHU"
-#define HUFFMAN_VERSION 1
-
-typedef struct {
-    char magic[4];
-    uint32_t version;
-    uint32_t title_offset;
-    uint32_t desc_offset;
-    uint32_t nodes_per_tree;
-} HuffmanHeader;
-
-static HuffmanNode *title_trees = NULL;
-static HuffmanNode *desc_trees = NULL;
-static int nodes_per_tree = 0;
-static int huffman_initialized = 0;
-static pthread_mutex_t huffman_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-int huffman_init() {
-    int fd = open("huffman.bin", O_RDONLY);
-    if (fd < 0) {
-        // Not a fatal error, but decoding won't work
-        LOG_DEBUG("HUFFMAN", "huffman.bin not found, Huffman decoding disabled");
-        return 0;
-    }
-
-    struct stat st;
-    fstat(fd, &st);
-
-    HuffmanHeader header;
-    if (read(fd, &header, sizeof(header)) != sizeof(header)) {
-        close(fd);
-        return 0;
-    }
-
-    if (memcmp(header.magic, HUFFMAN_MAGIC, 4) != 0 || header.version != HUFFMAN_VERSION) {
-        LOG_WARN("HUFFMAN", "Invalid huffman.bin format or version");
-        close(fd);
-        return 0;
-    }
-
-    nodes_per_tree = header.nodes_per_tree;
-    size_t tree_size = 128 * nodes_per_tree * sizeof(HuffmanNode);
-
-    title_trees = malloc(tree_size);
-    desc_trees = malloc(tree_size);
-
-    if (!title_trees || !desc_trees) {
-        perror("malloc");
-        close(fd);
-        return 0;
-    }
-
-    lseek(fd, header.title_offset, SEEK_SET);
-    read(fd, title_trees, tree_size);
-
-    lseek(fd, header.desc_offset, SEEK_SET);
-    read(fd, desc_trees, tree_size);
-
-    close(fd);
-    LOG_DEBUG("HUFFMAN", "Tables loaded (%d nodes per tree)", nodes_per_tree);
-    return 1;
-}
-
-void huffman_cleanup() {
-    if (title_trees) free(title_trees);
-    if (desc_trees) free(desc_trees);
-    title_trees = NULL;
-    desc_trees = NULL;
-}
-
-static int get_bit(const uint8_t *src, int bit_pos) {
-    return (src[bit_pos / 8] >> (7 - (bit_pos % 8))) & 1;
+int huffman_available() {
+    return huffman_tables_valid;
 }
 
 int huffman_decode(int compr_type, const uint8_t *src, int src_len, char *dest, int dest_len) {
-    // Lazy initialization: load tables on first decode attempt
-    pthread_mutex_lock(&huffman_mutex);
-    if (!huffman_initialized) {
-        huffman_init();
-        huffman_initialized = 1;
-    }
-    pthread_mutex_unlock(&huffman_mutex);
+    if (dest_len < 1) return -1;
+    dest[0] = '\0';
+    if (!huffman_tables_valid) return -1;
 
-    HuffmanNode *base_trees = (compr_type == 1) ? title_trees : desc_trees;
-    if (!base_trees) return 0;
+    const HuffmanNode *base_trees = (compr_type == 1) ? huffman_title_trees : huffman_desc_trees;
+    const HuffmanLutEntry *base_lut = (compr_type == 1) ? huffman_title_lut : huffman_desc_lut;
+    const int nodes_per_tree = huffman_nodes_per_tree;
 
-    int bit_pos = 0;
-    int max_bits = src_len * 8;
-    int dest_pos = (int)strlen(dest);
+    // Bit reader: acc holds nbits valid bits, MSB-aligned
+    uint64_t acc = 0;
+    int nbits = 0;
+    int byte_pos = 0;
+    int remaining = src_len * 8;   // Input bits not yet consumed
+
+    int dest_pos = 0;
     int prev_char = 0; // Standard says initial context is 0x00
 
-    while (bit_pos < max_bits && dest_pos < dest_len - 1) {
+    while (remaining > 0 && dest_pos < dest_len - 1) {
+        while (nbits <= 56 && byte_pos < src_len) {
+            acc |= (uint64_t)src[byte_pos++] << (56 - nbits);
+            nbits += 8;
+        }
+
         // Select tree based on previous character (1st-order conditional)
         // A/65 Annex C: Context is the previous 7-bit character
         int context = (prev_char & 0x7F);
-        HuffmanNode *tree = base_trees + (context * nodes_per_tree);
-        int node_idx = 0;
-
-        // Traverse tree
-        while (node_idx >= 0) {
-            if (bit_pos >= max_bits) break;
-            int bit = get_bit(src, bit_pos++);
-            node_idx = tree[node_idx].children[bit];
-        }
-
-        if (node_idx < 0) {
-            unsigned char c = (unsigned char)(-(node_idx + 1));
-            if (c == 0x00) break; // End of string
-            dest[dest_pos++] = c;
-            prev_char = c;
+        const HuffmanLutEntry *e = &base_lut[context * HUFFMAN_LUT_SIZE + (acc >> (64 - HUFFMAN_LUT_BITS))];
+
+        int symbol;
+        if (e->flags & HUFFMAN_LUT_LEAF) {
+            if (e->bits > remaining) break;   // Code runs past the input
+            symbol = e->value;
+            acc <<= e->bits;
+            nbits -= e->bits;
+            remaining -= e->bits;
+        } else if (e->flags & HUFFMAN_LUT_CONT) {
+            // Long code: finish the walk bit by bit from the interior node
+            if (remaining <= HUFFMAN_LUT_BITS) break;
+            const HuffmanNode *tree = base_trees + context * nodes_per_tree;
+            int node = e->value;
+            acc <<= HUFFMAN_LUT_BITS;
+            nbits -= HUFFMAN_LUT_BITS;
+            remaining -= HUFFMAN_LUT_BITS;
+            while (node >= 0 && node < nodes_per_tree && remaining > 0) {
+                if (nbits == 0) {
+                    if (byte_pos >= src_len) break;
+                    acc = (uint64_t)src[byte_pos++] << 56;
+                    nbits = 8;
+                }
+                node = tree[node].children[acc >> 63];
+                acc <<= 1;
+                nbits--;
+                remaining--;
+            }
+            if (node >= 0) break;  // Incomplete traversal
+            symbol = -(node + 1);
         } else {
-            // Incomplete traversal
             break;
         }
+
+        unsigned char c = (unsigned char)symbol;
+        if (c == 0x00) break; // End of string
+        dest[dest_pos++] = c;
+        prev_char = c;
     }
 
     dest[dest_pos] = '\0';
-    return 1;
+    return dest_pos;
 }
@@ -0,0 +1,64 @@
+/**
+ * @file json_buf.c
+ * @brief Growable buffer for building JSON responses
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "json_buf.h"
+
+int json_buf_init(JsonBuf *jb, size_t cap) {
+    jb->buf = malloc(cap);
+    jb->len = 0;
+    jb->cap = cap;
+    jb->failed = !jb->buf;
+    if (jb->buf) jb->buf[0] = '\0';
+    return !jb->failed;
+}
+
+void json_printf(JsonBuf *jb, const char *fmt, ...) {
+    if (jb->failed) return;
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(jb->buf + jb->len, jb->cap - jb->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            jb->failed = 1;
+            return;
+        }
+        if ((size_t)n < jb->cap - jb->len) {
+            jb->len += n;
+            return;
+        }
+        size_t cap = jb->cap * 2 + n;
+        char *tmp = realloc(jb->buf, cap);
+        if (!tmp) {
+            jb->failed = 1;
+            return;
+        }
+        jb->buf = tmp;
+        jb->cap = cap;
+    }
+}
+
+// Strings may come from request paths, so never trust them to be plain
+void json_string(JsonBuf *jb, const char *s) {
+    json_printf(jb, "\"");
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') json_printf(jb, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) json_printf(jb, "\\u%04x", (unsigned char)*s);
+        else json_printf(jb, "%c", *s);
+    }
+    json_printf(jb, "\"");
+}
+
+char *json_buf_finish(JsonBuf *jb) {
+    if (jb->failed) {
+        free(jb->buf);
+        jb->buf = NULL;
+        return NULL;
+    }
+    return jb->buf;
+}
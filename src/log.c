@@ -0,0 +1,419 @@
+/**
+ * @file log.c
+ * @brief Asynchronous logger: MPSC ring, background writer, rate limiting
+ *
+ * Producers claim a slot in a bounded ring with one CAS (Vyukov-style
+ * per-slot sequence numbers), copy in the formatted message and publish
+ * it. The writer thread drains the ring, stamps records with a
+ * timestamp string that is rebuilt at most once per second, folds
+ * repeats of identical messages and writes whole batches to stderr with
+ * a single write().
+ *
+ * A call site (identified by its format string) that fires more than
+ * LOG_SITE_PER_SEC times a second is throttled before it reaches the
+ * ring, so one noisy loop cannot crowd out everything else.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include "log.h"
+
+#define LOG_RING_SLOTS 1024          /* Power of two */
+#define LOG_TAG_MAX 16
+#define LOG_RECENT 64                /* Distinct messages tracked for rate limiting */
+#define LOG_OUT_BYTES 65536          /* Writer batch buffer */
+#define LOG_SITES 256                /* Call-site throttle table */
+#define LOG_SITE_PER_SEC 100         /* Records per call site per second */
+
+typedef struct {
+    atomic_size_t seq;
+    LogLevel level;
+    time_t when;
+    char tag[LOG_TAG_MAX];
+    char msg[LOG_MSG_MAX];
+} LogRecord;
+
+/* Rate limiting state for one distinct message (writer thread only) */
+typedef struct {
+    uint64_t hash;
+    time_t window_start;
+    int count;                       /* Seen in this window */
+    int suppressed;                  /* Not written in this window */
+    LogLevel level;
+    char tag[LOG_TAG_MAX];
+    char msg[LOG_MSG_MAX];
+} LogRecent;
+
+/* Per call site record count for the current second (approximate:
+   colliding sites just reset each other) */
+typedef struct {
+    _Atomic(const char *) fmt;
+    atomic_long second;
+    atomic_int count;
+} LogSite;
+
+static LogRecord ring[LOG_RING_SLOTS];
+static LogSite sites[LOG_SITES];
+static atomic_ulong throttled;
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos;
+static atomic_ulong dropped;
+
+static atomic_int running = 0;
+static atomic_int sleeping = 0;
+static pthread_t writer;
+static pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t sync_mutex = PTHREAD_MUTEX_INITIALIZER;   /* Synchronous mode output */
+
+static LogFormat format = LOG_FORMAT_PLAIN;
+static int use_color = 0;
+
+static LogRecent recent[LOG_RECENT];
+
+static const char *level_names[] = { "ERROR", "WARN ", "INFO ", "DEBUG" };
+static const char *level_json[] = { "error", "warn", "info", "debug" };
+static const char *level_colors[] = { COLOR_RED, COLOR_YELLOW, COLOR_GREEN, COLOR_DIM };
+
+// Output buffer; owned by the writer thread, or by sync_mutex holders
+typedef struct {
+    char buf[LOG_OUT_BYTES];
+    size_t len;
+    time_t stamp_time;
+    char stamp[40];
+} LogOutput;
+
+static LogOutput async_out = { .stamp_time = -1 };
+static LogOutput sync_out = { .stamp_time = -1 };
+
+static pthread_once_t color_once = PTHREAD_ONCE_INIT;
+
+static void detect_color(void) {
+    use_color = format == LOG_FORMAT_PLAIN && isatty(STDERR_FILENO);
+}
+
+void log_set_format(LogFormat f) {
+    format = f;
+    detect_color();
+}
+
+int log_parse_format(const char *name, LogFormat *out) {
+    if (strcmp(name, "plain") == 0) *out = LOG_FORMAT_PLAIN;
+    else if (strcmp(name, "json") == 0) *out = LOG_FORMAT_JSON;
+    else return 0;
+    return 1;
+}
+
+static void out_flush(LogOutput *o) {
+    size_t off = 0;
+    while (off < o->len) {
+        ssize_t n = write(STDERR_FILENO, o->buf + off, o->len - off);
+        if (n <= 0) break;
+        off += n;
+    }
+    o->len = 0;
+}
+
+static void out_append(LogOutput *o, const char *s, size_t len) {
+    if (o->len + len > sizeof(o->buf)) out_flush(o);
+    if (len > sizeof(o->buf)) len = sizeof(o->buf);
+    memcpy(o->buf + o->len, s, len);
+    o->len += len;
+}
+
+static void out_json_string(LogOutput *o, const char *s) {
+    char esc[8];
+    out_append(o, "\"", 1);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            esc[0] = '\\';
+            esc[1] = c;
+            out_append(o, esc, 2);
+        } else if (c < 0x20) {
+            int n = snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out_append(o, esc, n);
+        } else {
+            out_append(o, (const char *)&c, 1);
+        }
+    }
+    out_append(o, "\"", 1);
+}
+
+// localtime_r() and strftime() at most once per second of log time
+static const char *out_stamp(LogOutput *o, time_t when) {
+    if (when != o->stamp_time) {
+        struct tm tm;
+        localtime_r(&when, &tm);
+        strftime(o->stamp, sizeof(o->stamp),
+                 format == LOG_FORMAT_JSON ? "%Y-%m-%dT%H:%M:%S%z" : "%H:%M:%S", &tm);
+        o->stamp_time = when;
+    }
+    return o->stamp;
+}
+
+static void out_record(LogOutput *o, LogLevel level, time_t when, const char *tag, const char *msg) {
+    char head[128];
+    int n;
+    const char *stamp = out_stamp(o, when);
+
+    if (format == LOG_FORMAT_JSON) {
+        n = snprintf(head, sizeof(head), "{\"time\":\"%s\",\"level\":\"%s\",\"tag\":", stamp, level_json[level]);
+        out_append(o, head, n);
+        out_json_string(o, tag);
+        out_append(o, ",\"msg\":", 7);
+        out_json_string(o, msg);
+        out_append(o, "}\n", 2);
+        return;
+    }
+
+    if (use_color) {
+        const char *color = level_colors[level];
+        n = snprintf(head, sizeof(head), "%s[%s]%s %s%-5s%s %s" COLOR_CYAN "%s" COLOR_RESET " ",
+                     COLOR_DIM, stamp, COLOR_RESET, color, level_names[level], COLOR_RESET, color, tag);
+    } else {
+        n = snprintf(head, sizeof(head), "[%s] %-5s %s ", stamp, level_names[level], tag);
+    }
+    if (n >= (int)sizeof(head)) n = sizeof(head) - 1;
+    out_append(o, head, n);
+    out_append(o, msg, strlen(msg));
+    out_append(o, "\n", 1);
+}
+
+static int site_allow(const char *fmt, time_t now) {
+    LogSite *s = &sites[((uintptr_t)fmt >> 3) % LOG_SITES];
+    if (atomic_load_explicit(&s->fmt, memory_order_relaxed) != fmt ||
+        atomic_load_explicit(&s->second, memory_order_relaxed) != now) {
+        atomic_store_explicit(&s->fmt, fmt, memory_order_relaxed);
+        atomic_store_explicit(&s->second, now, memory_order_relaxed);
+        atomic_store_explicit(&s->count, 0, memory_order_relaxed);
+    }
+    return atomic_fetch_add_explicit(&s->count, 1, memory_order_relaxed) < LOG_SITE_PER_SEC;
+}
+
+void log_write(LogLevel level, const char *tag, const char *fmt, ...) {
+    if (level < LOG_ERROR || level > LOG_DEBUG) level = LOG_INFO;
+    va_list ap;
+
+    if (!atomic_load_explicit(&running, memory_order_acquire)) {
+        char msg[LOG_MSG_MAX];
+        va_start(ap, fmt);
+        vsnprintf(msg, sizeof(msg), fmt, ap);
+        va_end(ap);
+        pthread_once(&color_once, detect_color);
+        pthread_mutex_lock(&sync_mutex);
+        out_record(&sync_out, level, time(NULL), tag, msg);
+        out_flush(&sync_out);
+        pthread_mutex_unlock(&sync_mutex);
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (!site_allow(fmt, now)) {
+        atomic_fetch_add_explicit(&throttled, 1, memory_order_relaxed);
+        return;
+    }
+
+    // Claim a slot: its sequence equals our position when it is free
+    LogRecord *r;
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        r = &ring[pos & (LOG_RING_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            // Full: the writer is behind, so losing this line beats waiting
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    r->level = level;
+    r->when = now;
+    snprintf(r->tag, sizeof(r->tag), "%s", tag);
+    va_start(ap, fmt);
+    vsnprintf(r->msg, sizeof(r->msg), fmt, ap);
+    va_end(ap);
+    atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+
+    // Pairs with the sleeping store in the writer: either we see it
+    // asleep or it sees this record before waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&wake_mutex);
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&wake_mutex);
+    }
+}
+
+static uint64_t hash_record(LogLevel level, const char *tag, const char *msg) {
+    uint64_t h = 0xCBF29CE484222325ULL ^ (uint64_t)level;
+    for (const char *p = tag; *p; p++) h = (h ^ (unsigned char)*p) * 0x100000001B3ULL;
+    h = (h ^ 0xFF) * 0x100000001B3ULL;
+    for (const char *p = msg; *p; p++) h = (h ^ (unsigned char)*p) * 0x100000001B3ULL;
+    return h;
+}
+
+static void emit_summary(LogRecent *e, time_t now) {
+    if (e->suppressed == 0) return;
+    char msg[LOG_MSG_MAX + 64];
+    snprintf(msg, sizeof(msg), "%.*s (repeated %d more times in %lds)", LOG_MSG_MAX - 1, e->msg,
+             e->suppressed, (long)(now - e->window_start));
+    out_record(&async_out, e->level, now, e->tag, msg);
+    e->suppressed = 0;
+}
+
+// Returns 1 if the record should be written, 0 if it was folded
+static int rate_limit(const LogRecord *r) {
+    uint64_t h = hash_record(r->level, r->tag, r->msg);
+    LogRecent *victim = NULL;
+    for (int i = 0; i < LOG_RECENT; i++) {
+        LogRecent *e = &recent[i];
+        if (e->count > 0 && e->hash == h && e->level == r->level &&
+            strcmp(e->tag, r->tag) == 0 && strcmp(e->msg, r->msg) == 0) {
+            if (r->when - e->window_start >= LOG_RATE_WINDOW) {
+                emit_summary(e, r->when);
+                e->window_start = r->when;
+                e->count = 0;
+            }
+            if (++e->count > LOG_RATE_BURST) {
+                e->suppressed++;
+                return 0;
+            }
+            return 1;
+        }
+        if (!victim || (victim->count > 0 && (e->count == 0 || e->window_start < victim->window_start))) {
+            victim = e;
+        }
+    }
+
+    // New message: reuse an empty entry or the oldest window
+    emit_summary(victim, r->when);
+    victim->hash = h;
+    victim->level = r->level;
+    victim->window_start = r->when;
+    victim->count = 1;
+    victim->suppressed = 0;
+    snprintf(victim->tag, sizeof(victim->tag), "%s", r->tag);
+    snprintf(victim->msg, sizeof(victim->msg), "%s", r->msg);
+    return 1;
+}
+
+// Report repeats of messages that have gone quiet
+static void sweep_recent(time_t now) {
+    for (int i = 0; i < LOG_RECENT; i++) {
+        LogRecent *e = &recent[i];
+        if (e->count > 0 && now - e->window_start >= LOG_RATE_WINDOW) {
+            emit_summary(e, now);
+            e->count = 0;
+        }
+    }
+}
+
+// Write every published record; returns the number taken
+static int drain(void) {
+    int n = 0;
+    for (;;) {
+        LogRecord *r = &ring[dequeue_pos & (LOG_RING_SLOTS - 1)];
+        if (atomic_load_explicit(&r->seq, memory_order_acquire) != dequeue_pos + 1) break;
+        if (rate_limit(r)) out_record(&async_out, r->level, r->when, r->tag, r->msg);
+        atomic_store_explicit(&r->seq, dequeue_pos + LOG_RING_SLOTS, memory_order_release);
+        dequeue_pos++;
+        n++;
+    }
+
+    char msg[96];
+    unsigned long lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (lost > 0) {
+        snprintf(msg, sizeof(msg), "%lu log messages dropped (queue full)", lost);
+        out_record(&async_out, LOG_WARN, time(NULL), "LOG", msg);
+    }
+    unsigned long busy = atomic_exchange_explicit(&throttled, 0, memory_order_relaxed);
+    if (busy > 0) {
+        snprintf(msg, sizeof(msg), "%lu log messages throttled (over %d/s from one call site)", busy, LOG_SITE_PER_SEC);
+        out_record(&async_out, LOG_WARN, time(NULL), "LOG", msg);
+    }
+    if (async_out.len > 0) out_flush(&async_out);
+    return n;
+}
+
+static int ring_empty(void) {
+    LogRecord *r = &ring[dequeue_pos & (LOG_RING_SLOTS - 1)];
+    return atomic_load_explicit(&r->seq, memory_order_acquire) != dequeue_pos + 1;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        drain();
+        sweep_recent(time(NULL));
+        if (async_out.len > 0) out_flush(&async_out);
+        if (!atomic_load(&running) && ring_empty()) break;
+
+        // Sleep until a producer signals; wake once a second regardless
+        // so repeat summaries go out even when nothing new arrives
+        pthread_mutex_lock(&wake_mutex);
+        atomic_store(&sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (ring_empty() && atomic_load(&running)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            pthread_cond_timedwait(&wake_cond, &wake_mutex, &deadline);
+        }
+        atomic_store(&sleeping, 0);
+        pthread_mutex_unlock(&wake_mutex);
+    }
+
+    // Final summaries so suppressed counts are not lost at shutdown
+    time_t now = time(NULL);
+    for (int i = 0; i < LOG_RECENT; i++) emit_summary(&recent[i], now);
+    out_flush(&async_out);
+    return NULL;
+}
+
+static void log_atexit(void) {
+    log_stop();
+}
+
+void log_start() {
+    static int atexit_registered = 0;
+    if (atomic_load(&running)) return;
+
+    for (size_t i = 0; i < LOG_RING_SLOTS; i++) atomic_init(&ring[i].seq, i);
+    atomic_store(&enqueue_pos, 0);
+    dequeue_pos = 0;
+    detect_color();
+
+    atomic_store_explicit(&running, 1, memory_order_release);
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+        atomic_store(&running, 0);
+        LOG_WARN("LOG", "Failed to start log writer; logging synchronously");
+        return;
+    }
+    if (!atexit_registered) {
+        atexit(log_atexit);
+        atexit_registered = 1;
+    }
+}
+
+void log_stop() {
+    if (!atomic_exchange(&running, 0)) return;
+    pthread_mutex_lock(&wake_mutex);
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_mutex);
+    pthread_join(writer, NULL);
+}
@@ -14,12 +14,19 @@
  * 3. Load channel configuration
  * 4. Discover available tuners
  * 5. Start EPG collection (waits for first scan if DB empty)
- * 6. Start mDNS advertisement
- * 7. Start HTTP server (blocks)
+ * 6. Start the recording scheduler and multicast publisher
+ * 7. Start mDNS advertisement
+ * 8. Start HTTP server (blocks)
  * 
  * Command line options:
  *   -p <port>  HTTP server port (default: 18392)
  *   -v         Enable verbose debug logging
+ *   -g <n>     EPG guide depth in 3-hour EIT blocks (1-128, default: 8)
+ *   -L <fmt>   Log format: plain or json (default: plain)
+ *   -w <secs>  Keep a tuner on its mux this long after the last viewer (default: 30)
+ *   -T <mins>  Timeshift window per tuned mux, spilled to disk (default: off)
+ *   -J <ms>    Jitter buffer of paced (?pace=1) streams (default: 200)
+ *   -M <fmt>   Publish channels to multicast groups on demand: rtp or udp (default: off)
  */
 
 #include <stdio.h>
@@ -37,13 +44,25 @@
 #include "epg.h"
 #include "mdns.h"
 #include "scanner.h"
+#include "capture.h"
+#include "timeshift.h"
+#include "dvr.h"
+#include "pacer.h"
+#include "mcast.h"
+#include "mss_cache.h"
 
 // Global verbose flag
 int g_verbose = 0;
 
 void print_usage(const char *progname) {
-    printf("Usage: %s [-p port] [-v]\n", progname);
+    printf("Usage: %s [-p port] [-g depth] [-w secs] [-T mins] [-J ms] [-M rtp|udp] [-L plain|json] [-v]\n", progname);
     printf("  -p port           Port to listen on (default: %d)\n", DEFAULT_PORT);
+    printf("  -g depth          EPG depth in 3-hour EIT blocks, 1-%d (default: %d)\n", EPG_MAX_GUIDE_DEPTH, EPG_GUIDE_DEPTH);
+    printf("  -w secs           Keep tuners on their mux after the last viewer leaves (default: %d, 0 = off)\n", STREAM_LINGER_SECS);
+    printf("  -T minutes        Timeshift window per tuned mux, spilled to %s (default: off)\n", TIMESHIFT_DIR);
+    printf("  -J ms             Jitter buffer of paced (?pace=1) streams (default: %d)\n", PACE_JITTER_MS);
+    printf("  -M rtp|udp        Publish channels to %s/16 port %d on demand (default: off)\n", MCAST_GROUP_BASE, MCAST_PORT);
+    printf("  -L format         Log format: plain or json (default: plain; no colors unless on a terminal)\n");
     printf("  -v                Enable verbose/debug logging\n");
 }
 
@@ -63,11 +82,43 @@ int main(int argc, char *argv[]) {
     int opt;
 
     // Parse command line arguments
-    while ((opt = getopt(argc, argv, "p:vh")) != -1) {
+    LogFormat log_format = LOG_FORMAT_PLAIN;
+    while ((opt = getopt(argc, argv, "p:g:w:T:J:M:L:vh")) != -1) {
         switch (opt) {
             case 'p':
                 port = atoi(optarg);
                 break;
+            case 'g':
+                epg_guide_depth = atoi(optarg);
+                if (epg_guide_depth < 1) epg_guide_depth = 1;
+                if (epg_guide_depth > EPG_MAX_GUIDE_DEPTH) epg_guide_depth = EPG_MAX_GUIDE_DEPTH;
+                break;
+            case 'w':
+                stream_linger_secs = atoi(optarg);
+                if (stream_linger_secs < 0) stream_linger_secs = 0;
+                break;
+            case 'T':
+                timeshift_minutes = atoi(optarg);
+                if (timeshift_minutes < 0) timeshift_minutes = 0;
+                break;
+            case 'J':
+                // The pace queue holds a few seconds; keep well inside it
+                pace_jitter_ms = atoi(optarg);
+                if (pace_jitter_ms < 0) pace_jitter_ms = 0;
+                if (pace_jitter_ms > 2000) pace_jitter_ms = 2000;
+                break;
+            case 'M':
+                if (!mcast_parse_mode(optarg, &mcast_mode)) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'L':
+                if (!log_parse_format(optarg, &log_format)) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
             case 'v':
                 g_verbose = 1;
                 break;
@@ -83,6 +134,7 @@ int main(int argc, char *argv[]) {
     // Ignore SIGPIPE to prevent crash on client disconnect
     signal(SIGPIPE, SIG_IGN);
 
+    log_set_format(log_format);
     print_banner(port);
     LOG_DEBUG("MAIN", "Channels config: %s", channels_conf_path);
 
@@ -91,6 +143,9 @@ int main(int argc, char *argv[]) {
         return 0; // Scanner finished and user should verify/restart
     }
 
+    // Interactive wizard is done; from here on logging is asynchronous
+    log_start();
+
     // 1. Initialize DB
     if (!db_init()) {
         LOG_ERROR("DB", "Failed to initialize database");
@@ -105,6 +160,7 @@ int main(int argc, char *argv[]) {
     } else {
         LOG_INFO("CHANNELS", "Loaded %d channels", count);
     }
+    channels_watch_start();
 
     // 3. Discover Tuners
     discover_tuners();
@@ -121,15 +177,20 @@ int main(int argc, char *argv[]) {
         wait_for_first_epg_scan();
     }
 
-    // 5. Start Discovery (mDNS & SSDP)
+    // 5. Start Recording Scheduler and Multicast Publisher
+    dvr_start();
+    mcast_start();
+
+    // 6. Start Discovery (mDNS & SSDP)
     mdns_init(port);
 
-    // 6. Start HTTP Server
+    // 7. Start HTTP Server
     LOG_INFO("HTTP", "Server listening on port %d", port);
     start_http_server(port);
 
     // Cleanup
     mdns_cleanup();
+    mss_cache_cleanup();
     db_close();
     return 0;
 }
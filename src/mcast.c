@@ -0,0 +1,457 @@
+/**
+ * @file mcast.c
+ * @brief RTP/UDP multicast publication of channels
+ *
+ * One publisher thread per published channel, plus one IGMP listener.
+ * pub_mutex guards the publication list and each publication's expiry.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <ifaddrs.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "mcast.h"
+#include "config.h"
+#include "capture.h"
+#include "spts.h"
+#include "metrics.h"
+#include "log.h"
+
+#define TS_PACKET 188
+#define DATAGRAM_PAYLOAD (TS_PACKET * 7)
+/* Datagrams per sendmmsg() */
+#define MCAST_BATCH 32
+#define RTP_HEADER 12
+#define RTP_PT_MP2T 33
+
+#define IGMP_QUERY 0x11
+#define IGMP_V1_REPORT 0x12
+#define IGMP_V2_REPORT 0x16
+#define IGMP_V2_LEAVE 0x17
+#define IGMP_V3_REPORT 0x22
+#define IGMP_V3_REPORTS_GROUP "224.0.0.22"
+#define IGMP_ALL_HOSTS "224.0.0.1"
+/* RFC 3376 defaults: Other Querier Present Interval, Last Member Query Time */
+#define IGMP_OTHER_QUERIER_SECS 255
+#define IGMP_LEAVE_GRACE_SECS 3
+#define LOCAL_ADDRS_MAX 32
+#define LOCAL_ADDRS_REFRESH_SECS 60
+
+McastMode mcast_mode = MCAST_OFF;
+
+typedef struct McastPub {
+    Channel chan;
+    struct in_addr group;
+    time_t expires;
+    struct McastPub *next;
+} McastPub;
+
+static McastPub *pubs = NULL;
+static pthread_mutex_t pub_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int pub_count = 0;
+
+/* IGMP listener's raw socket, -1 without CAP_NET_RAW */
+static int igmp_fd = -1;
+
+int mcast_parse_mode(const char *name, McastMode *out) {
+    if (strcmp(name, "rtp") == 0) *out = MCAST_RTP;
+    else if (strcmp(name, "udp") == 0) *out = MCAST_UDP;
+    else return 0;
+    return 1;
+}
+
+// Group of a channel: the base /16 plus major.minor
+static int channel_group(const Channel *chan, struct in_addr *group) {
+    if (chan->major < 0 || chan->major > 255 || chan->minor < 0 || chan->minor > 255) return 0;
+    uint32_t base = ntohl(inet_addr(MCAST_GROUP_BASE)) & 0xFFFF0000;
+    group->s_addr = htonl(base | (chan->major << 8) | chan->minor);
+    return 1;
+}
+
+int mcast_url(const Channel *chan, char *out, size_t len) {
+    struct in_addr group;
+    if (!channel_group(chan, &group)) return 0;
+    snprintf(out, len, "%s://@%s:%d", mcast_mode == MCAST_UDP ? "udp" : "rtp", inet_ntoa(group), MCAST_PORT);
+    return 1;
+}
+
+// Join or leave a group on the IGMP socket, to hear IGMPv2 reports for it
+static void igmp_membership(struct in_addr group, int join) {
+    if (igmp_fd < 0) return;
+    struct ip_mreq mreq = { .imr_multiaddr = group, .imr_interface.s_addr = htonl(INADDR_ANY) };
+    setsockopt(igmp_fd, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+}
+
+// -----------------------------------------------------------------------------
+// Publisher
+// -----------------------------------------------------------------------------
+
+// Send count whole datagrams from buf; returns 0 on a socket error
+static int send_datagrams(int sock, const unsigned char *buf, int count, uint16_t *seq, uint32_t ssrc) {
+    struct mmsghdr msgs[MCAST_BATCH];
+    struct iovec iov[MCAST_BATCH][2];
+    unsigned char rtp[MCAST_BATCH][RTP_HEADER];
+    // RTP timestamps: 90 kHz sampling clock (RFC 2250)
+    uint32_t ts90 = (uint32_t)(metrics_now_ns() * 9 / 100000);
+
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < count; i++) {
+        int n = 0;
+        if (mcast_mode == MCAST_RTP) {
+            unsigned char *h = rtp[i];
+            uint16_t s = (*seq)++;
+            h[0] = 0x80;                /* V=2 */
+            h[1] = RTP_PT_MP2T;
+            h[2] = s >> 8;
+            h[3] = s & 0xFF;
+            h[4] = ts90 >> 24;
+            h[5] = ts90 >> 16;
+            h[6] = ts90 >> 8;
+            h[7] = ts90;
+            h[8] = ssrc >> 24;
+            h[9] = ssrc >> 16;
+            h[10] = ssrc >> 8;
+            h[11] = ssrc;
+            iov[i][n].iov_base = h;
+            iov[i][n++].iov_len = RTP_HEADER;
+        }
+        iov[i][n].iov_base = (void *)(buf + (size_t)i * DATAGRAM_PAYLOAD);
+        iov[i][n++].iov_len = DATAGRAM_PAYLOAD;
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = n;
+    }
+
+    int done = 0;
+    while (done < count) {
+        int r = sendmmsg(sock, msgs + done, count - done, 0);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        done += r;
+    }
+    metrics_add(METRIC_MCAST_BYTES, (uint64_t)count * DATAGRAM_PAYLOAD);
+    return 1;
+}
+
+static int pub_live(McastPub *p) {
+    pthread_mutex_lock(&pub_mutex);
+    int live = time(NULL) < p->expires;
+    pthread_mutex_unlock(&pub_mutex);
+    return live;
+}
+
+static void *publisher(void *arg) {
+    McastPub *p = arg;
+    char url[64];
+    mcast_url(&p->chan, url, sizeof(url));
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int ttl = MCAST_TTL, loop = 1, sndbuf = 1024 * 1024;
+    struct sockaddr_in dst = { .sin_family = AF_INET, .sin_port = htons(MCAST_PORT), .sin_addr = p->group };
+    if (sock < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+        connect(sock, (struct sockaddr *)&dst, sizeof(dst)) < 0) {
+        LOG_ERROR("MCAST", "Cannot open %s: %s", url, strerror(errno));
+        if (sock >= 0) close(sock);
+        goto out;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    StreamTrace trace;
+    trace_begin(&trace, metrics_now_ns());
+    CaptureError err;
+    CaptureViewer *v = capture_open(&p->chan, &trace, &err);
+    if (!v) {
+        LOG_WARN("MCAST", "Cannot publish %s: %s", p->chan.number,
+                 err == CAPTURE_NO_TUNER ? "no tuner available" : "tuner process failed to start");
+        close(sock);
+        goto out;
+    }
+    LOG_INFO("MCAST", "Publishing %s to %s on Tuner %d", p->chan.number, url, v->tuner_id);
+
+    SptsFilter *spts = spts_open(p->chan.sid);
+    size_t cap = (size_t)DATAGRAM_PAYLOAD * MCAST_BATCH;
+    unsigned char *buf = malloc(cap);
+    size_t fill = 0;
+    uint16_t seq = (uint16_t)rand();
+    uint32_t ssrc = (uint32_t)(metrics_now_ns() ^ ((uint64_t)p->group.s_addr * 2654435761u));
+    int warned = 0;
+
+    while (buf && pub_live(p)) {
+        ssize_t n = capture_read(v, buf + fill, cap - fill);
+        if (n <= 0) break;
+        if (spts) n = spts_filter(spts, buf + fill, n);
+        fill += n;
+
+        // Every whole datagram goes out in one call; the rest waits
+        int count = fill / DATAGRAM_PAYLOAD;
+        if (count == 0) continue;
+        if (!send_datagrams(sock, buf, count, &seq, ssrc) && !warned++) {
+            LOG_WARN("MCAST", "Send to %s failed: %s", url, strerror(errno));
+        }
+        size_t used = (size_t)count * DATAGRAM_PAYLOAD;
+        memmove(buf, buf + used, fill - used);
+        fill -= used;
+    }
+    LOG_INFO("MCAST", "Stopped publishing %s to %s", p->chan.number, url);
+    free(buf);
+    spts_close(spts);
+    capture_close(v);
+    close(sock);
+
+out:
+    pthread_mutex_lock(&pub_mutex);
+    for (McastPub **pp = &pubs; *pp; pp = &(*pp)->next) {
+        if (*pp == p) {
+            *pp = p->next;
+            pub_count--;
+            break;
+        }
+    }
+    igmp_membership(p->group, 0);
+    pthread_mutex_unlock(&pub_mutex);
+    free(p);
+    return NULL;
+}
+
+int mcast_request(const Channel *chan) {
+    struct in_addr group;
+    if (mcast_mode == MCAST_OFF || !channel_group(chan, &group)) return 0;
+
+    pthread_mutex_lock(&pub_mutex);
+    for (McastPub *p = pubs; p; p = p->next) {
+        if (p->group.s_addr == group.s_addr) {
+            p->expires = time(NULL) + MCAST_IDLE_SECS;
+            pthread_mutex_unlock(&pub_mutex);
+            return 1;
+        }
+    }
+
+    McastPub *p = calloc(1, sizeof(McastPub));
+    pthread_t thread;
+    if (!p) {
+        pthread_mutex_unlock(&pub_mutex);
+        return 0;
+    }
+    p->chan = *chan;
+    p->group = group;
+    p->expires = time(NULL) + MCAST_IDLE_SECS;
+    p->next = pubs;
+    pubs = p;
+    pub_count++;
+    if (pthread_create(&thread, NULL, publisher, p) != 0) {
+        pubs = p->next;
+        pub_count--;
+        pthread_mutex_unlock(&pub_mutex);
+        free(p);
+        return 0;
+    }
+    pthread_detach(thread);
+    igmp_membership(group, 1);
+    pthread_mutex_unlock(&pub_mutex);
+    return 1;
+}
+
+int mcast_active_count() {
+    pthread_mutex_lock(&pub_mutex);
+    int n = pub_count;
+    pthread_mutex_unlock(&pub_mutex);
+    return n;
+}
+
+// -----------------------------------------------------------------------------
+// IGMP listener and querier
+// -----------------------------------------------------------------------------
+
+static uint16_t inet_checksum(const unsigned char *data, int len) {
+    uint32_t sum = 0;
+    for (int i = 0; i + 1 < len; i += 2) sum += (data[i] << 8) | data[i + 1];
+    if (len & 1) sum += data[len - 1] << 8;
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~sum;
+}
+
+// IGMPv3 query (understood by v2 hosts too); group 0 = general query
+static void send_query(struct in_addr group) {
+    unsigned char q[12] = {0};
+    q[0] = IGMP_QUERY;
+    q[1] = group.s_addr ? 10 : 100;     /* Max response: 1 s / 10 s */
+    memcpy(q + 4, &group.s_addr, 4);
+    q[8] = 0x02;                        /* QRV */
+    q[9] = MCAST_QUERY_SECS;            /* QQIC (exact below 128) */
+    uint16_t sum = inet_checksum(q, sizeof(q));
+    q[2] = sum >> 8;
+    q[3] = sum & 0xFF;
+
+    struct sockaddr_in dst = { .sin_family = AF_INET };
+    dst.sin_addr.s_addr = group.s_addr ? group.s_addr : inet_addr(IGMP_ALL_HOSTS);
+    sendto(igmp_fd, q, sizeof(q), 0, (struct sockaddr *)&dst, sizeof(dst));
+}
+
+// Channel published at a group address, if the address is one of ours
+static int group_channel(struct in_addr group, Channel *out) {
+    uint32_t g = ntohl(group.s_addr);
+    uint32_t base = ntohl(inet_addr(MCAST_GROUP_BASE)) & 0xFFFF0000;
+    if ((g & 0xFFFF0000) != base) return 0;
+
+    char number[16];
+    snprintf(number, sizeof(number), "%u.%u", (g >> 8) & 0xFF, g & 0xFF);
+    ChannelTable *lineup = channels_acquire();
+    Channel *c = find_channel_by_number(lineup, number);
+    if (c) *out = *c;
+    channels_release(lineup);
+    return c != NULL;
+}
+
+static void on_join(struct in_addr group) {
+    Channel chan;
+    if (group_channel(group, &chan)) mcast_request(&chan);
+}
+
+// Last member may have gone: expire soon unless someone answers a query
+static void on_leave(struct in_addr group, int other_querier) {
+    pthread_mutex_lock(&pub_mutex);
+    for (McastPub *p = pubs; p; p = p->next) {
+        if (p->group.s_addr != group.s_addr) continue;
+        time_t soon = time(NULL) + IGMP_LEAVE_GRACE_SECS;
+        if (p->expires > soon) p->expires = soon;
+        if (!other_querier) send_query(group);
+    }
+    pthread_mutex_unlock(&pub_mutex);
+}
+
+// Our own reports loop back to us; they must not keep channels alive
+static int is_local_addr(uint32_t addr) {
+    static uint32_t addrs[LOCAL_ADDRS_MAX];
+    static int count = 0;
+    static time_t refreshed = 0;
+    time_t now = time(NULL);
+    if (now - refreshed >= LOCAL_ADDRS_REFRESH_SECS) {
+        struct ifaddrs *ifaddr;
+        count = 0;
+        if (getifaddrs(&ifaddr) == 0) {
+            for (struct ifaddrs *ifa = ifaddr; ifa && count < LOCAL_ADDRS_MAX; ifa = ifa->ifa_next) {
+                if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET) continue;
+                addrs[count++] = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr;
+            }
+            freeifaddrs(ifaddr);
+        }
+        refreshed = now;
+    }
+    for (int i = 0; i < count; i++) {
+        if (addrs[i] == addr) return 1;
+    }
+    return 0;
+}
+
+static void handle_igmp(const unsigned char *pkt, int len, time_t *other_querier_until) {
+    if (len < 20) return;
+    int ihl = (pkt[0] & 0x0F) * 4;
+    if (len < ihl + 8) return;
+    uint32_t src;
+    memcpy(&src, pkt + 12, 4);
+    if (is_local_addr(src)) return;
+
+    const unsigned char *m = pkt + ihl;
+    int mlen = len - ihl;
+    int other_querier = time(NULL) < *other_querier_until;
+    struct in_addr group;
+    memcpy(&group.s_addr, m + 4, 4);
+
+    switch (m[0]) {
+        case IGMP_QUERY:
+            *other_querier_until = time(NULL) + IGMP_OTHER_QUERIER_SECS;
+            break;
+        case IGMP_V1_REPORT:
+        case IGMP_V2_REPORT:
+            on_join(group);
+            break;
+        case IGMP_V2_LEAVE:
+            on_leave(group, other_querier);
+            break;
+        case IGMP_V3_REPORT: {
+            int records = (m[6] << 8) | m[7];
+            int off = 8;
+            for (int r = 0; r < records && off + 8 <= mlen; r++) {
+                int type = m[off];
+                int aux = m[off + 1] * 4;
+                int sources = (m[off + 2] << 8) | m[off + 3];
+                memcpy(&group.s_addr, m + off + 4, 4);
+                // EXCLUDE modes (any source) and INCLUDE with sources are
+                // members; INCLUDE with no sources is a leave
+                if (type == 2 || type == 4 || ((type == 1 || type == 3 || type == 5) && sources > 0)) {
+                    on_join(group);
+                } else if ((type == 1 || type == 3) && sources == 0) {
+                    on_leave(group, other_querier);
+                }
+                off += 8 + sources * 4 + aux;
+            }
+            break;
+        }
+    }
+}
+
+static void *igmp_listener(void *arg) {
+    (void)arg;
+    time_t other_querier_until = 0;
+    time_t last_query = 0;
+    unsigned char pkt[1500];
+
+    for (;;) {
+        struct pollfd pfd = { .fd = igmp_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 1000) > 0) {
+            ssize_t n = recv(igmp_fd, pkt, sizeof(pkt), 0);
+            if (n > 0) handle_igmp(pkt, n, &other_querier_until);
+        }
+
+        // Members only report when asked; ask if no router does
+        time_t now = time(NULL);
+        if (mcast_active_count() > 0 && now >= other_querier_until && now - last_query >= MCAST_QUERY_SECS) {
+            struct in_addr any = { 0 };
+            send_query(any);
+            last_query = now;
+        }
+    }
+    return NULL;
+}
+
+void mcast_start() {
+    if (mcast_mode == MCAST_OFF) return;
+
+    igmp_fd = socket(AF_INET, SOCK_RAW, IPPROTO_IGMP);
+    if (igmp_fd < 0) {
+        LOG_INFO("MCAST", "Not watching IGMP (%s); multicast channels stop %ds after the last /multicast request",
+                 strerror(errno), MCAST_IDLE_SECS);
+        return;
+    }
+    // Queries go out once, to this link only, with Router Alert
+    int ttl = 1, loop = 0;
+    unsigned char router_alert[4] = { 0x94, 0x04, 0x00, 0x00 };
+    setsockopt(igmp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(igmp_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    setsockopt(igmp_fd, IPPROTO_IP, IP_OPTIONS, router_alert, sizeof(router_alert));
+    struct ip_mreq mreq = { .imr_interface.s_addr = htonl(INADDR_ANY) };
+    mreq.imr_multiaddr.s_addr = inet_addr(IGMP_V3_REPORTS_GROUP);
+    setsockopt(igmp_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, igmp_listener, NULL) != 0) {
+        close(igmp_fd);
+        igmp_fd = -1;
+        return;
+    }
+    pthread_detach(thread);
+    LOG_INFO("MCAST", "Publishing channels on demand to %s/16 port %d (%s)",
+             MCAST_GROUP_BASE, MCAST_PORT, mcast_mode == MCAST_UDP ? "UDP" : "RTP");
+}
@@ -16,6 +16,7 @@
 #include <avahi-common/error.h>
 #include "mdns.h"
 #include "log.h"
+#include "mcast.h"
 
 // DNS constants
 #define MDNS_PORT 5353
@@ -112,13 +113,15 @@ static void* mdns_fallback_worker(void *arg) {
         memcpy(packet+p, target_host, 19); p += 19;
 
         // 3. TXT: ZapLinkCore._http._tcp.local -> "path=/playlist.m3u"
+        //    (+ "multicast=/multicast.m3u" with -M)
         memcpy(packet+p, inst_name, 30); p += 30;
         packet[p++] = 0x00; packet[p++] = 0x10; // Type: TXT
         packet[p++] = 0x00; packet[p++] = 0x01; // Class: IN
         packet[p++] = 0x00; packet[p++] = 0x00; packet[p++] = 0x01; packet[p++] = 0x2c; // TTL: 300
-        const char *txt_data = "\022path=/playlist.m3u";
-        packet[p++] = 0x00; packet[p++] = 19;   // RDLEN
-        memcpy(packet+p, txt_data, 19); p += 19;
+        const char *txt_data = "\022path=/playlist.m3u\030multicast=/multicast.m3u";
+        int txt_len = mcast_mode != MCAST_OFF ? 44 : 19;
+        packet[p++] = 0x00; packet[p++] = txt_len; // RDLEN
+        memcpy(packet+p, txt_data, txt_len); p += txt_len;
 
         // 4. A: zaplinkcore.local -> ip
         memcpy(packet+p, target_host, 19); p += 19;
@@ -157,7 +160,8 @@ static void entry_group_callback(AvahiEntryGroup *g, AvahiEntryGroupState state,
 static void create_services(AvahiClient *c) {
     if (!group && !(group = avahi_entry_group_new(c, entry_group_callback, NULL))) return;
     if (avahi_entry_group_is_empty(group)) {
-        avahi_entry_group_add_service(group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, name, "_http._tcp", NULL, NULL, service_port, "path=/playlist.m3u", NULL);
+        avahi_entry_group_add_service(group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, name, "_http._tcp", NULL, NULL, service_port, "path=/playlist.m3u",
+                                      mcast_mode != MCAST_OFF ? "multicast=/multicast.m3u" : NULL, NULL);
         avahi_entry_group_commit(group);
     }
 }
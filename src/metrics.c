@@ -0,0 +1,343 @@
+/**
+ * @file metrics.c
+ * @brief Prometheus metrics: sharded counters, histograms, stream slots
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "metrics.h"
+#include "tuner.h"
+#include "dvr.h"
+#include "pacer.h"
+#include "mcast.h"
+#include "config.h"
+
+#define METRICS_SHARDS 16
+#define TS_PACKET_SIZE 188
+
+/* Histogram upper bounds in nanoseconds: 100 us .. 60 s */
+static const uint64_t bucket_ns[] = {
+    100000ULL, 250000ULL, 500000ULL,
+    1000000ULL, 2500000ULL, 5000000ULL,
+    10000000ULL, 25000000ULL, 50000000ULL,
+    100000000ULL, 250000000ULL, 500000000ULL,
+    1000000000ULL, 2500000000ULL, 5000000000ULL,
+    10000000000ULL, 30000000000ULL, 60000000000ULL
+};
+#define BUCKETS (sizeof(bucket_ns) / sizeof(bucket_ns[0]))
+
+typedef struct {
+    atomic_uint_least64_t buckets[BUCKETS + 1];   /* Last one is +Inf */
+    atomic_uint_least64_t sum_ns;
+} HistogramCells;
+
+typedef struct {
+    _Alignas(64) atomic_uint_least64_t counters[METRIC_COUNTER_COUNT];
+    HistogramCells hist[METRIC_HISTOGRAM_COUNT];
+} MetricShard;
+
+struct MetricsStream {
+    char channel[32];
+    atomic_uint_least64_t bytes;
+    atomic_uint_least64_t cc_errors;
+    atomic_uint_least64_t tei_packets;
+    atomic_int viewers;
+};
+
+/* Relay transport errors by tuner, to tell a bad tuner from a bad mux */
+static atomic_uint_least64_t tuner_cc_errors[MAX_TUNERS];
+static atomic_uint_least64_t tuner_tei_packets[MAX_TUNERS];
+
+static MetricShard shards[METRICS_SHARDS];
+static atomic_uint next_shard;
+static _Thread_local MetricShard *my_shard;
+
+static MetricsStream streams[METRICS_MAX_STREAMS];
+static atomic_int stream_count;
+static pthread_mutex_t stream_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *counter_names[METRIC_COUNTER_COUNT][2] = {
+    [METRIC_TUNER_WAITS]        = {"zaplink_tuner_acquire_waits_total", "Stream requests that waited for a tuner"},
+    [METRIC_TUNER_PREEMPTIONS]  = {"zaplink_tuner_preemptions_total", "EPG scans preempted by a stream"},
+    [METRIC_TUNER_UNAVAILABLE]  = {"zaplink_tuner_unavailable_total", "Stream requests refused with 503"},
+    [METRIC_TUNER_LINGER_RECLAIMS] = {"zaplink_tuner_linger_reclaims_total", "Lingering tuners reclaimed for other work"},
+    [METRIC_STREAM_WARM_STARTS] = {"zaplink_stream_warm_starts_total", "Streams attached to an already tuned mux"},
+    [METRIC_STREAM_KEYFRAME_STARTS] = {"zaplink_stream_keyframe_starts_total", "Warm streams started from a cached keyframe"},
+    [METRIC_STREAM_FILTERED_BYTES] = {"zaplink_stream_filtered_bytes_total", "Bytes of other programs and null packets not sent to viewers"},
+    [METRIC_PACE_RESYNCS]       = {"zaplink_pace_resyncs_total", "Paced stream schedules re-anchored after a PCR discontinuity, tuner stall or clock drift"},
+    [METRIC_PACE_STALLS]        = {"zaplink_pace_stalls_total", "Paced sends put off because the client socket was full"},
+    [METRIC_MCAST_BYTES]        = {"zaplink_multicast_bytes_total", "TS bytes published to multicast groups"},
+    [METRIC_DVR_BYTES]          = {"zaplink_dvr_bytes_total", "Bytes written to recordings"},
+    [METRIC_DVR_OVERRUNS]       = {"zaplink_dvr_overruns_total", "Times a recorder fell behind the capture (data lost from that recording only)"},
+    [METRIC_EPG_SECTIONS]       = {"zaplink_epg_sections_total", "PSIP sections parsed"},
+    [METRIC_EPG_EVENTS]         = {"zaplink_epg_events_total", "Guide updates queued for storage"},
+    [METRIC_EPG_EVENTS_DROPPED] = {"zaplink_epg_events_dropped_total", "Guide updates dropped on a full writer queue"},
+    [METRIC_EPG_CRC_ERRORS]     = {"zaplink_epg_crc_errors_total", "PSIP sections dropped on CRC mismatch"},
+    [METRIC_EPG_CC_ERRORS]      = {"zaplink_epg_cc_errors_total", "TS continuity counter errors during scans"},
+};
+
+/* Histograms sharing a family are exported under one name with a label */
+static const struct {
+    const char *family;
+    const char *label;
+} histogram_names[METRIC_HISTOGRAM_COUNT] = {
+    [METRIC_TUNER_WAIT]     = {"zaplink_tuner_acquire_wait_seconds", NULL},
+    [METRIC_EPG_SCAN]       = {"zaplink_epg_scan_duration_seconds", NULL},
+    [METRIC_DB_UPSERT]      = {"zaplink_db_statement_seconds", "statement=\"upsert_program\""},
+    [METRIC_DB_DESCRIPTION] = {"zaplink_db_statement_seconds", "statement=\"update_description\""},
+    [METRIC_DB_COMMIT]      = {"zaplink_db_statement_seconds", "statement=\"commit\""},
+    [METRIC_DB_XMLTV]       = {"zaplink_db_statement_seconds", "statement=\"xmltv\""},
+    [METRIC_DB_JSON]        = {"zaplink_db_statement_seconds", "statement=\"json\""},
+    [METRIC_DB_CLEANUP]     = {"zaplink_db_statement_seconds", "statement=\"cleanup\""},
+    [METRIC_HTTP_PLAYLIST]  = {"zaplink_http_request_duration_seconds", "route=\"/playlist.m3u\""},
+    [METRIC_HTTP_XMLTV]     = {"zaplink_http_request_duration_seconds", "route=\"/xmltv.xml\""},
+    [METRIC_HTTP_JSON]      = {"zaplink_http_request_duration_seconds", "route=\"/xmltv.json\""},
+    [METRIC_HTTP_RELOAD]    = {"zaplink_http_request_duration_seconds", "route=\"/reload\""},
+    [METRIC_HTTP_METRICS]   = {"zaplink_http_request_duration_seconds", "route=\"/metrics\""},
+    [METRIC_HTTP_STATUS]    = {"zaplink_http_request_duration_seconds", "route=\"/status\""},
+    [METRIC_HTTP_STARTUP]   = {"zaplink_http_request_duration_seconds", "route=\"/startup\""},
+    [METRIC_HTTP_OTHER]     = {"zaplink_http_request_duration_seconds", "route=\"other\""},
+    [METRIC_STARTUP_PARSED]     = {"zaplink_stream_startup_seconds", "phase=\"parsed\""},
+    [METRIC_STARTUP_TUNER]      = {"zaplink_stream_startup_seconds", "phase=\"tuner\""},
+    [METRIC_STARTUP_SPAWNED]    = {"zaplink_stream_startup_seconds", "phase=\"spawned\""},
+    [METRIC_STARTUP_FIRST_BYTE] = {"zaplink_stream_startup_seconds", "phase=\"first_byte\""},
+    [METRIC_STARTUP_FIRST_PAT]  = {"zaplink_stream_startup_seconds", "phase=\"first_pat\""},
+    [METRIC_STARTUP_FIRST_PMT]  = {"zaplink_stream_startup_seconds", "phase=\"first_pmt\""},
+    [METRIC_STARTUP_FIRST_SENT] = {"zaplink_stream_startup_seconds", "phase=\"first_sent\""},
+    [METRIC_PACE_LATENESS]      = {"zaplink_pace_lateness_seconds", NULL},
+};
+
+static const char *histogram_help(const char *family) {
+    if (strcmp(family, "zaplink_tuner_acquire_wait_seconds") == 0) return "Time stream requests waited for a tuner";
+    if (strcmp(family, "zaplink_epg_scan_duration_seconds") == 0) return "Duration of one EPG mux scan";
+    if (strcmp(family, "zaplink_db_statement_seconds") == 0) return "SQLite statement latency";
+    if (strcmp(family, "zaplink_stream_startup_seconds") == 0) return "Stream startup time from accept, by phase reached";
+    if (strcmp(family, "zaplink_pace_lateness_seconds") == 0) return "How late paced packets left against their PCR schedule";
+    return "HTTP request latency by route (streams excluded)";
+}
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Threads are dealt shards round-robin on first use
+static inline MetricShard *shard(void) {
+    if (!my_shard) my_shard = &shards[atomic_fetch_add(&next_shard, 1) % METRICS_SHARDS];
+    return my_shard;
+}
+
+void metrics_add(MetricCounter c, uint64_t n) {
+    atomic_fetch_add_explicit(&shard()->counters[c], n, memory_order_relaxed);
+}
+
+void metrics_observe(MetricHistogram h, uint64_t ns) {
+    HistogramCells *cells = &shard()->hist[h];
+    size_t b = 0;
+    while (b < BUCKETS && ns > bucket_ns[b]) b++;
+    atomic_fetch_add_explicit(&cells->buckets[b], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&cells->sum_ns, ns, memory_order_relaxed);
+}
+
+MetricsStream *metrics_stream_open(const char *channel) {
+    MetricsStream *s = NULL;
+
+    // Slots are never freed, so counters stay monotonic across viewers
+    pthread_mutex_lock(&stream_mutex);
+    int n = atomic_load(&stream_count);
+    for (int i = 0; i < n; i++) {
+        if (strcmp(streams[i].channel, channel) == 0) {
+            s = &streams[i];
+            break;
+        }
+    }
+    if (!s && n < METRICS_MAX_STREAMS) {
+        s = &streams[n];
+        snprintf(s->channel, sizeof(s->channel), "%s", channel);
+        atomic_store(&stream_count, n + 1);
+    }
+    pthread_mutex_unlock(&stream_mutex);
+
+    if (s) atomic_fetch_add(&s->viewers, 1);
+    return s;
+}
+
+void metrics_stream_relayed(MetricsStream *s, size_t bytes) {
+    if (s) atomic_fetch_add_explicit(&s->bytes, bytes, memory_order_relaxed);
+}
+
+void metrics_stream_errors(MetricsStream *s, int tuner_index, uint64_t cc_errors, uint64_t tei_packets) {
+    if (s) {
+        atomic_fetch_add_explicit(&s->cc_errors, cc_errors, memory_order_relaxed);
+        atomic_fetch_add_explicit(&s->tei_packets, tei_packets, memory_order_relaxed);
+    }
+    if (tuner_index >= 0 && tuner_index < MAX_TUNERS) {
+        atomic_fetch_add_explicit(&tuner_cc_errors[tuner_index], cc_errors, memory_order_relaxed);
+        atomic_fetch_add_explicit(&tuner_tei_packets[tuner_index], tei_packets, memory_order_relaxed);
+    }
+}
+
+void metrics_stream_close(MetricsStream *s) {
+    if (s) atomic_fetch_sub(&s->viewers, 1);
+}
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int failed;
+} TextBuf;
+
+static void emit(TextBuf *tb, const char *fmt, ...) {
+    if (tb->failed) return;
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(tb->buf + tb->len, tb->cap - tb->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            tb->failed = 1;
+            return;
+        }
+        if ((size_t)n < tb->cap - tb->len) {
+            tb->len += n;
+            return;
+        }
+        size_t cap = tb->cap * 2 + n;
+        char *tmp = realloc(tb->buf, cap);
+        if (!tmp) {
+            tb->failed = 1;
+            return;
+        }
+        tb->buf = tmp;
+        tb->cap = cap;
+    }
+}
+
+// Copy a channel number into a label value (Prometheus escapes \ " and \n)
+static void label_value(char *out, size_t out_len, const char *in) {
+    size_t o = 0;
+    for (; *in && o + 3 < out_len; in++) {
+        if (*in == '\\' || *in == '"') out[o++] = '\\';
+        if (*in == '\n') {
+            out[o++] = '\\';
+            out[o++] = 'n';
+            continue;
+        }
+        out[o++] = *in;
+    }
+    out[o] = '\0';
+}
+
+static void render_histogram(TextBuf *tb, MetricHistogram h) {
+    uint64_t buckets[BUCKETS + 1] = {0};
+    uint64_t sum_ns = 0;
+    for (int s = 0; s < METRICS_SHARDS; s++) {
+        const HistogramCells *cells = &shards[s].hist[h];
+        for (size_t b = 0; b <= BUCKETS; b++) buckets[b] += atomic_load_explicit(&cells->buckets[b], memory_order_relaxed);
+        sum_ns += atomic_load_explicit(&cells->sum_ns, memory_order_relaxed);
+    }
+
+    const char *family = histogram_names[h].family;
+    const char *label = histogram_names[h].label;
+    uint64_t cumulative = 0;
+    for (size_t b = 0; b <= BUCKETS; b++) {
+        cumulative += buckets[b];
+        char le[32];
+        if (b < BUCKETS) snprintf(le, sizeof(le), "%g", bucket_ns[b] / 1e9);
+        else snprintf(le, sizeof(le), "+Inf");
+        emit(tb, "%s_bucket{%s%sle=\"%s\"} %llu\n", family, label ? label : "", label ? "," : "",
+             le, (unsigned long long)cumulative);
+    }
+    emit(tb, "%s_sum%s%s%s %.6f\n", family, label ? "{" : "", label ? label : "", label ? "}" : "", sum_ns / 1e9);
+    emit(tb, "%s_count%s%s%s %llu\n", family, label ? "{" : "", label ? label : "", label ? "}" : "",
+         (unsigned long long)cumulative);
+}
+
+char *metrics_render(void) {
+    TextBuf tb = { malloc(16384), 0, 16384, 0 };
+    if (!tb.buf) return NULL;
+
+    // Per-channel relay counters
+    int n = atomic_load(&stream_count);
+    static const char *stream_families[5][3] = {
+        {"zaplink_stream_bytes_total", "counter", "TS bytes relayed to viewers"},
+        {"zaplink_stream_packets_total", "counter", "TS packets relayed to viewers"},
+        {"zaplink_stream_viewers", "gauge", "Active viewers"},
+        {"zaplink_stream_cc_errors_total", "counter", "Continuity errors in relayed streams"},
+        {"zaplink_stream_tei_packets_total", "counter", "Relayed packets flagged with transport errors"},
+    };
+    for (int f = 0; f < 5; f++) {
+        emit(&tb, "# HELP %s %s\n# TYPE %s %s\n", stream_families[f][0], stream_families[f][2],
+             stream_families[f][0], stream_families[f][1]);
+        for (int i = 0; i < n; i++) {
+            char chan[80];
+            label_value(chan, sizeof(chan), streams[i].channel);
+            uint64_t bytes = atomic_load_explicit(&streams[i].bytes, memory_order_relaxed);
+            unsigned long long v;
+            switch (f) {
+                case 0: v = bytes; break;
+                case 1: v = bytes / TS_PACKET_SIZE; break;
+                case 2: v = atomic_load(&streams[i].viewers); break;
+                case 3: v = atomic_load_explicit(&streams[i].cc_errors, memory_order_relaxed); break;
+                default: v = atomic_load_explicit(&streams[i].tei_packets, memory_order_relaxed); break;
+            }
+            emit(&tb, "%s{channel=\"%s\"} %llu\n", stream_families[f][0], chan, v);
+        }
+    }
+
+    // Tuner occupancy is read from the pool rather than tracked
+    emit(&tb, "# HELP zaplink_tuners Tuners by current user\n# TYPE zaplink_tuners gauge\n");
+    emit(&tb, "zaplink_tuners{user=\"idle\"} %d\n", tuner_count_by_user(USER_NONE));
+    emit(&tb, "zaplink_tuners{user=\"stream\"} %d\n", tuner_count_by_user(USER_STREAM));
+    emit(&tb, "zaplink_tuners{user=\"epg\"} %d\n", tuner_count_by_user(USER_EPG));
+    emit(&tb, "zaplink_tuners{user=\"linger\"} %d\n", tuner_count_by_user(USER_LINGER));
+    emit(&tb, "# HELP zaplink_dvr_recordings Recordings currently capturing\n# TYPE zaplink_dvr_recordings gauge\n");
+    emit(&tb, "zaplink_dvr_recordings %d\n", dvr_active_count());
+    emit(&tb, "# HELP zaplink_paced_streams Streams sent with PCR pacing\n# TYPE zaplink_paced_streams gauge\n");
+    emit(&tb, "zaplink_paced_streams %d\n", pace_session_count());
+    emit(&tb, "# HELP zaplink_multicast_channels Channels published to multicast groups\n# TYPE zaplink_multicast_channels gauge\n");
+    emit(&tb, "zaplink_multicast_channels %d\n", mcast_active_count());
+
+    emit(&tb, "# HELP zaplink_tuner_cc_errors_total Continuity errors in streams relayed from each tuner\n"
+              "# TYPE zaplink_tuner_cc_errors_total counter\n");
+    for (int i = 0; i < tuner_count && i < MAX_TUNERS; i++) {
+        emit(&tb, "zaplink_tuner_cc_errors_total{adapter=\"%d\"} %llu\n", tuners[i].id,
+             (unsigned long long)atomic_load_explicit(&tuner_cc_errors[i], memory_order_relaxed));
+    }
+    emit(&tb, "# HELP zaplink_tuner_tei_packets_total Transport error packets from each tuner\n"
+              "# TYPE zaplink_tuner_tei_packets_total counter\n");
+    for (int i = 0; i < tuner_count && i < MAX_TUNERS; i++) {
+        emit(&tb, "zaplink_tuner_tei_packets_total{adapter=\"%d\"} %llu\n", tuners[i].id,
+             (unsigned long long)atomic_load_explicit(&tuner_tei_packets[i], memory_order_relaxed));
+    }
+
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        uint64_t total = 0;
+        for (int s = 0; s < METRICS_SHARDS; s++) {
+            total += atomic_load_explicit(&shards[s].counters[c], memory_order_relaxed);
+        }
+        emit(&tb, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_names[c][0], counter_names[c][1],
+             counter_names[c][0], counter_names[c][0], (unsigned long long)total);
+    }
+
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        const char *family = histogram_names[h].family;
+        if (h == 0 || strcmp(family, histogram_names[h - 1].family) != 0) {
+            emit(&tb, "# HELP %s %s\n# TYPE %s histogram\n", family, histogram_help(family), family);
+        }
+        render_histogram(&tb, h);
+    }
+
+    if (tb.failed) {
+        free(tb.buf);
+        return NULL;
+    }
+    return tb.buf;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file mls.c
+ * @brief Compact multi-language string access
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "mls.h"
+
+int mls_next(const char **cursor, MlsVariant *out) {
+    const char *p = *cursor;
+    if (!p || *p == '\0') return 0;
+
+    if (*p != MLS_SEP) {
+        // Untagged legacy text: the whole buffer is one variant
+        out->lang[0] = '\0';
+        out->text = p;
+        out->len = strlen(p);
+        *cursor = p + out->len;
+        return 1;
+    }
+
+    p++;
+    size_t n = 0;
+    while (n < MLS_LANG_LEN && p[n] && p[n] != MLS_SEP) n++;
+    memcpy(out->lang, p, n);
+    out->lang[n] = '\0';
+    p += n;
+
+    const char *end = strchr(p, MLS_SEP);
+    out->text = p;
+    out->len = end ? (size_t)(end - p) : strlen(p);
+    *cursor = p + out->len;
+    return 1;
+}
+
+int mls_select(const char *mls, const char *lang, MlsVariant *out) {
+    out->lang[0] = '\0';
+    out->text = "";
+    out->len = 0;
+
+    const char *cur = mls;
+    MlsVariant v;
+    int first = 1;
+    while (mls_next(&cur, &v)) {
+        if (lang && lang[0] && strcasecmp(v.lang, lang) == 0) {
+            *out = v;
+            return 1;
+        }
+        if (first) {
+            *out = v;
+            first = 0;
+        }
+    }
+    return 0;
+}
+
+int mls_valid_lang(const char *lang) {
+    if (!lang || strlen(lang) != MLS_LANG_LEN) return 0;
+    for (int i = 0; i < MLS_LANG_LEN; i++) {
+        if (!isalpha((unsigned char)lang[i])) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,213 @@
+/**
+ * @file mss_cache.c
+ * @brief Sharded CLOCK cache of decoded ATSC strings
+ * 
+ * Each shard owns a fixed array of slots and a hash table of slot
+ * indices (chained through the slots). A lookup hashes the raw MSS bytes,
+ * walks one chain and confirms the hit with a full byte compare, so hash
+ * collisions never return the wrong text. On a hit the slot's reference
+ * bit is set; inserting into a full shard advances the clock hand,
+ * clearing reference bits until it finds an unreferenced victim.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "mss_cache.h"
+
+#define MSS_CACHE_SHARDS 8
+#define SHARD_SLOTS (MSS_CACHE_SLOTS / MSS_CACHE_SHARDS)
+#define SHARD_BUCKETS (SHARD_SLOTS * 2)
+
+typedef struct {
+    uint64_t hash;
+    unsigned char *key;   /* Raw MSS bytes, followed by the value */
+    char *val;            /* Points into the same allocation as key */
+    uint32_t key_len;
+    uint32_t val_len;
+    uint32_t out_len;     /* Output buffer size the value was decoded for */
+    int next;             /* Next slot in bucket chain, -1 terminates */
+    uint8_t used;
+    uint8_t referenced;
+} MssCacheSlot;
+
+typedef struct {
+    pthread_mutex_t lock;
+    MssCacheSlot slots[SHARD_SLOTS];
+    int buckets[SHARD_BUCKETS];
+    int hand;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long entries;
+    size_t bytes;
+} MssCacheShard;
+
+static MssCacheShard shards[MSS_CACHE_SHARDS];
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static void cache_init(void) {
+    for (int i = 0; i < MSS_CACHE_SHARDS; i++) {
+        memset(&shards[i], 0, sizeof(MssCacheShard));
+        pthread_mutex_init(&shards[i].lock, NULL);
+        memset(shards[i].buckets, 0xFF, sizeof(shards[i].buckets));
+    }
+}
+
+// 64-bit multiply/xorshift hash over 8-byte words
+static uint64_t hash_bytes(const unsigned char *p, size_t len, uint64_t seed) {
+    uint64_t h = seed ^ (len * 0x9E3779B97F4A7C15ULL);
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ (w * 0xBF58476D1CE4E5B9ULL)) * 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+        p += 8;
+        len -= 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, len);
+    h = (h ^ (tail * 0xBF58476D1CE4E5B9ULL)) * 0x94D049BB133111EBULL;
+
+    // fmix64 finalizer: both halves must avalanche, since the low bits
+    // pick the shard and the high bits the bucket
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 33);
+}
+
+// Every key in a shard shares its low bits, so the bucket comes from the
+// high half of the hash
+static inline int bucket_of(uint64_t hash) {
+    return (int)((hash >> 32) % SHARD_BUCKETS);
+}
+
+static int find_slot(MssCacheShard *sh, uint64_t hash, const unsigned char *raw, int raw_len, size_t out_len) {
+    for (int i = sh->buckets[bucket_of(hash)]; i >= 0; i = sh->slots[i].next) {
+        MssCacheSlot *s = &sh->slots[i];
+        if (s->hash == hash && s->key_len == (uint32_t)raw_len && s->out_len == out_len &&
+            memcmp(s->key, raw, raw_len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void unlink_slot(MssCacheShard *sh, int idx) {
+    int *link = &sh->buckets[bucket_of(sh->slots[idx].hash)];
+    while (*link >= 0 && *link != idx) link = &sh->slots[*link].next;
+    if (*link == idx) *link = sh->slots[idx].next;
+}
+
+int mss_cache_get(const unsigned char *raw, int raw_len, char *out, size_t out_len) {
+    if (raw_len <= 0 || out_len == 0) return -1;
+    pthread_once(&cache_once, cache_init);
+    uint64_t hash = hash_bytes(raw, raw_len, out_len);
+    MssCacheShard *sh = &shards[hash % MSS_CACHE_SHARDS];
+
+    pthread_mutex_lock(&sh->lock);
+    int idx = find_slot(sh, hash, raw, raw_len, out_len);
+    if (idx < 0) {
+        sh->misses++;
+        pthread_mutex_unlock(&sh->lock);
+        return -1;
+    }
+    MssCacheSlot *s = &sh->slots[idx];
+    s->referenced = 1;
+    sh->hits++;
+    size_t n = s->val_len < out_len - 1 ? s->val_len : out_len - 1;
+    memcpy(out, s->val, n);
+    out[n] = '\0';
+    pthread_mutex_unlock(&sh->lock);
+    return (int)n;
+}
+
+void mss_cache_put(const unsigned char *raw, int raw_len, size_t out_len, const char *val, size_t val_len) {
+    if (raw_len <= 0 || out_len == 0) return;
+    pthread_once(&cache_once, cache_init);
+    uint64_t hash = hash_bytes(raw, raw_len, out_len);
+    MssCacheShard *sh = &shards[hash % MSS_CACHE_SHARDS];
+
+    unsigned char *blob = malloc(raw_len + val_len + 1);
+    if (!blob) return;
+    memcpy(blob, raw, raw_len);
+    memcpy(blob + raw_len, val, val_len);
+    blob[raw_len + val_len] = '\0';
+
+    pthread_mutex_lock(&sh->lock);
+    if (find_slot(sh, hash, raw, raw_len, out_len) >= 0) {
+        pthread_mutex_unlock(&sh->lock);
+        free(blob);
+        return;
+    }
+
+    // CLOCK: give referenced slots a second chance, take the first cold one
+    MssCacheSlot *s;
+    for (;;) {
+        s = &sh->slots[sh->hand];
+        if (!s->used || !s->referenced) break;
+        s->referenced = 0;
+        sh->hand = (sh->hand + 1) % SHARD_SLOTS;
+    }
+    int idx = sh->hand;
+    sh->hand = (sh->hand + 1) % SHARD_SLOTS;
+
+    unsigned char *old = NULL;
+    if (s->used) {
+        unlink_slot(sh, idx);
+        old = s->key;
+        sh->bytes -= s->key_len + s->val_len;
+        sh->evictions++;
+    } else {
+        sh->entries++;
+    }
+
+    s->hash = hash;
+    s->key = blob;
+    s->val = (char *)blob + raw_len;
+    s->key_len = raw_len;
+    s->val_len = val_len;
+    s->out_len = out_len;
+    s->used = 1;
+    s->referenced = 0;
+    s->next = sh->buckets[bucket_of(hash)];
+    sh->buckets[bucket_of(hash)] = idx;
+    sh->bytes += raw_len + val_len;
+    pthread_mutex_unlock(&sh->lock);
+
+    free(old);
+}
+
+void mss_cache_stats(MssCacheStats *st) {
+    pthread_once(&cache_once, cache_init);
+    memset(st, 0, sizeof(*st));
+    for (int i = 0; i < MSS_CACHE_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        st->hits += shards[i].hits;
+        st->misses += shards[i].misses;
+        st->evictions += shards[i].evictions;
+        st->entries += shards[i].entries;
+        st->bytes += shards[i].bytes;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
+
+void mss_cache_cleanup() {
+    pthread_once(&cache_once, cache_init);
+    for (int i = 0; i < MSS_CACHE_SHARDS; i++) {
+        MssCacheShard *sh = &shards[i];
+        pthread_mutex_lock(&sh->lock);
+        for (int k = 0; k < SHARD_SLOTS; k++) {
+            free(sh->slots[k].key);
+            sh->slots[k].key = NULL;
+            sh->slots[k].used = 0;
+        }
+        memset(sh->buckets, 0xFF, sizeof(sh->buckets));
+        sh->entries = 0;
+        sh->bytes = 0;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
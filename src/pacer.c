@@ -0,0 +1,351 @@
+/**
+ * @file pacer.c
+ * @brief PCR-paced stream output
+ *
+ * Everything (the wheel and every session's queue) is guarded by
+ * pace_mutex. Sends are non-blocking, so the pacer thread only ever
+ * holds it for memcpy- and syscall-sized moments.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "pacer.h"
+#include "config.h"
+#include "metrics.h"
+#include "log.h"
+
+#define TS_PACKET 188
+
+#define PACE_TICK_NS 1000000ULL
+#define PACE_WHEEL_SLOTS 1024
+/* Queue per session: about 3 s of a single program, 1.2 s of a whole mux */
+#define PACE_QUEUE_PACKETS 16384
+/* How soon a client with a full socket is retried */
+#define PACE_STALL_RETRY_NS (5 * PACE_TICK_NS)
+/* Schedule further ahead than the jitter buffer plus this is drift */
+#define PACE_MAX_AHEAD_NS (3000000000ULL)
+/* PCR steps above this (27 MHz) are discontinuities */
+#define PCR_MAX_STEP (27000000ULL)
+#define PCR_WRAP ((1ULL << 33) * 300)
+
+int pace_jitter_ms = PACE_JITTER_MS;
+
+struct PaceSession {
+    int fd;
+    unsigned char *pkts;        /* Ring of PACE_QUEUE_PACKETS packets */
+    uint64_t *due;              /* Send time of each stamped packet */
+    uint64_t head;              /* Packets queued */
+    uint64_t tail;              /* Packets fully sent */
+    uint64_t stamped;           /* [tail, stamped) have send times */
+    size_t partial;             /* Bytes of the tail packet already sent */
+    uint64_t sent_bytes;
+    int failed;                 /* Client gone */
+
+    int pcr_pid;                /* -1 until the first PCR */
+    uint64_t last_pcr;          /* 27 MHz */
+    uint64_t last_pcr_seq;
+    uint64_t last_pcr_due;
+
+    int scheduled;
+    int slot;
+    unsigned rounds;            /* Wheel turns left before it is due */
+    struct PaceSession *next;   /* In its slot */
+};
+
+static pthread_mutex_t pace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pace_wake = PTHREAD_COND_INITIALIZER;    /* Pacer: work scheduled */
+static pthread_cond_t pace_progress = PTHREAD_COND_INITIALIZER; /* Sessions: sent or failed */
+static pthread_once_t pacer_once = PTHREAD_ONCE_INIT;
+static int pacer_running = 0;
+static PaceSession *wheel[PACE_WHEEL_SLOTS];
+static uint64_t wheel_tick;     /* Next tick to run */
+static int scheduled_count = 0;
+static int session_count = 0;
+
+// -----------------------------------------------------------------------------
+// Timer wheel; called with pace_mutex held
+// -----------------------------------------------------------------------------
+
+static void schedule(PaceSession *s, uint64_t due_ns) {
+    if (scheduled_count == 0) {
+        // The wheel stood still while idle; bring it to now
+        uint64_t now_tick = metrics_now_ns() / PACE_TICK_NS;
+        if (now_tick > wheel_tick) wheel_tick = now_tick;
+    }
+    uint64_t tick = due_ns / PACE_TICK_NS;
+    if (tick < wheel_tick) tick = wheel_tick;
+    s->slot = tick % PACE_WHEEL_SLOTS;
+    s->rounds = (tick - wheel_tick) / PACE_WHEEL_SLOTS;
+    s->next = wheel[s->slot];
+    wheel[s->slot] = s;
+    s->scheduled = 1;
+    if (scheduled_count++ == 0) pthread_cond_signal(&pace_wake);
+}
+
+static void unschedule(PaceSession *s) {
+    if (!s->scheduled) return;
+    for (PaceSession **pp = &wheel[s->slot]; *pp; pp = &(*pp)->next) {
+        if (*pp == s) {
+            *pp = s->next;
+            break;
+        }
+    }
+    s->scheduled = 0;
+    scheduled_count--;
+}
+
+// Send every packet that is due; returns when to look again (0 = when pushed)
+static uint64_t send_due(PaceSession *s, uint64_t now) {
+    uint64_t n = 0;
+    while (s->tail + n < s->stamped && s->due[(s->tail + n) % PACE_QUEUE_PACKETS] <= now + PACE_TICK_NS / 2) n++;
+    if (n == 0) return s->tail < s->stamped ? s->due[s->tail % PACE_QUEUE_PACKETS] : 0;
+
+    // Up to two runs: the ring may wrap
+    struct iovec iov[2];
+    int iovcnt = 1;
+    uint64_t first = s->tail % PACE_QUEUE_PACKETS;
+    uint64_t run = PACE_QUEUE_PACKETS - first < n ? PACE_QUEUE_PACKETS - first : n;
+    iov[0].iov_base = s->pkts + first * TS_PACKET + s->partial;
+    iov[0].iov_len = run * TS_PACKET - s->partial;
+    if (run < n) {
+        iov[1].iov_base = s->pkts;
+        iov[1].iov_len = (n - run) * TS_PACKET;
+        iovcnt = 2;
+    }
+    size_t want = iov[0].iov_len + (iovcnt == 2 ? iov[1].iov_len : 0);
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+    ssize_t sent = sendmsg(s->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            metrics_add(METRIC_PACE_STALLS, 1);
+            return now + PACE_STALL_RETRY_NS;
+        }
+        s->failed = 1;
+        pthread_cond_broadcast(&pace_progress);
+        return 0;
+    }
+
+    metrics_observe(METRIC_PACE_LATENESS, now > s->due[first] ? now - s->due[first] : 0);
+    size_t done = s->partial + sent;
+    s->tail += done / TS_PACKET;
+    s->partial = done % TS_PACKET;
+    s->sent_bytes += sent;
+    pthread_cond_broadcast(&pace_progress);
+
+    if ((size_t)sent < want) return now + PACE_STALL_RETRY_NS;   /* Socket full */
+    return s->tail < s->stamped ? s->due[s->tail % PACE_QUEUE_PACKETS] : 0;
+}
+
+static void *pacer_thread(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&pace_mutex);
+    for (;;) {
+        while (scheduled_count == 0) pthread_cond_wait(&pace_wake, &pace_mutex);
+
+        uint64_t tick_ns = wheel_tick * PACE_TICK_NS;
+        uint64_t now = metrics_now_ns();
+        if (now < tick_ns) {
+            pthread_mutex_unlock(&pace_mutex);
+            struct timespec ts = { .tv_sec = tick_ns / 1000000000ULL, .tv_nsec = tick_ns % 1000000000ULL };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+            pthread_mutex_lock(&pace_mutex);
+            continue;
+        }
+
+        // Take the slot's list, then advance the wheel so rescheduling
+        // never lands back in the slot being run
+        int slot = wheel_tick % PACE_WHEEL_SLOTS;
+        PaceSession *list = wheel[slot];
+        wheel[slot] = NULL;
+        wheel_tick++;
+
+        while (list) {
+            PaceSession *s = list;
+            list = s->next;
+            if (s->rounds > 0) {
+                // Due on a later turn of the wheel
+                s->rounds--;
+                s->next = wheel[slot];
+                wheel[slot] = s;
+                continue;
+            }
+            s->scheduled = 0;
+            scheduled_count--;
+            uint64_t next = send_due(s, now);
+            if (next) schedule(s, next);
+        }
+    }
+    return NULL;
+}
+
+static void pacer_start(void) {
+    pthread_t thread;
+    wheel_tick = metrics_now_ns() / PACE_TICK_NS;
+    if (pthread_create(&thread, NULL, pacer_thread, NULL) != 0) {
+        LOG_ERROR("PACE", "Cannot start pacer thread");
+        return;
+    }
+    pthread_detach(thread);
+    pacer_running = 1;
+}
+
+// -----------------------------------------------------------------------------
+// Sessions
+// -----------------------------------------------------------------------------
+
+PaceSession *pace_open(int fd) {
+    pthread_once(&pacer_once, pacer_start);
+    if (!pacer_running) return NULL;
+
+    PaceSession *s = calloc(1, sizeof(PaceSession));
+    if (!s) return NULL;
+    s->pkts = malloc((size_t)PACE_QUEUE_PACKETS * TS_PACKET);
+    s->due = malloc(PACE_QUEUE_PACKETS * sizeof(uint64_t));
+    if (!s->pkts || !s->due) {
+        free(s->pkts);
+        free(s->due);
+        free(s);
+        return NULL;
+    }
+    s->fd = fd;
+    s->pcr_pid = -1;
+
+    pthread_mutex_lock(&pace_mutex);
+    session_count++;
+    pthread_mutex_unlock(&pace_mutex);
+    return s;
+}
+
+// 27 MHz PCR of a packet, or -1
+static int64_t packet_pcr(const unsigned char *p) {
+    if (!(p[3] & 0x20) || p[4] < 7 || !(p[5] & 0x10)) return -1;
+    uint64_t base = ((uint64_t)p[6] << 25) | (p[7] << 17) | (p[8] << 9) | (p[9] << 1) | (p[10] >> 7);
+    int ext = ((p[10] & 0x01) << 8) | p[11];
+    return base * 300 + ext;
+}
+
+// Give packets [stamped, upto] send times ending at due_upto: spread
+// evenly from the previous PCR, or all at due_upto
+static void stamp_until(PaceSession *s, uint64_t upto, uint64_t due_upto, int spread) {
+    for (uint64_t seq = s->stamped; seq <= upto; seq++) {
+        s->due[seq % PACE_QUEUE_PACKETS] = spread
+            ? s->last_pcr_due + (due_upto - s->last_pcr_due) * (seq - s->last_pcr_seq) / (upto - s->last_pcr_seq)
+            : due_upto;
+    }
+    s->stamped = upto + 1;
+}
+
+// A PCR arrived on packet seq; called with pace_mutex held
+static void on_pcr(PaceSession *s, int pid, uint64_t pcr, uint64_t seq) {
+    uint64_t now = metrics_now_ns();
+    uint64_t jitter = (uint64_t)pace_jitter_ms * 1000000ULL;
+    uint64_t anchor = now + jitter;
+
+    uint64_t due;
+    int spread = s->pcr_pid >= 0;
+    if (!spread) {
+        // First clock: everything so far leaves once the buffer has filled
+        s->pcr_pid = pid;
+        due = anchor;
+    } else {
+        uint64_t step = (pcr + PCR_WRAP - s->last_pcr) % PCR_WRAP;
+        due = s->last_pcr_due + step * 1000 / 27;
+        if (step > PCR_MAX_STEP || due < now || due > anchor + PACE_MAX_AHEAD_NS) {
+            // Discontinuity, tuner stall or clock drift: refill the buffer
+            due = anchor > s->last_pcr_due ? anchor : s->last_pcr_due;
+            metrics_add(METRIC_PACE_RESYNCS, 1);
+        }
+    }
+    stamp_until(s, seq, due, spread);
+    s->last_pcr = pcr;
+    s->last_pcr_seq = seq;
+    s->last_pcr_due = due;
+}
+
+int pace_push(PaceSession *s, const unsigned char *buf, size_t len) {
+    pthread_mutex_lock(&pace_mutex);
+    for (size_t i = 0; i + TS_PACKET <= len; i += TS_PACKET) {
+        while (s->head - s->tail == PACE_QUEUE_PACKETS && !s->failed) {
+            pthread_cond_wait(&pace_progress, &pace_mutex);
+        }
+        if (s->failed) break;
+
+        const unsigned char *p = buf + i;
+        uint64_t seq = s->head++;
+        memcpy(s->pkts + (seq % PACE_QUEUE_PACKETS) * TS_PACKET, p, TS_PACKET);
+
+        int pid = ((p[1] & 0x1F) << 8) | p[2];
+        int64_t pcr = (s->pcr_pid < 0 || pid == s->pcr_pid) ? packet_pcr(p) : -1;
+        if (pcr >= 0) {
+            on_pcr(s, pid, pcr, seq);
+        } else if (s->head - s->stamped > PACE_QUEUE_PACKETS / 2) {
+            // No usable clock for half a queue: send at the last known
+            // pace and follow whichever PID carries PCRs next
+            uint64_t now = metrics_now_ns() + (uint64_t)pace_jitter_ms * 1000000ULL;
+            s->pcr_pid = -1;
+            uint64_t due = now > s->last_pcr_due ? now : s->last_pcr_due;
+            stamp_until(s, seq, due, 0);
+            s->last_pcr_due = due;
+            metrics_add(METRIC_PACE_RESYNCS, 1);
+        }
+        if (!s->scheduled && s->tail < s->stamped) schedule(s, s->due[s->tail % PACE_QUEUE_PACKETS]);
+    }
+    int ok = !s->failed;
+    pthread_mutex_unlock(&pace_mutex);
+    return ok;
+}
+
+uint64_t pace_sent_bytes(PaceSession *s) {
+    pthread_mutex_lock(&pace_mutex);
+    uint64_t n = s->sent_bytes;
+    pthread_mutex_unlock(&pace_mutex);
+    return n;
+}
+
+uint64_t pace_close(PaceSession *s) {
+    pthread_mutex_lock(&pace_mutex);
+    uint64_t now = metrics_now_ns();
+    if (!s->failed && s->head > s->stamped) {
+        // Packets after the last PCR follow right behind it
+        stamp_until(s, s->head - 1, s->last_pcr_due > now ? s->last_pcr_due : now, 0);
+        if (!s->scheduled) schedule(s, s->due[s->tail % PACE_QUEUE_PACKETS]);
+    }
+    // Drain on schedule, but never wait long on a client that stopped reading
+    uint64_t last_due = s->head > s->tail ? s->due[(s->head - 1) % PACE_QUEUE_PACKETS] : now;
+    uint64_t wait_ns = (last_due > now ? last_due - now : 0) + 5000000000ULL;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_ns / 1000000000ULL;
+    deadline.tv_nsec += wait_ns % 1000000000ULL;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (!s->failed && s->tail < s->head) {
+        if (pthread_cond_timedwait(&pace_progress, &pace_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    unschedule(s);
+    session_count--;
+    uint64_t sent = s->sent_bytes;
+    pthread_mutex_unlock(&pace_mutex);
+
+    free(s->pkts);
+    free(s->due);
+    free(s);
+    return sent;
+}
+
+int pace_session_count() {
+    pthread_mutex_lock(&pace_mutex);
+    int n = session_count;
+    pthread_mutex_unlock(&pace_mutex);
+    return n;
+}
@@ -0,0 +1,219 @@
+/**
+ * @file spts.c
+ * @brief Single-program transport stream filter for one channel
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "spts.h"
+#include "crc32.h"
+#include "log.h"
+
+#define TS_PACKET 188
+#define PAT_PID 0x0000
+#define PSIP_BASE_PID 0x1FFB
+#define NULL_PID 0x1FFF
+
+/* One PSI section being reassembled; only the first section starting in
+ * a packet is followed, which is all PAT and PMT need in practice */
+typedef struct {
+    unsigned char data[1024];
+    int len;
+    int need;                   /* Total section size, 0 when idle */
+} SptsSection;
+
+struct SptsFilter {
+    int service_id;
+    int pmt_pid;                /* -1 until the PAT lists the service */
+    int passthrough;            /* PAT without the service: send the mux */
+    int warned;
+
+    int ts_id;
+    int pat_version;
+    unsigned pat_cc;            /* Our own counter for the rewritten PAT */
+
+    uint8_t keep[8192 / 8];     /* PMT, PCR, ES and PSIP PIDs */
+    int es_pids[32];            /* Added from the current PMT */
+    int es_count;
+
+    SptsSection pat;
+    SptsSection pmt;
+};
+
+static inline void keep_set(SptsFilter *f, int pid, int on) {
+    if (on) f->keep[pid >> 3] |= 1 << (pid & 7);
+    else f->keep[pid >> 3] &= ~(1 << (pid & 7));
+}
+
+static inline int keep_has(const SptsFilter *f, int pid) {
+    return (f->keep[pid >> 3] >> (pid & 7)) & 1;
+}
+
+SptsFilter *spts_open(int service_id) {
+    SptsFilter *f = calloc(1, sizeof(SptsFilter));
+    if (!f) return NULL;
+    f->service_id = service_id;
+    f->pmt_pid = -1;
+    f->pat_version = -1;
+    keep_set(f, PSIP_BASE_PID, 1);
+    return f;
+}
+
+void spts_close(SptsFilter *f) {
+    free(f);
+}
+
+// Feed one packet; returns 1 once s->data holds a whole, intact section
+static int section_feed(SptsSection *s, const unsigned char *p) {
+    int afc = (p[3] >> 4) & 0x3;
+    if (!(afc & 0x1)) return 0;
+    int off = 4;
+    if (afc & 0x2) off += 1 + p[4];
+    if (off >= TS_PACKET) return 0;
+    const unsigned char *payload = p + off;
+    int len = TS_PACKET - off;
+
+    if (p[1] & 0x40) {
+        int pointer = payload[0];
+        if (1 + pointer + 3 > len) {
+            s->need = 0;
+            return 0;
+        }
+        payload += 1 + pointer;
+        len -= 1 + pointer;
+        s->need = 3 + (((payload[1] & 0x0F) << 8) | payload[2]);
+        s->len = 0;
+        if (s->need < 12 || s->need > (int)sizeof(s->data)) {
+            s->need = 0;
+            return 0;
+        }
+    } else if (!s->need) {
+        return 0;
+    }
+
+    int n = s->need - s->len;
+    if (n > len) n = len;
+    memcpy(s->data + s->len, payload, n);
+    s->len += n;
+    if (s->len < s->need) return 0;
+    s->need = 0;
+    return crc32_mpeg(s->data, s->len) == 0 && (s->data[5] & 0x01);
+}
+
+// Forget the PIDs of the previous PMT
+static void clear_program(SptsFilter *f) {
+    for (int i = 0; i < f->es_count; i++) keep_set(f, f->es_pids[i], 0);
+    f->es_count = 0;
+    if (f->pmt_pid >= 0) keep_set(f, f->pmt_pid, 0);
+    keep_set(f, PSIP_BASE_PID, 1);
+}
+
+static void add_es_pid(SptsFilter *f, int pid) {
+    if (pid == PAT_PID || pid == NULL_PID || keep_has(f, pid)) return;
+    if (f->es_count == (int)(sizeof(f->es_pids) / sizeof(f->es_pids[0]))) return;
+    f->es_pids[f->es_count++] = pid;
+    keep_set(f, pid, 1);
+}
+
+static void parse_pat(SptsFilter *f, const unsigned char *sec, int len) {
+    if (sec[0] != 0x00) return;
+    f->ts_id = (sec[3] << 8) | sec[4];
+    f->pat_version = (sec[5] >> 1) & 0x1F;
+
+    int pmt_pid = -1;
+    for (int i = 8; i + 4 <= len - 4; i += 4) {
+        int program = (sec[i] << 8) | sec[i + 1];
+        if (program == f->service_id) pmt_pid = ((sec[i + 2] & 0x1F) << 8) | sec[i + 3];
+    }
+
+    f->passthrough = pmt_pid < 0;
+    if (f->passthrough && !f->warned) {
+        f->warned = 1;
+        LOG_WARN("SPTS", "Program %d is not in the PAT; sending the whole mux", f->service_id);
+    }
+    if (pmt_pid != f->pmt_pid) {
+        clear_program(f);
+        f->pmt_pid = pmt_pid;
+        f->pmt.need = 0;
+        if (pmt_pid >= 0) keep_set(f, pmt_pid, 1);
+    }
+}
+
+static void parse_pmt(SptsFilter *f, const unsigned char *sec, int len) {
+    if (sec[0] != 0x02 || ((sec[3] << 8) | sec[4]) != f->service_id) return;
+
+    for (int i = 0; i < f->es_count; i++) keep_set(f, f->es_pids[i], 0);
+    f->es_count = 0;
+    keep_set(f, f->pmt_pid, 1);
+    keep_set(f, PSIP_BASE_PID, 1);
+
+    add_es_pid(f, ((sec[8] & 0x1F) << 8) | sec[9]);     /* PCR PID */
+    int pos = 12 + (((sec[10] & 0x0F) << 8) | sec[11]);
+    while (pos + 5 <= len - 4) {
+        add_es_pid(f, ((sec[pos + 1] & 0x1F) << 8) | sec[pos + 2]);
+        pos += 5 + (((sec[pos + 3] & 0x0F) << 8) | sec[pos + 4]);
+    }
+}
+
+// Single-entry PAT for our program
+static void write_pat(SptsFilter *f, unsigned char *p) {
+    memset(p, 0xFF, TS_PACKET);
+    p[0] = 0x47;
+    p[1] = 0x40;                /* PUSI, PID 0 */
+    p[2] = 0x00;
+    p[3] = 0x10 | (f->pat_cc++ & 0x0F);
+    p[4] = 0x00;                /* pointer_field */
+
+    unsigned char *sec = p + 5;
+    sec[0] = 0x00;
+    sec[1] = 0xB0;              /* section_syntax_indicator, length 13 */
+    sec[2] = 13;
+    sec[3] = f->ts_id >> 8;
+    sec[4] = f->ts_id & 0xFF;
+    sec[5] = 0xC1 | (f->pat_version << 1);
+    sec[6] = 0x00;
+    sec[7] = 0x00;
+    sec[8] = f->service_id >> 8;
+    sec[9] = f->service_id & 0xFF;
+    sec[10] = 0xE0 | (f->pmt_pid >> 8);
+    sec[11] = f->pmt_pid & 0xFF;
+    uint32_t crc = crc32_mpeg(sec, 12);
+    sec[12] = crc >> 24;
+    sec[13] = crc >> 16;
+    sec[14] = crc >> 8;
+    sec[15] = crc;
+}
+
+size_t spts_filter(SptsFilter *f, unsigned char *buf, size_t len) {
+    size_t out = 0;
+    for (size_t i = 0; i + TS_PACKET <= len; i += TS_PACKET) {
+        unsigned char *p = buf + i;
+        if (p[0] != 0x47) continue;
+        int pid = ((p[1] & 0x1F) << 8) | p[2];
+
+        if (pid == PAT_PID) {
+            if (section_feed(&f->pat, p)) {
+                parse_pat(f, f->pat.data, f->pat.len);
+                if (!f->passthrough) {
+                    // At most one packet out per packet in, so this never
+                    // overtakes the input
+                    write_pat(f, buf + out);
+                    out += TS_PACKET;
+                    continue;
+                }
+            }
+            if (!f->passthrough) continue;
+        } else if (pid == NULL_PID) {
+            continue;
+        } else if (!f->passthrough) {
+            if (!keep_has(f, pid)) continue;
+            if (pid == f->pmt_pid && section_feed(&f->pmt, p)) parse_pmt(f, f->pmt.data, f->pmt.len);
+        }
+
+        if (out != i) memcpy(buf + out, p, TS_PACKET);
+        out += TS_PACKET;
+    }
+    return out;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file stream_out.c
+ * @brief Packet-aligned socket output for stream relays
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "stream_out.h"
+#include "config.h"
+#include "metrics.h"
+
+/* Largest read a latency stream sends in one go */
+#define LATENCY_CHUNK (188 * 7 * 3)
+
+StreamProfile stream_profile_parse(const char *name) {
+    if (name && strcmp(name, "throughput") == 0) return STREAM_PROFILE_THROUGHPUT;
+    return STREAM_PROFILE_LATENCY;
+}
+
+int stream_out_open(StreamOut *o, int fd, StreamProfile profile) {
+    memset(o, 0, sizeof(*o));
+    o->fd = fd;
+    o->profile = profile;
+    o->size = profile == STREAM_PROFILE_THROUGHPUT ? STREAM_BATCH_BYTES : LATENCY_CHUNK;
+    o->buf = malloc(o->size);
+    if (!o->buf) return 0;
+
+    // Best effort: a socket that refuses an option still streams
+    int one = 1;
+    int sndbuf = profile == STREAM_PROFILE_THROUGHPUT ? STREAM_SNDBUF_THROUGHPUT : STREAM_SNDBUF_LATENCY;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    if (profile == STREAM_PROFILE_THROUGHPUT) {
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &one, sizeof(one));
+    } else {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return 1;
+}
+
+unsigned char *stream_out_space(StreamOut *o, size_t *room) {
+    *room = o->size - o->fill;
+    return o->buf + o->fill;
+}
+
+// Send the whole buffer; a short write is finished, never dropped
+static ssize_t flush(StreamOut *o) {
+    size_t off = 0;
+    while (off < o->fill) {
+        ssize_t n = write(o->fd, o->buf + off, o->fill - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        off += n;
+    }
+    ssize_t sent = o->fill;
+    o->fill = 0;
+    return sent;
+}
+
+ssize_t stream_out_commit(StreamOut *o, size_t n) {
+    uint64_t now = metrics_now_ns();
+    if (n && o->fill == 0) o->oldest_ns = now;
+    o->fill += n;
+    if (o->fill == 0) return 0;
+
+    if (o->profile == STREAM_PROFILE_THROUGHPUT && o->fill < o->size &&
+        now - o->oldest_ns < (uint64_t)STREAM_BATCH_MAX_MS * 1000000) {
+        return 0;
+    }
+    return flush(o);
+}
+
+void stream_out_close(StreamOut *o) {
+    if (!o->buf) return;
+    if (o->fill) flush(o);
+    if (o->profile == STREAM_PROFILE_THROUGHPUT) {
+        int zero = 0;
+        setsockopt(o->fd, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+    }
+    free(o->buf);
+    o->buf = NULL;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file stream_trace.c
+ * @brief Per-session stream startup timeline
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "stream_trace.h"
+#include "metrics.h"
+#include "log.h"
+#include "json_buf.h"
+
+static const char *phase_names[TRACE_PHASES] = {
+    "accepted", "parsed", "tuner", "spawned", "first_byte", "first_pat", "first_pmt", "first_sent"
+};
+
+/* Histogram per phase, measured from accept */
+static const MetricHistogram phase_metric[TRACE_PHASES] = {
+    METRIC_HISTOGRAM_COUNT,     /* accepted: always zero */
+    METRIC_STARTUP_PARSED,
+    METRIC_STARTUP_TUNER,
+    METRIC_STARTUP_SPAWNED,
+    METRIC_STARTUP_FIRST_BYTE,
+    METRIC_STARTUP_FIRST_PAT,
+    METRIC_STARTUP_FIRST_PMT,
+    METRIC_STARTUP_FIRST_SENT,
+};
+
+static StreamTrace recent[STREAM_TRACE_RECENT];
+static int recent_next = 0;
+static int recent_count = 0;
+static pthread_mutex_t recent_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void trace_begin(StreamTrace *tr, uint64_t accepted_ns) {
+    memset(tr, 0, sizeof(*tr));
+    tr->tuner_id = -1;
+    tr->started = time(NULL);
+    tr->t[TRACE_ACCEPTED] = accepted_ns;
+}
+
+void trace_mark(StreamTrace *tr, TracePhase phase) {
+    if (tr->t[phase] == 0) tr->t[phase] = metrics_now_ns();
+}
+
+static double phase_ms(const StreamTrace *tr, int phase) {
+    return (tr->t[phase] - tr->t[TRACE_ACCEPTED]) / 1e6;
+}
+
+void trace_finish(StreamTrace *tr, const char *outcome) {
+    if (tr->outcome[0]) return;
+    snprintf(tr->outcome, sizeof(tr->outcome), "%s", outcome);
+    // A rejected request (404, 416) never started; keep it out of the histograms
+    int observe = outcome[0] != '4';
+
+    char line[256];
+    size_t len = 0;
+    for (int p = TRACE_PARSED; p < TRACE_PHASES && len < sizeof(line); p++) {
+        if (!tr->t[p]) continue;
+        len += snprintf(line + len, sizeof(line) - len, " %s %.1f", phase_names[p], phase_ms(tr, p));
+        if (observe) metrics_observe(phase_metric[p], tr->t[p] - tr->t[TRACE_ACCEPTED]);
+    }
+    LOG_DEBUG("STREAM", "Startup %s (%s, %s tuner %d, %d retries) ms:%s",
+              tr->channel, tr->outcome, tr->warm ? "warm" : "cold", tr->tuner_id, tr->retries,
+              len ? line : " none");
+
+    pthread_mutex_lock(&recent_mutex);
+    recent[recent_next] = *tr;
+    recent_next = (recent_next + 1) % STREAM_TRACE_RECENT;
+    if (recent_count < STREAM_TRACE_RECENT) recent_count++;
+    pthread_mutex_unlock(&recent_mutex);
+}
+
+char *trace_recent_json(void) {
+    StreamTrace copy[STREAM_TRACE_RECENT];
+    int n;
+    pthread_mutex_lock(&recent_mutex);
+    n = recent_count;
+    // Newest first
+    for (int i = 0; i < n; i++) {
+        copy[i] = recent[(recent_next - 1 - i + STREAM_TRACE_RECENT) % STREAM_TRACE_RECENT];
+    }
+    pthread_mutex_unlock(&recent_mutex);
+
+    JsonBuf jb;
+    if (!json_buf_init(&jb, 512 + (size_t)n * 512)) return NULL;
+    json_printf(&jb, "{\n  \"sessions\": [");
+    for (int i = 0; i < n; i++) {
+        const StreamTrace *tr = &copy[i];
+        // The channel is whatever the request path said, even on a 404
+        json_printf(&jb, "%s\n    {\"channel\": ", i ? "," : "");
+        json_string(&jb, tr->channel);
+        json_printf(&jb, ", \"client\": ");
+        json_string(&jb, tr->client);
+        json_printf(&jb, ", \"outcome\": ");
+        json_string(&jb, tr->outcome);
+        json_printf(&jb, ", \"tuner\": %d, \"warm\": %s, \"retries\": %d, \"started\": %ld, \"ms\": {",
+                    tr->tuner_id, tr->warm ? "true" : "false", tr->retries, (long)tr->started);
+        int first = 1;
+        for (int p = TRACE_PARSED; p < TRACE_PHASES; p++) {
+            if (!tr->t[p]) continue;
+            json_printf(&jb, "%s\"%s\": %.1f", first ? "" : ", ", phase_names[p], phase_ms(tr, p));
+            first = 0;
+        }
+        json_printf(&jb, "}}");
+    }
+    json_printf(&jb, "\n  ]\n}\n");
+    return json_buf_finish(&jb);
+}
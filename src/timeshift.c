@@ -0,0 +1,255 @@
+/**
+ * @file timeshift.c
+ * @brief Disk-backed timeshift window for a mux capture
+ *
+ * One spill thread appends; any number of viewers read. The window
+ * start is advanced before a write overwrites old data, and readers
+ * re-check it after reading, so a read that raced the writer is
+ * discarded rather than returned torn.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include "timeshift.h"
+#include "config.h"
+#include "log.h"
+
+#define TS_PACKET 188
+
+/* Segment length in 90 kHz PCR ticks */
+#define SEGMENT_TICKS 45000
+/* PCR steps outside this range are discontinuities, not elapsed time */
+#define MAX_PCR_STEP (5 * 90000)
+/* Re-pick the PCR PID if the current one is silent for this long */
+#define PCR_PID_TIMEOUT_BYTES (8 * 1024 * 1024)
+
+int timeshift_minutes = 0;
+
+typedef struct {
+    uint64_t pos;           /* Absolute offset of the segment's first packet */
+    uint64_t ticks;         /* Timeline at that packet */
+} TimeshiftSegment;
+
+struct Timeshift {
+    int fd;
+    uint64_t size;          /* File size, whole packets */
+
+    pthread_mutex_t lock;
+    uint64_t start;         /* Oldest absolute offset still in the file */
+    uint64_t end;           /* One past the newest */
+
+    TimeshiftSegment *segs; /* Circular, ordered by pos and ticks */
+    int seg_cap;
+    int seg_first;
+    int seg_count;
+
+    /* Spill thread only */
+    int pcr_pid;            /* -1 until the first PCR */
+    uint64_t last_pcr;      /* 90 kHz base of the last PCR */
+    uint64_t last_pcr_pos;
+    uint64_t ticks;         /* Timeline at the last PCR */
+    uint64_t seg_ticks;     /* Timeline when the newest segment opened */
+};
+
+Timeshift *timeshift_create(uint32_t freq_hz, int minutes) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/zaplink-timeshift-%u-%d.ts", TIMESHIFT_DIR, freq_hz, (int)getpid());
+
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_ERROR("TIMESHIFT", "Cannot create %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    // Only our descriptor keeps it; the space is freed when we close it
+    unlink(path);
+
+    uint64_t size = (uint64_t)minutes * 60 * TIMESHIFT_BYTES_PER_SEC;
+    size -= size % TS_PACKET;
+    int rc = posix_fallocate(fd, 0, size);
+    if (rc != 0) {
+        // tmpfs and some network filesystems cannot preallocate
+        LOG_WARN("TIMESHIFT", "Cannot preallocate %lu MB for mux %u: %s",
+                 (unsigned long)(size >> 20), freq_hz, strerror(rc));
+        if (ftruncate(fd, size) != 0) {
+            LOG_ERROR("TIMESHIFT", "Cannot size timeshift file: %s", strerror(errno));
+            close(fd);
+            return NULL;
+        }
+    }
+
+    Timeshift *ts = calloc(1, sizeof(Timeshift));
+    int seg_cap = minutes * 60 * (90000 / SEGMENT_TICKS) + 64;
+    if (ts) ts->segs = malloc(seg_cap * sizeof(TimeshiftSegment));
+    if (!ts || !ts->segs) {
+        free(ts);
+        close(fd);
+        return NULL;
+    }
+    ts->fd = fd;
+    ts->size = size;
+    ts->seg_cap = seg_cap;
+    ts->pcr_pid = -1;
+    pthread_mutex_init(&ts->lock, NULL);
+    LOG_DEBUG("TIMESHIFT", "Mux %u: %d min window (%lu MB)", freq_hz, minutes, (unsigned long)(size >> 20));
+    return ts;
+}
+
+void timeshift_destroy(Timeshift *ts) {
+    if (!ts) return;
+    close(ts->fd);
+    pthread_mutex_destroy(&ts->lock);
+    free(ts->segs);
+    free(ts);
+}
+
+// PCR base (90 kHz) of a packet, or -1
+static int64_t packet_pcr(const unsigned char *p) {
+    if (!(p[3] & 0x20) || p[4] < 7 || !(p[5] & 0x10)) return -1;
+    return ((int64_t)p[6] << 25) | (p[7] << 17) | (p[8] << 9) | (p[9] << 1) | (p[10] >> 7);
+}
+
+// Called with the lock held
+static void add_segment(Timeshift *ts, uint64_t pos, uint64_t ticks) {
+    if (ts->seg_count == ts->seg_cap) {
+        ts->seg_first = (ts->seg_first + 1) % ts->seg_cap;
+        ts->seg_count--;
+    }
+    TimeshiftSegment *s = &ts->segs[(ts->seg_first + ts->seg_count) % ts->seg_cap];
+    s->pos = pos;
+    s->ticks = ticks;
+    ts->seg_count++;
+}
+
+// Advance the timeline over the new packets; returns segments to add
+static int index_packets(Timeshift *ts, const unsigned char *buf, size_t len, uint64_t pos,
+                         TimeshiftSegment *out, int max) {
+    int n = 0;
+    for (size_t i = 0; i < len; i += TS_PACKET) {
+        const unsigned char *p = buf + i;
+        if (p[0] != 0x47 || (p[1] & 0x80)) continue;
+        int pid = ((p[1] & 0x1F) << 8) | p[2];
+        if (ts->pcr_pid >= 0 && pid != ts->pcr_pid) {
+            if (pos + i - ts->last_pcr_pos < PCR_PID_TIMEOUT_BYTES) continue;
+            ts->pcr_pid = -1;   /* Program gone; follow another clock */
+        }
+        int64_t pcr = packet_pcr(p);
+        if (pcr < 0) continue;
+
+        if (ts->pcr_pid < 0) {
+            // New clock: continue the timeline where it left off
+            ts->pcr_pid = pid;
+        } else {
+            uint64_t step = ((uint64_t)pcr - ts->last_pcr) & ((1ULL << 33) - 1);
+            if (step <= MAX_PCR_STEP) ts->ticks += step;
+        }
+        ts->last_pcr = pcr;
+        ts->last_pcr_pos = pos + i;
+
+        if (ts->seg_count + n == 0 || ts->ticks - ts->seg_ticks >= SEGMENT_TICKS) {
+            ts->seg_ticks = ts->ticks;
+            if (n < max) {
+                out[n].pos = pos + i;
+                out[n].ticks = ts->ticks;
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+void timeshift_append(Timeshift *ts, const unsigned char *buf, size_t len, uint64_t pos) {
+    if (len > ts->size) {
+        // Larger than the whole window: only the tail survives
+        buf += len - ts->size;
+        pos += len - ts->size;
+        len = ts->size;
+    }
+
+    TimeshiftSegment segs[16];
+    int nsegs = index_packets(ts, buf, len, pos, segs, 16);
+
+    pthread_mutex_lock(&ts->lock);
+    if (pos != ts->end) {
+        // The spill fell behind the ring: what is on disk no longer joins up
+        LOG_WARN("TIMESHIFT", "Spill gap of %lu bytes; window restarts",
+                 (unsigned long)(pos - ts->end));
+        ts->start = pos;
+        ts->end = pos;
+        ts->seg_count = 0;
+    }
+    // Retire what this write is about to overwrite before touching it
+    if (pos + len - ts->start > ts->size) ts->start = pos + len - ts->size;
+    while (ts->seg_count > 0 && ts->segs[ts->seg_first].pos < ts->start) {
+        ts->seg_first = (ts->seg_first + 1) % ts->seg_cap;
+        ts->seg_count--;
+    }
+    pthread_mutex_unlock(&ts->lock);
+
+    uint64_t off = pos % ts->size;
+    size_t first = ts->size - off;
+    if (first > len) first = len;
+    if (pwrite(ts->fd, buf, first, off) != (ssize_t)first ||
+        (len > first && pwrite(ts->fd, buf + first, len - first, 0) != (ssize_t)(len - first))) {
+        LOG_ERROR("TIMESHIFT", "Spill write failed: %s", strerror(errno));
+    }
+
+    pthread_mutex_lock(&ts->lock);
+    ts->end = pos + len;
+    for (int i = 0; i < nsegs; i++) add_segment(ts, segs[i].pos, segs[i].ticks);
+    pthread_mutex_unlock(&ts->lock);
+}
+
+ssize_t timeshift_read(Timeshift *ts, uint64_t pos, unsigned char *buf, size_t len) {
+    pthread_mutex_lock(&ts->lock);
+    uint64_t start = ts->start, end = ts->end;
+    pthread_mutex_unlock(&ts->lock);
+    if (pos < start || pos >= end) return -1;
+
+    if (len > end - pos) len = end - pos;
+    uint64_t off = pos % ts->size;
+    size_t first = ts->size - off;
+    if (first > len) first = len;
+    if (pread(ts->fd, buf, first, off) != (ssize_t)first) return -1;
+    if (len > first && pread(ts->fd, buf + first, len - first, 0) != (ssize_t)(len - first)) return -1;
+
+    // The writer may have lapped us while we read
+    pthread_mutex_lock(&ts->lock);
+    int overwritten = pos < ts->start;
+    pthread_mutex_unlock(&ts->lock);
+    return overwritten ? -1 : (ssize_t)len;
+}
+
+void timeshift_window(Timeshift *ts, uint64_t *start, uint64_t *end) {
+    pthread_mutex_lock(&ts->lock);
+    *start = ts->start;
+    *end = ts->end;
+    pthread_mutex_unlock(&ts->lock);
+}
+
+int timeshift_seek(Timeshift *ts, double seconds, uint64_t *pos) {
+    pthread_mutex_lock(&ts->lock);
+    if (ts->seg_count == 0) {
+        pthread_mutex_unlock(&ts->lock);
+        return 0;
+    }
+    const TimeshiftSegment *newest = &ts->segs[(ts->seg_first + ts->seg_count - 1) % ts->seg_cap];
+    uint64_t back = seconds > 0 ? (uint64_t)(seconds * 90000) : 0;
+    uint64_t target = newest->ticks > back ? newest->ticks - back : 0;
+
+    // First segment at or after the target time
+    int lo = 0, hi = ts->seg_count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ts->segs[(ts->seg_first + mid) % ts->seg_cap].ticks < target) lo = mid + 1;
+        else hi = mid;
+    }
+    *pos = ts->segs[(ts->seg_first + lo) % ts->seg_cap].pos;
+    pthread_mutex_unlock(&ts->lock);
+    return 1;
+}
@@ -0,0 +1,286 @@
+/**
+ * @file ts_health.c
+ * @brief Inline transport stream health analysis for live relays
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ts_health.h"
+#include "json_buf.h"
+
+#define NULL_PID 0x1FFF
+#define PCR_HZ 27000000.0
+#define PCR_WRAP ((1ULL << 33) * 300)     /* 33-bit base * 300 + extension */
+#define PCR_MAX_GAP (27000000ULL)          /* > 1 s between PCRs: treat as a restart */
+#define EWMA_SHIFT 16.0                    /* Smoothing for bitrate and jitter */
+
+static TsHealth *sessions = NULL;
+static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+TsHealth *ts_health_open(const char *channel, int tuner_id, int tuner_index,
+                         const char *client, MetricsStream *metrics) {
+    TsHealth *h = calloc(1, sizeof(TsHealth));
+    if (!h) return NULL;
+    snprintf(h->channel, sizeof(h->channel), "%s", channel);
+    snprintf(h->client, sizeof(h->client), "%s", client ? client : "");
+    h->tuner_id = tuner_id;
+    h->tuner_index = tuner_index;
+    h->started = time(NULL);
+    h->metrics = metrics;
+    memset(h->pid_slot, 0xFF, sizeof(h->pid_slot));
+    pthread_mutex_init(&h->lock, NULL);
+
+    pthread_mutex_lock(&sessions_mutex);
+    h->next = sessions;
+    sessions = h;
+    pthread_mutex_unlock(&sessions_mutex);
+    return h;
+}
+
+void ts_health_close(TsHealth *h) {
+    if (!h) return;
+    pthread_mutex_lock(&sessions_mutex);
+    for (TsHealth **pp = &sessions; *pp; pp = &(*pp)->next) {
+        if (*pp == h) {
+            *pp = h->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+    pthread_mutex_destroy(&h->lock);
+    free(h);
+}
+
+static TsPidHealth *pid_entry(TsHealth *h, int pid, int create) {
+    int slot = h->pid_slot[pid];
+    if (slot >= 0) return &h->pids[slot];
+    if (!create || h->pid_count == TS_HEALTH_MAX_PIDS) return NULL;
+
+    TsPidHealth *ph = &h->pids[h->pid_count];
+    memset(ph, 0, sizeof(*ph));
+    ph->pid = pid;
+    ph->last_cc = -1;
+    h->pid_slot[pid] = h->pid_count++;
+    return ph;
+}
+
+// Bitrate from the bytes between consecutive PCRs; jitter is how far each
+// PCR lands from where the smoothed rate predicts
+static void pcr_seen(TsPidHealth *ph, uint64_t pcr, uint64_t packet, int discontinuity) {
+    if (ph->pcr_count > 0 && !discontinuity) {
+        uint64_t dpcr = (pcr + PCR_WRAP - ph->last_pcr) % PCR_WRAP;
+        uint64_t dpkt = packet - ph->last_pcr_packet;
+        if (dpcr > 0 && dpcr < PCR_MAX_GAP && dpkt > 0) {
+            double bits = dpkt * TS_PACKET_SIZE * 8.0;
+            double rate = bits * PCR_HZ / dpcr;
+            if (ph->bitrate_bps > 0) {
+                double err_us = (dpcr - bits / ph->bitrate_bps * PCR_HZ) / 27.0;
+                if (err_us < 0) err_us = -err_us;
+                ph->jitter_avg_us += (err_us - ph->jitter_avg_us) / EWMA_SHIFT;
+                if (err_us > ph->jitter_max_us) ph->jitter_max_us = err_us;
+                ph->bitrate_bps += (rate - ph->bitrate_bps) / EWMA_SHIFT;
+            } else {
+                ph->bitrate_bps = rate;
+            }
+        }
+    }
+    ph->pcr_count++;
+    ph->last_pcr = pcr;
+    ph->last_pcr_packet = packet;
+}
+
+// Note PMT PIDs from a PAT that starts in this packet (a PAT always fits
+// one packet in practice; anything longer is ignored)
+static void health_pat(TsHealth *h, const unsigned char *payload, int len) {
+    int pointer = payload[0];
+    if (1 + pointer + 8 > len) return;
+    const unsigned char *sec = payload + 1 + pointer;
+    if (sec[0] != 0x00) return;
+    int sec_len = ((sec[1] & 0x0F) << 8) | sec[2];
+    int end = 3 + sec_len - 4;    /* Stop before the CRC */
+    if (1 + pointer + 3 + sec_len > len) return;
+
+    for (int i = 8; i + 4 <= end; i += 4) {
+        int program = (sec[i] << 8) | sec[i + 1];
+        int pid = ((sec[i + 2] & 0x1F) << 8) | sec[i + 3];
+        if (program != 0) h->pmt_pid[pid >> 3] |= 1 << (pid & 7);
+    }
+    h->pat_seen = 1;
+}
+
+static void health_packet(TsHealth *h, const unsigned char *p) {
+    uint64_t index = h->packets++;
+    int pid = ((p[1] & 0x1F) << 8) | p[2];
+    if (pid == NULL_PID) {
+        h->null_packets++;
+        return;
+    }
+
+    // TEI: the header itself may be corrupt, so never let it create a PID
+    // entry or touch continuity state
+    if (p[1] & 0x80) {
+        h->tei_packets++;
+        TsPidHealth *ph = pid_entry(h, pid, 0);
+        if (ph) ph->tei_packets++;
+        return;
+    }
+
+    TsPidHealth *ph = pid_entry(h, pid, 1);
+    if (!ph) {
+        h->untracked_packets++;
+        return;
+    }
+    ph->packets++;
+
+    int afc = (p[3] >> 4) & 0x3;
+    int cc = p[3] & 0x0F;
+    int discontinuity = 0;
+    if ((afc & 0x2) && p[4] > 0) {
+        int flags = p[5];
+        discontinuity = flags & 0x80;
+        if ((flags & 0x10) && p[4] >= 7) {
+            uint64_t base = ((uint64_t)p[6] << 25) | ((uint64_t)p[7] << 17) |
+                            ((uint64_t)p[8] << 9) | ((uint64_t)p[9] << 1) | (p[10] >> 7);
+            uint64_t ext = ((uint64_t)(p[10] & 0x01) << 8) | p[11];
+            pcr_seen(ph, base * 300 + ext, index, discontinuity);
+        }
+    }
+
+    // Startup tracing: first PAT, then the first PMT it points to
+    if ((afc & 0x1) && (p[1] & 0x40) && !h->pmt_seen) {
+        int offset = 4 + ((afc & 0x2) ? 1 + p[4] : 0);
+        if (offset < TS_PACKET_SIZE) {
+            if (pid == 0) {
+                health_pat(h, p + offset, TS_PACKET_SIZE - offset);
+            } else if (h->pat_seen && (h->pmt_pid[pid >> 3] & (1 << (pid & 7)))) {
+                int pointer = p[offset];
+                if (offset + 1 + pointer < TS_PACKET_SIZE && p[offset + 1 + pointer] == 0x02) h->pmt_seen = 1;
+            }
+        }
+    }
+
+    // CC advances only on payload packets; one duplicate is legal
+    if (afc & 0x1) {
+        if (ph->last_cc >= 0 && !discontinuity && cc != ph->last_cc &&
+            cc != ((ph->last_cc + 1) & 0x0F)) {
+            ph->cc_errors++;
+            h->cc_errors++;
+        }
+        ph->last_cc = cc;
+    }
+}
+
+void ts_health_feed(TsHealth *h, const unsigned char *buf, size_t len) {
+    if (!h || len == 0) return;
+
+    pthread_mutex_lock(&h->lock);
+    uint64_t cc_before = h->cc_errors;
+    uint64_t tei_before = h->tei_packets;
+    h->bytes += len;
+
+    // Finish a packet that straddled the previous chunk
+    if (h->carry_len > 0) {
+        size_t need = TS_PACKET_SIZE - h->carry_len;
+        if (len < need) {
+            memcpy(h->carry + h->carry_len, buf, len);
+            h->carry_len += len;
+            len = 0;
+        } else {
+            memcpy(h->carry + h->carry_len, buf, need);
+            buf += need;
+            len -= need;
+            h->carry_len = 0;
+            health_packet(h, h->carry);
+        }
+    }
+
+    while (len >= TS_PACKET_SIZE) {
+        if (buf[0] != 0x47) {
+            h->sync_losses++;
+            const unsigned char *sync = memchr(buf + 1, 0x47, len - 1);
+            if (!sync) {
+                len = 0;
+                break;
+            }
+            len -= sync - buf;
+            buf = sync;
+            continue;
+        }
+        health_packet(h, buf);
+        buf += TS_PACKET_SIZE;
+        len -= TS_PACKET_SIZE;
+    }
+
+    if (len > 0) {
+        const unsigned char *sync = buf[0] == 0x47 ? buf : memchr(buf, 0x47, len);
+        if (sync != buf) h->sync_losses++;
+        if (sync) {
+            h->carry_len = len - (sync - buf);
+            memcpy(h->carry, sync, h->carry_len);
+        }
+    }
+
+    uint64_t cc_new = h->cc_errors - cc_before;
+    uint64_t tei_new = h->tei_packets - tei_before;
+    pthread_mutex_unlock(&h->lock);
+
+    if (cc_new || tei_new) metrics_stream_errors(h->metrics, h->tuner_index, cc_new, tei_new);
+}
+
+static void session_json(JsonBuf *jb, TsHealth *h, time_t now) {
+    pthread_mutex_lock(&h->lock);
+
+    // The mux rate is best measured on the busiest PCR PID
+    const TsPidHealth *pcr_pid = NULL;
+    for (int i = 0; i < h->pid_count; i++) {
+        if (h->pids[i].pcr_count > 1 && (!pcr_pid || h->pids[i].pcr_count > pcr_pid->pcr_count)) {
+            pcr_pid = &h->pids[i];
+        }
+    }
+
+    json_printf(jb, "    {\"channel\": ");
+    json_string(jb, h->channel);
+    json_printf(jb, ", \"client\": ");
+    json_string(jb, h->client);
+    json_printf(jb, ", \"tuner\": %d, \"uptime_s\": %ld,\n", h->tuner_id, (long)(now - h->started));
+    json_printf(jb, "     \"bytes\": %llu, \"packets\": %llu, \"null_share\": %.4f, \"bitrate_bps\": %.0f,\n",
+                (unsigned long long)h->bytes, (unsigned long long)h->packets,
+                h->packets ? (double)h->null_packets / h->packets : 0.0,
+                pcr_pid ? pcr_pid->bitrate_bps : 0.0);
+    json_printf(jb, "     \"cc_errors\": %llu, \"tei_packets\": %llu, \"sync_losses\": %llu, \"untracked_packets\": %llu,\n",
+                (unsigned long long)h->cc_errors, (unsigned long long)h->tei_packets,
+                (unsigned long long)h->sync_losses, (unsigned long long)h->untracked_packets);
+    json_printf(jb, "     \"pids\": [");
+    for (int i = 0; i < h->pid_count; i++) {
+        const TsPidHealth *ph = &h->pids[i];
+        json_printf(jb, "%s\n       {\"pid\": %u, \"packets\": %llu, \"cc_errors\": %llu, \"tei_packets\": %llu",
+                    i ? "," : "", ph->pid, (unsigned long long)ph->packets,
+                    (unsigned long long)ph->cc_errors, (unsigned long long)ph->tei_packets);
+        if (ph->pcr_count > 0) {
+            json_printf(jb, ", \"pcr\": {\"count\": %llu, \"bitrate_bps\": %.0f, \"jitter_avg_us\": %.2f, \"jitter_max_us\": %.2f}",
+                        (unsigned long long)ph->pcr_count, ph->bitrate_bps, ph->jitter_avg_us, ph->jitter_max_us);
+        }
+        json_printf(jb, "}");
+    }
+    json_printf(jb, "]}");
+
+    pthread_mutex_unlock(&h->lock);
+}
+
+char *ts_health_status_json(void) {
+    JsonBuf jb;
+    if (!json_buf_init(&jb, 8192)) return NULL;
+
+    time_t now = time(NULL);
+    json_printf(&jb, "{\n  \"sessions\": [\n");
+    pthread_mutex_lock(&sessions_mutex);
+    for (TsHealth *h = sessions; h; h = h->next) {
+        session_json(&jb, h, now);
+        json_printf(&jb, "%s\n", h->next ? "," : "");
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+    json_printf(&jb, "  ]\n}\n");
+    return json_buf_finish(&jb);
+}
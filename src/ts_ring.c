@@ -0,0 +1,103 @@
+/**
+ * @file ts_ring.c
+ * @brief Lock-free SPSC ring of TS batches
+ */
+
+#include <sched.h>
+#include "ts_ring.h"
+
+#define TS_RING_SPIN 64   /* Yields before the consumer sleeps */
+
+void ts_ring_init(TsRing *r) {
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->closed, 0);
+    atomic_init(&r->sleeping, 0);
+    atomic_init(&r->producer_sleeping, 0);
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake, NULL);
+    pthread_cond_init(&r->space, NULL);
+}
+
+void ts_ring_destroy(TsRing *r) {
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->wake);
+    pthread_cond_destroy(&r->space);
+}
+
+TsBatch *ts_ring_reserve(TsRing *r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail == TS_RING_SLOTS) return NULL;
+    return &r->slots[head & (TS_RING_SLOTS - 1)];
+}
+
+TsBatch *ts_ring_reserve_wait(TsRing *r) {
+    TsBatch *b = ts_ring_reserve(r);
+    if (b) return b;
+
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    pthread_mutex_lock(&r->lock);
+    atomic_store(&r->producer_sleeping, 1);
+    while (head - atomic_load(&r->tail) == TS_RING_SLOTS) {
+        pthread_cond_wait(&r->space, &r->lock);
+    }
+    atomic_store(&r->producer_sleeping, 0);
+    pthread_mutex_unlock(&r->lock);
+    return &r->slots[head & (TS_RING_SLOTS - 1)];
+}
+
+static void ts_ring_wake(TsRing *r) {
+    // Pairs with the sleeping store in ts_ring_next(): either we see the
+    // consumer asleep, or it sees our new head before it waits
+    if (atomic_load(&r->sleeping)) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_signal(&r->wake);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+void ts_ring_publish(TsRing *r) {
+    atomic_fetch_add(&r->head, 1);
+    ts_ring_wake(r);
+}
+
+void ts_ring_close(TsRing *r) {
+    atomic_store(&r->closed, 1);
+    ts_ring_wake(r);
+}
+
+TsBatch *ts_ring_next(TsRing *r) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    for (;;) {
+        // Poll briefly before sleeping: under load the next batch is
+        // usually moments away and a futex round trip costs more
+        for (int spin = 0; spin < TS_RING_SPIN; spin++) {
+            if (atomic_load(&r->head) != tail) return &r->slots[tail & (TS_RING_SLOTS - 1)];
+            sched_yield();
+        }
+        if (atomic_load(&r->closed)) {
+            // Recheck: the last publish may have raced with close
+            if (atomic_load(&r->head) != tail) continue;
+            return NULL;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        atomic_store(&r->sleeping, 1);
+        while (atomic_load(&r->head) == tail && !atomic_load(&r->closed)) {
+            pthread_cond_wait(&r->wake, &r->lock);
+        }
+        atomic_store(&r->sleeping, 0);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+void ts_ring_release(TsRing *r) {
+    atomic_fetch_add(&r->tail, 1);
+    // Same handshake as ts_ring_wake(), with the producer waiting for space
+    if (atomic_load(&r->producer_sleeping)) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_signal(&r->space);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
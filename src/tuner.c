@@ -7,6 +7,7 @@
  * - Discovery: Scans /dev/dvb/adapter* for available tuners
  * - Acquisition: Thread-safe tuner locking with round-robin selection
  * - Preemption: Stream requests can preempt background EPG scans
+ * - Lingering: Idle stream captures stay tuned until reclaimed (capture.h)
  * - Cleanup: Graceful process termination (SIGTERM then SIGKILL)
  * 
  * Thread safety: All acquisition/release operations are protected
@@ -26,6 +27,7 @@
 #include "tuner.h"
 #include "config.h"
 #include "log.h"
+#include "metrics.h"
 
 /* Global tuner state */
 Tuner tuners[MAX_TUNERS];
@@ -95,7 +97,7 @@ static void terminate_process(pid_t pid) {
     waitpid(pid, &status, 0); // Reap the zombie
 }
 
-Tuner *acquire_tuner(TunerUser purpose) {
+Tuner *acquire_tuner(TunerUser purpose, unsigned *generation) {
     pthread_mutex_lock(&tuner_mutex);
     
     if (tuner_count == 0) {
@@ -109,13 +111,35 @@ Tuner *acquire_tuner(TunerUser purpose) {
         if (!tuners[idx].in_use) {
             tuners[idx].in_use = 1;
             tuners[idx].user_type = purpose;
+            tuners[idx].generation++;
+            if (generation) *generation = tuners[idx].generation;
             last_tuner_index = idx;
             pthread_mutex_unlock(&tuner_mutex);
             return &tuners[idx];
         }
     }
 
-    // 2. If it's a STREAM request, look for an EPG tuner to preempt
+    // 2. Reclaim a tuner kept warm after its viewers left; its capture
+    // sees EOF and, finding the generation changed, leaves the tuner alone
+    for (int i = 0; i < tuner_count; i++) {
+        int idx = (last_tuner_index + 1 + i) % tuner_count;
+        if (tuners[idx].user_type == USER_LINGER) {
+            LOG_DEBUG("TUNER", "Reclaiming lingering Tuner %d", tuners[idx].id);
+            if (tuners[idx].zap_pid > 0) {
+                terminate_process(tuners[idx].zap_pid);
+                tuners[idx].zap_pid = 0;
+            }
+            tuners[idx].user_type = purpose;
+            tuners[idx].generation++;
+            if (generation) *generation = tuners[idx].generation;
+            last_tuner_index = idx;
+            metrics_add(METRIC_TUNER_LINGER_RECLAIMS, 1);
+            pthread_mutex_unlock(&tuner_mutex);
+            return &tuners[idx];
+        }
+    }
+
+    // 3. If it's a STREAM request, look for an EPG tuner to preempt
     if (purpose == USER_STREAM) {
         for (int i = 0; i < tuner_count; i++) {
             int idx = (last_tuner_index + 1 + i) % tuner_count;
@@ -131,7 +155,10 @@ Tuner *acquire_tuner(TunerUser purpose) {
                 
                 // Keep in_use=1 but change type
                 tuners[idx].user_type = USER_STREAM;
+                tuners[idx].generation++;
+                if (generation) *generation = tuners[idx].generation;
                 last_tuner_index = idx;
+                metrics_add(METRIC_TUNER_PREEMPTIONS, 1);
                 
                 pthread_mutex_unlock(&tuner_mutex);
                 return &tuners[idx];
@@ -143,19 +170,45 @@ Tuner *acquire_tuner(TunerUser purpose) {
     return NULL;
 }
 
-void release_tuner(Tuner *t) {
-    if (!t) return;
-    
+int release_tuner_if(Tuner *t, unsigned generation) {
+    if (!t) return 0;
     pthread_mutex_lock(&tuner_mutex);
-    
-    // Terminate child processes and wait to prevent zombies
-    if (t->zap_pid > 0) {
-        terminate_process(t->zap_pid);
-        t->zap_pid = 0;
+    int ours = t->generation == generation;
+    if (ours) {
+        // Terminate child processes and wait to prevent zombies
+        if (t->zap_pid > 0) {
+            terminate_process(t->zap_pid);
+            t->zap_pid = 0;
+        }
+        t->in_use = 0;
+        t->user_type = USER_NONE;
+    }
+    pthread_mutex_unlock(&tuner_mutex);
+    return ours;
+}
+
+int tuner_linger(Tuner *t, unsigned generation, int linger) {
+    pthread_mutex_lock(&tuner_mutex);
+    int ours = t->generation == generation && t->in_use;
+    if (ours) t->user_type = linger ? USER_LINGER : USER_STREAM;
+    pthread_mutex_unlock(&tuner_mutex);
+    return ours;
+}
+
+int tuner_set_zap(Tuner *t, unsigned generation, pid_t pid) {
+    pthread_mutex_lock(&tuner_mutex);
+    int ours = t->generation == generation;
+    if (ours) t->zap_pid = pid;
+    pthread_mutex_unlock(&tuner_mutex);
+    return ours;
+}
+
+int tuner_count_by_user(TunerUser user) {
+    int n = 0;
+    pthread_mutex_lock(&tuner_mutex);
+    for (int i = 0; i < tuner_count; i++) {
+        if (tuners[i].user_type == user) n++;
     }
-    
-    t->in_use = 0;
-    t->user_type = USER_NONE;
-    
     pthread_mutex_unlock(&tuner_mutex);
+    return n;
 }
@@ -8,6 +8,11 @@ VERSION = 1
 TREES_PER_SET = 128
 NODES_PER_TREE = 256 # Maximum nodes in a 7-bit ASCII tree
 
+# Fast-lookup configuration (must match HUFFMAN_LUT_* in include/huffman.h)
+LUT_BITS = 8
+LUT_LEAF = 0x1
+LUT_CONT = 0x2
+
 def generate_placeholder_bin(filename):
     """Generates a skeleton huffman.bin with identity mapping (uncompressed = compressed)"""
     print(f"Generating placeholder {filename}...")
@@ -42,5 +47,89 @@ def generate_placeholder_bin(filename):
 
     print("Success. Note: This is an empty placeholder for testing the loader.")
 
+def load_bin(filename):
+    """Reads a huffman.bin; returns (nodes_per_tree, title_nodes, desc_nodes) or None"""
+    try:
+        with open(filename, "rb") as f:
+            data = f.read()
+    except OSError:
+        return None
+    if len(data) < 20:
+        return None
+    magic, version, title_offset, desc_offset, npt = struct.unpack_from("<4sIIII", data, 0)
+    if magic != MAGIC or version != VERSION or npt == 0:
+        return None
+    count = TREES_PER_SET * npt
+    if title_offset + count * 4 > len(data) or desc_offset + count * 4 > len(data):
+        return None
+    title = list(struct.iter_unpack("<hh", data[title_offset:title_offset + count * 4]))
+    desc = list(struct.iter_unpack("<hh", data[desc_offset:desc_offset + count * 4]))
+    return npt, title, desc
+
+def has_trees(nodes, npt):
+    """True if any tree's root points somewhere; the placeholder is all (-1, -1)"""
+    return any(nodes[ctx * npt] != (-1, -1) for ctx in range(TREES_PER_SET))
+
+def build_lut(nodes, npt):
+    """Mirrors the decoder: resolve every LUT_BITS prefix in every context"""
+    lut = []
+    for ctx in range(TREES_PER_SET):
+        base = ctx * npt
+        for pattern in range(1 << LUT_BITS):
+            node, bits = 0, 0
+            while 0 <= node < npt and bits < LUT_BITS:
+                bit = (pattern >> (LUT_BITS - 1 - bits)) & 1
+                node = nodes[base + node][bit]
+                bits += 1
+            if node < 0:
+                lut.append((-(node + 1), bits, LUT_LEAF))
+            elif node < npt and node != 0:
+                lut.append((node, LUT_BITS, LUT_CONT))
+            else:
+                lut.append((0, 0, 0))
+    return lut
+
+def write_array(f, ctype, name, rows, fmt):
+    f.write(f"const {ctype} {name}[{len(rows)}] = {{\n")
+    for i in range(0, len(rows), 8):
+        f.write("    " + " ".join(fmt % r + "," for r in rows[i:i + 8]) + "\n")
+    f.write("};\n\n")
+
+def generate_c_source(filename, source_bin):
+    """Emits the A/65 decode trees and fast-lookup tables as static const data"""
+    tables = load_bin(source_bin) if source_bin else None
+    valid = tables is not None
+    if valid:
+        npt, title, desc = tables
+        valid = has_trees(title, npt) or has_trees(desc, npt)
+        if valid:
+            print(f"Generating {filename} from {source_bin} ({npt} nodes per tree)...")
+        else:
+            print(f"warning: {source_bin} holds no decode trees (placeholder?); "
+                  f"Huffman-coded text will not be decoded", file=sys.stderr)
+    if not valid:
+        # No usable source tables: empty trees, decoder reports them unavailable
+        npt = NODES_PER_TREE
+        title = [(-1, -1)] * (TREES_PER_SET * npt)
+        desc = list(title)
+        print(f"Generating placeholder {filename} (no valid huffman.bin)...")
+
+    os.makedirs(os.path.dirname(filename) or ".", exist_ok=True)
+    with open(filename, "w") as f:
+        f.write("/* Generated by support/gen_huffman.py - do not edit */\n\n")
+        f.write("#include \"huffman.h\"\n\n")
+        f.write(f"const int huffman_tables_valid = {1 if valid else 0};\n")
+        f.write(f"const int huffman_nodes_per_tree = {npt};\n\n")
+        # HuffmanNode wraps an int16_t[2], hence the nested braces
+        write_array(f, "HuffmanNode", "huffman_title_trees", title, "{{%d,%d}}")
+        write_array(f, "HuffmanNode", "huffman_desc_trees", desc, "{{%d,%d}}")
+        write_array(f, "HuffmanLutEntry", "huffman_title_lut", build_lut(title, npt), "{%d,%d,%d}")
+        write_array(f, "HuffmanLutEntry", "huffman_desc_lut", build_lut(desc, npt), "{%d,%d,%d}")
+
 if __name__ == "__main__":
-    generate_placeholder_bin("huffman.bin")
+    # gen_huffman.py                         -> placeholder huffman.bin
+    # gen_huffman.py --c out.c [source.bin]  -> compiled-in tables
+    if len(sys.argv) >= 3 and sys.argv[1] == "--c":
+        generate_c_source(sys.argv[2], sys.argv[3] if len(sys.argv) > 3 else None)
+    else:
+        generate_placeholder_bin("huffman.bin")
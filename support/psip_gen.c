@@ -0,0 +1,794 @@
+/**
+ * @file psip_gen.c
+ * @brief Synthetic ATSC PSIP transport stream generator
+ *
+ * Emits valid MPEG-TS carrying MGT, TVCT and EIT/ETT instances with a
+ * configurable channel count, event density and guide depth, for load
+ * and scale testing without an antenna. Output replays through
+ * epg_replay (or anything that reads a capture).
+ *
+ * Usage: psip_gen [options] -o <file.ts|dir>
+ *
+ * Channels come from an existing channels.conf (-c, one stream per
+ * frequency) or are synthesized (-n per mux, -m muxes); -C writes the
+ * synthesized lineup in channels.conf format so the server and
+ * epg_replay map the events. Text is plain or Huffman-coded with the
+ * tables compiled into the project (-H), in one or more languages.
+ * Each section starts a TS packet of its own unless -P packs them
+ * back-to-back, several to a packet, as broadcasters do; readers then
+ * have to follow pointer_field. CRC, continuity and TEI errors can be
+ * injected at given rates.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "log.h"
+#include "channels.h"
+#include "huffman.h"
+#include "crc32.h"
+
+int g_verbose = 0;
+
+#define TS_PACKET_SIZE 188
+#define PSIP_BASE_PID 0x1FFB
+#define EIT_PID_BASE 0x1D00     /* EIT-k on EIT_PID_BASE + k */
+#define ETT_PID_BASE 0x1E00     /* ETT-k on ETT_PID_BASE + k */
+#define MAX_SECTION 4096
+#define VCT_MAX_SECTION 1024
+#define GPS_EPOCH_OFFSET 315964800LL
+#define GPS_LEAP_SECONDS 18
+#define BLOCK_SECONDS (3 * 3600)
+#define MAX_LANGS 4
+
+/** One channel in a generated mux */
+typedef struct {
+    char name[64];
+    int major;
+    int minor;
+    int source_id;      /* Also the channels.conf SERVICE_ID */
+} GenChannel;
+
+/** A finished section waiting to be packetized */
+typedef struct {
+    int pid;
+    int len;
+    unsigned char data[MAX_SECTION];
+} GenSection;
+
+typedef struct {
+    long packets;
+    long sections;
+    long events;
+    long huffman_strings;
+    long plain_strings;
+    long crc_errors;
+    long cc_errors;
+    long tei_errors;
+} GenStats;
+
+/* Options */
+static int opt_channels = 4;
+static int opt_muxes = 1;
+static int opt_events = 8;          /* Events per channel per EIT instance */
+static int opt_depth = EPG_GUIDE_DEPTH;
+static int opt_cycles = 3;
+static int opt_desc_len = 200;
+static int opt_huffman = 0;
+static int opt_pack = 0;
+static double opt_crc_rate = 0;
+static double opt_cc_rate = 0;
+static double opt_tei_rate = 0;
+static unsigned opt_seed = 1;
+static long long opt_time_base = 0;
+static char opt_langs[MAX_LANGS][4] = { "eng" };
+static int opt_lang_count = 1;
+
+static GenStats stats;
+static unsigned rng;
+static uint8_t cc_state[8192];
+/* Packet being filled on each PID; open_fill is 0 when none is open */
+static unsigned char open_pkt[8192][TS_PACKET_SIZE];
+static int open_fill[8192];
+
+// -----------------------------------------------------------------------------
+// CRC / packetization
+// -----------------------------------------------------------------------------
+
+static int chance(double rate) {
+    return rate > 0 && (double)rand_r(&rng) / RAND_MAX < rate;
+}
+
+// Number, error-inject and write one finished packet
+static void write_packet(FILE *out, unsigned char *p) {
+    int pid = ((p[1] & 0x1F) << 8) | p[2];
+    if (chance(opt_cc_rate)) {
+        cc_state[pid] = (cc_state[pid] + 1) & 0x0F;
+        stats.cc_errors++;
+    }
+    p[3] = 0x10 | cc_state[pid];
+    cc_state[pid] = (cc_state[pid] + 1) & 0x0F;
+
+    if (chance(opt_tei_rate)) {
+        p[1] |= 0x80;
+        stats.tei_errors++;
+    }
+    fwrite(p, 1, TS_PACKET_SIZE, out);
+    stats.packets++;
+}
+
+static void packet_open(int pid, int pusi) {
+    unsigned char *p = open_pkt[pid];
+    p[0] = 0x47;
+    p[1] = (pusi ? 0x40 : 0) | (pid >> 8);
+    p[2] = pid & 0xFF;
+    p[3] = 0;
+    open_fill[pid] = 4;
+    if (pusi) p[open_fill[pid]++] = 0;  // pointer_field
+}
+
+// Stuff the rest of a PID's open packet and write it
+static void packet_flush(FILE *out, int pid) {
+    if (!open_fill[pid]) return;
+    memset(open_pkt[pid] + open_fill[pid], 0xFF, TS_PACKET_SIZE - open_fill[pid]);
+    write_packet(out, open_pkt[pid]);
+    open_fill[pid] = 0;
+}
+
+static void packet_flush_all(FILE *out) {
+    for (int pid = 0; pid < 8192; pid++) packet_flush(out, pid);
+}
+
+// Split one section across TS packets. The section starts a packet of
+// its own, or with -P follows the previous section on its PID.
+static void emit_section(FILE *out, GenSection *s) {
+    if (chance(opt_crc_rate)) {
+        s->data[3 + rand_r(&rng) % (s->len - 7)] ^= 0x5A;
+        stats.crc_errors++;
+    }
+
+    int pid = s->pid;
+    unsigned char *p = open_pkt[pid];
+    // Starting here needs a byte of room, plus a pointer_field if the
+    // packet so far only holds the tail of the previous section
+    if (open_fill[pid] && open_fill[pid] + ((p[1] & 0x40) ? 1 : 2) > TS_PACKET_SIZE) {
+        packet_flush(out, pid);
+    }
+    if (!open_fill[pid]) {
+        packet_open(pid, 1);
+    } else if (!(p[1] & 0x40)) {
+        // pointer_field goes in front of the tail and skips it
+        memmove(p + 5, p + 4, open_fill[pid] - 4);
+        p[4] = open_fill[pid] - 4;
+        p[1] |= 0x40;
+        open_fill[pid]++;
+    }
+
+    int pos = 0;
+    while (pos < s->len) {
+        if (open_fill[pid] == TS_PACKET_SIZE) {
+            packet_flush(out, pid);
+            packet_open(pid, 0);
+        }
+        int n = s->len - pos;
+        if (n > TS_PACKET_SIZE - open_fill[pid]) n = TS_PACKET_SIZE - open_fill[pid];
+        memcpy(p + open_fill[pid], s->data + pos, n);
+        open_fill[pid] += n;
+        pos += n;
+    }
+    if (!opt_pack || open_fill[pid] == TS_PACKET_SIZE) packet_flush(out, pid);
+    stats.sections++;
+}
+
+// Long-form section header; section_length and CRC are set by section_finish
+static int section_begin(GenSection *s, int pid, int table_id, int ext, int section_number) {
+    s->pid = pid;
+    s->data[0] = table_id;
+    s->data[3] = ext >> 8;
+    s->data[4] = ext & 0xFF;
+    s->data[5] = 0xC1;              // version 0, current_next 1
+    s->data[6] = section_number;
+    s->data[7] = section_number;    // last_section_number, patched later
+    s->data[8] = 0;                 // protocol_version
+    return 9;
+}
+
+static void section_finish(GenSection *s, int len, int last_section_number) {
+    int section_length = len - 3 + 4;
+    s->data[1] = 0xF0 | (section_length >> 8);
+    s->data[2] = section_length & 0xFF;
+    s->data[7] = last_section_number;
+    uint32_t crc = crc32_mpeg(s->data, len);
+    s->data[len] = crc >> 24;
+    s->data[len + 1] = crc >> 16;
+    s->data[len + 2] = crc >> 8;
+    s->data[len + 3] = crc;
+    s->len = len + 4;
+}
+
+// -----------------------------------------------------------------------------
+// Multiple String Structure (A/65 6.10) with optional Huffman coding
+// -----------------------------------------------------------------------------
+
+typedef struct {
+    uint64_t bits;
+    uint8_t len;    /* 0 = symbol not reachable */
+} HuffCode;
+
+#define HUFF_MAX_CODE 64
+
+static HuffCode huff_codes[2][128][256];
+static int huff_ready = 0;
+
+// Walk every tree once, recording the shortest code for each symbol
+static void huff_build_codes(void) {
+    struct { int node; uint64_t bits; int len; } stack[512];
+    unsigned char *seen = malloc(huffman_nodes_per_tree);
+    if (!seen) return;
+    for (int type = 0; type < 2; type++) {
+        const HuffmanNode *set = type == 0 ? huffman_title_trees : huffman_desc_trees;
+        for (int ctx = 0; ctx < 128; ctx++) {
+            const HuffmanNode *tree = set + ctx * huffman_nodes_per_tree;
+            memset(seen, 0, huffman_nodes_per_tree);
+            seen[0] = 1;
+            int sp = 0;
+            stack[sp].node = 0;
+            stack[sp].bits = 0;
+            stack[sp].len = 0;
+            sp++;
+            while (sp > 0) {
+                sp--;
+                int node = stack[sp].node;
+                uint64_t bits = stack[sp].bits;
+                int len = stack[sp].len;
+                for (int b = 0; b < 2; b++) {
+                    int child = tree[node].children[b];
+                    uint64_t cbits = (bits << 1) | b;
+                    if (len + 1 > HUFF_MAX_CODE) continue;
+                    if (child < 0) {
+                        HuffCode *c = &huff_codes[type][ctx][(unsigned char)(-(child + 1))];
+                        if (c->len == 0 || len + 1 < c->len) {
+                            c->bits = cbits;
+                            c->len = len + 1;
+                        }
+                    } else if (child < huffman_nodes_per_tree && !seen[child] && sp < 512) {
+                        seen[child] = 1;  // Malformed tables must not loop
+                        stack[sp].node = child;
+                        stack[sp].bits = cbits;
+                        stack[sp].len = len + 1;
+                        sp++;
+                    }
+                }
+            }
+        }
+    }
+    free(seen);
+    huff_ready = 1;
+}
+
+// Encode text ending with the 0x00 terminator; -1 if a symbol has no code
+static int huff_encode(int compr_type, const char *text, int text_len, unsigned char *dest, int dest_len) {
+    if (!huff_ready) huff_build_codes();
+    int type = compr_type == 1 ? 0 : 1;
+    int bitpos = 0;
+    int prev = 0;
+    memset(dest, 0, dest_len);
+    for (int i = 0; i <= text_len; i++) {
+        int sym = i < text_len ? (unsigned char)text[i] : 0;
+        const HuffCode *c = &huff_codes[type][prev & 0x7F][sym];
+        if (c->len == 0 || bitpos + c->len > dest_len * 8) return -1;
+        for (int k = c->len - 1; k >= 0; k--, bitpos++) {
+            if ((c->bits >> k) & 1) dest[bitpos >> 3] |= 0x80 >> (bitpos & 7);
+        }
+        prev = sym;
+    }
+    return (bitpos + 7) / 8;
+}
+
+// Append one segment; text is split into 255-byte plain segments as needed
+static int mss_segments(unsigned char *p, int cap, int compr_type, const char *text, int *num_segments) {
+    int len = (int)strlen(text);
+    int pos = 0;
+    int n = 0;
+
+    if (opt_huffman && huffman_tables_valid) {
+        // Chunk so each compressed segment fits its 8-bit length
+        for (int off = 0; off < len; off += 160) {
+            int chunk = len - off < 160 ? len - off : 160;
+            unsigned char enc[255];
+            int elen = huff_encode(compr_type, text + off, chunk, enc, sizeof(enc));
+            if (elen < 0) {
+                pos = 0;
+                n = 0;
+                break;  // Fall back to plain for the whole string
+            }
+            if (pos + 3 + elen > cap) return -1;
+            p[pos++] = compr_type;
+            p[pos++] = 0;
+            p[pos++] = elen;
+            memcpy(p + pos, enc, elen);
+            pos += elen;
+            n++;
+        }
+        if (n > 0) {
+            stats.huffman_strings++;
+            *num_segments = n;
+            return pos;
+        }
+    }
+
+    for (int off = 0; off < len || n == 0; off += 255) {
+        int chunk = len - off < 255 ? len - off : 255;
+        if (pos + 3 + chunk > cap) return -1;
+        p[pos++] = 0x00;
+        p[pos++] = 0x00;
+        p[pos++] = chunk;
+        memcpy(p + pos, text + off, chunk);
+        pos += chunk;
+        n++;
+    }
+    stats.plain_strings++;
+    *num_segments = n;
+    return pos;
+}
+
+// Build an MSS with one string per configured language
+static int build_mss(unsigned char *p, int cap, int compr_type, const char *fmt_text, int limit) {
+    int pos = 0;
+    if (cap < 1) return -1;
+    p[pos++] = opt_lang_count;
+    for (int l = 0; l < opt_lang_count; l++) {
+        char text[1024];
+        snprintf(text, sizeof(text), "%s%s%s", fmt_text, l ? " / " : "", l ? opt_langs[l] : "");
+        if (limit > 0 && (int)strlen(text) > limit) text[limit] = '\0';
+        if (pos + 4 > cap) return -1;
+        memcpy(p + pos, opt_langs[l], 3);
+        int nseg_pos = pos + 3;
+        pos += 4;
+        int nseg = 0;
+        int n = mss_segments(p + pos, cap - pos, compr_type, text, &nseg);
+        if (n < 0) return -1;
+        p[nseg_pos] = nseg;
+        pos += n;
+    }
+    return pos;
+}
+
+// -----------------------------------------------------------------------------
+// Tables
+// -----------------------------------------------------------------------------
+
+static GenSection *sections;
+static int section_count;
+static int section_cap;
+
+static GenSection *new_section(void) {
+    if (section_count == section_cap) {
+        section_cap = section_cap ? section_cap * 2 : 256;
+        sections = realloc(sections, section_cap * sizeof(GenSection));
+        if (!sections) {
+            LOG_ERROR("GEN", "Out of memory");
+            exit(1);
+        }
+    }
+    return &sections[section_count++];
+}
+
+// Total bytes of sections [from, to) for the MGT number_bytes field
+static uint32_t table_bytes(int from, int to) {
+    uint32_t n = 0;
+    for (int i = from; i < to; i++) n += sections[i].len;
+    return n;
+}
+
+static void build_vct(const GenChannel *ch, int count, int tsid) {
+    int per_section = (VCT_MAX_SECTION - 10 - 2 - 4) / 32;
+    int nsec = (count + per_section - 1) / per_section;
+    if (nsec == 0) nsec = 1;
+    for (int sn = 0; sn < nsec; sn++) {
+        GenSection *s = new_section();
+        int pos = section_begin(s, PSIP_BASE_PID, 0xC8, tsid, sn);
+        int first = sn * per_section;
+        int n = count - first < per_section ? count - first : per_section;
+        s->data[pos++] = n;
+        for (int i = first; i < first + n; i++) {
+            unsigned char *c = s->data + pos;
+            memset(c, 0, 32);
+            for (int k = 0; k < 7 && ch[i].name[k]; k++) c[k * 2 + 1] = ch[i].name[k];  // UTF-16BE
+            c[14] = 0xF0 | (ch[i].major >> 6);
+            c[15] = ((ch[i].major & 0x3F) << 2) | (ch[i].minor >> 8);
+            c[16] = ch[i].minor & 0xFF;
+            c[17] = 0x04;                       // 8-VSB
+            c[22] = tsid >> 8;
+            c[23] = tsid & 0xFF;
+            c[24] = ch[i].source_id >> 8;       // program_number
+            c[25] = ch[i].source_id & 0xFF;
+            c[26] = 0x4D;                       // ETM in PTC, not hidden
+            c[27] = 0xC2;                       // ATSC digital television
+            c[28] = ch[i].source_id >> 8;
+            c[29] = ch[i].source_id & 0xFF;
+            c[30] = 0xFC;                       // No descriptors
+            c[31] = 0x00;
+            pos += 32;
+        }
+        s->data[pos++] = 0xFC;                  // additional_descriptors_length
+        s->data[pos++] = 0x00;
+        section_finish(s, pos, nsec - 1);
+    }
+}
+
+static int event_id_for(int instance, int e) {
+    return (instance * opt_events + e) & 0x3FFF;
+}
+
+static void build_eit(const GenChannel *ch, int instance, long long block_start) {
+    int eit_pid = EIT_PID_BASE + instance;
+    int duration = BLOCK_SECONDS / opt_events;
+    int first_section = section_count;
+    GenSection *s = NULL;
+    int pos = 0, count_pos = 0, sn = 0;
+
+    for (int e = 0; e < opt_events; e++) {
+        unsigned char ev[10 + 256 + 2];
+        long long start_unix = block_start + (long long)e * duration;
+        uint32_t gps = (uint32_t)(start_unix - GPS_EPOCH_OFFSET + GPS_LEAP_SECONDS);
+        int event_id = event_id_for(instance, e);
+
+        char title[128];
+        snprintf(title, sizeof(title), "%s Show %d.%d", ch->name, instance, e);
+        int tlen = build_mss(ev + 10, 255, 1, title, 0);
+        if (tlen < 0) tlen = 0;
+
+        ev[0] = 0xC0 | (event_id >> 8);
+        ev[1] = event_id & 0xFF;
+        ev[2] = gps >> 24;
+        ev[3] = gps >> 16;
+        ev[4] = gps >> 8;
+        ev[5] = gps;
+        ev[6] = 0xC0 | (1 << 4) | ((duration >> 16) & 0x0F);  // ETM in PTC
+        ev[7] = duration >> 8;
+        ev[8] = duration & 0xFF;
+        ev[9] = tlen;
+        ev[10 + tlen] = 0xF0;                   // No descriptors
+        ev[11 + tlen] = 0x00;
+        int elen = 12 + tlen;
+
+        if (s && pos + elen + 4 > MAX_SECTION) {
+            section_finish(s, pos, 0);
+            s = NULL;
+            sn++;
+        }
+        if (!s) {
+            s = new_section();
+            pos = section_begin(s, eit_pid, 0xCB, ch->source_id, sn);
+            count_pos = pos;
+            s->data[pos++] = 0;
+        }
+        memcpy(s->data + pos, ev, elen);
+        pos += elen;
+        s->data[count_pos]++;
+        stats.events++;
+    }
+    if (s) section_finish(s, pos, 0);
+
+    // Patch last_section_number now that the split is known
+    for (int i = first_section; i < section_count; i++) section_finish(&sections[i], sections[i].len - 4, sn);
+}
+
+static void build_ett(const GenChannel *ch, int instance) {
+    int ett_pid = ETT_PID_BASE + instance;
+    for (int e = 0; e < opt_events; e++) {
+        int event_id = event_id_for(instance, e);
+        char text[1024];
+        int n = snprintf(text, sizeof(text), "%s event %d.%d.", ch->name, instance, e);
+        while (n < opt_desc_len && n < (int)sizeof(text) - 64) {
+            n += snprintf(text + n, sizeof(text) - n, " Synthetic guide text for load testing.");
+        }
+
+        GenSection *s = new_section();
+        int pos = section_begin(s, ett_pid, 0xCC, ch->source_id, 0);
+        uint32_t etm_id = ((uint32_t)ch->source_id << 16) | ((uint32_t)event_id << 2) | 0x2;
+        s->data[pos++] = etm_id >> 24;
+        s->data[pos++] = etm_id >> 16;
+        s->data[pos++] = etm_id >> 8;
+        s->data[pos++] = etm_id;
+        int mlen = build_mss(s->data + pos, MAX_SECTION - pos - 4, 2, text, opt_desc_len);
+        if (mlen < 0) mlen = 0;
+        pos += mlen;
+        section_finish(s, pos, 0);
+    }
+}
+
+static void build_mgt(int vct_end, const int *eit_range, const int *ett_range) {
+    GenSection *s = new_section();
+    int pos = section_begin(s, PSIP_BASE_PID, 0xC7, 0, 0);
+    int tables = 1 + 2 * opt_depth;
+    s->data[pos++] = tables >> 8;
+    s->data[pos++] = tables & 0xFF;
+
+    for (int t = 0; t < tables; t++) {
+        int type, pid;
+        uint32_t bytes;
+        if (t == 0) {
+            type = 0x0000;
+            pid = PSIP_BASE_PID;
+            bytes = table_bytes(0, vct_end);
+        } else if (t <= opt_depth) {
+            type = 0x0100 + (t - 1);
+            pid = EIT_PID_BASE + (t - 1);
+            bytes = table_bytes(eit_range[(t - 1) * 2], eit_range[(t - 1) * 2 + 1]);
+        } else {
+            type = 0x0200 + (t - 1 - opt_depth);
+            pid = ETT_PID_BASE + (t - 1 - opt_depth);
+            bytes = table_bytes(ett_range[(t - 1 - opt_depth) * 2], ett_range[(t - 1 - opt_depth) * 2 + 1]);
+        }
+        unsigned char *e = s->data + pos;
+        e[0] = type >> 8;
+        e[1] = type & 0xFF;
+        e[2] = 0xE0 | (pid >> 8);
+        e[3] = pid & 0xFF;
+        e[4] = 0xE0;                        // table_type_version 0
+        e[5] = bytes >> 24;
+        e[6] = bytes >> 16;
+        e[7] = bytes >> 8;
+        e[8] = bytes;
+        e[9] = 0xF0;                        // No descriptors
+        e[10] = 0x00;
+        pos += 11;
+    }
+    s->data[pos++] = 0xF0;                  // descriptors_length
+    s->data[pos++] = 0x00;
+    section_finish(s, pos, 0);
+}
+
+// Build every table for one mux and write opt_cycles repetitions
+static int generate_mux(const char *path, const GenChannel *ch, int count, int tsid, long long time_base) {
+    FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (!out) {
+        LOG_ERROR("GEN", "Cannot write %s", path);
+        return -1;
+    }
+
+    section_count = 0;
+    memset(cc_state, 0, sizeof(cc_state));
+    long events_before = stats.events;
+
+    build_vct(ch, count, tsid);
+    int vct_end = section_count;
+
+    int *eit_range = malloc(opt_depth * 2 * sizeof(int));
+    int *ett_range = malloc(opt_depth * 2 * sizeof(int));
+    if (!eit_range || !ett_range) {
+        LOG_ERROR("GEN", "Out of memory");
+        exit(1);
+    }
+    for (int k = 0; k < opt_depth; k++) {
+        eit_range[k * 2] = section_count;
+        for (int c = 0; c < count; c++) build_eit(&ch[c], k, time_base + (long long)k * BLOCK_SECONDS);
+        eit_range[k * 2 + 1] = section_count;
+    }
+    for (int k = 0; k < opt_depth; k++) {
+        ett_range[k * 2] = section_count;
+        for (int c = 0; c < count; c++) build_ett(&ch[c], k);
+        ett_range[k * 2 + 1] = section_count;
+    }
+    long events = stats.events - events_before;
+    build_mgt(vct_end, eit_range, ett_range);
+    free(eit_range);
+    free(ett_range);
+
+    // Base PID tables first each cycle, so a reader locks on the MGT early.
+    // With -P the base PID is flushed after the MGT and after the VCT, or
+    // they would wait in an open packet behind the whole EIT/ETT set.
+    GenSection *mgt = &sections[section_count - 1];
+    for (int cycle = 0; cycle < opt_cycles; cycle++) {
+        GenSection copy;
+        copy = *mgt;
+        emit_section(out, &copy);
+        packet_flush(out, mgt->pid);
+        for (int i = 0; i < section_count - 1; i++) {
+            copy = sections[i];
+            emit_section(out, &copy);
+            if (i == vct_end - 1) packet_flush(out, mgt->pid);
+        }
+        packet_flush_all(out);
+    }
+
+    if (out != stdout) fclose(out);
+    LOG_INFO("GEN", "%s: %d channels, %ld events x %d cycles, %d sections per cycle",
+             path, count, events, opt_cycles, section_count);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Main
+// -----------------------------------------------------------------------------
+
+static void usage(const char *progname) {
+    printf("Usage: %s [options] -o <file.ts|dir|->\n", progname);
+    printf("  -c file      Use channels from a channels.conf (one stream per frequency)\n");
+    printf("  -n count     Synthetic channels per mux (default: %d)\n", opt_channels);
+    printf("  -m count     Synthetic muxes; -o is then a directory of <freq>.ts (default: 1)\n");
+    printf("  -C file      Write the synthetic lineup as channels.conf\n");
+    printf("  -e count     Events per channel per 3-hour EIT instance (default: %d)\n", opt_events);
+    printf("  -g depth     EIT/ETT instances, 1-%d (default: %d)\n", EPG_MAX_GUIDE_DEPTH, EPG_GUIDE_DEPTH);
+    printf("  -r cycles    Table repetitions in the stream (default: %d)\n", opt_cycles);
+    printf("  -D length    Description length in characters, up to 900 (default: %d)\n", opt_desc_len);
+    printf("  -l langs     Comma-separated ISO 639 codes, up to %d (default: eng)\n", MAX_LANGS);
+    printf("  -H           Huffman-code text with the compiled-in A/65 tables\n");
+    printf("  -P           Pack sections back-to-back across packets (exercises pointer_field)\n");
+    printf("  -T time      Unix time of EIT-0 (default: now, 3-hour aligned)\n");
+    printf("  -s seed      Random seed for error injection (default: 1)\n");
+    printf("  --crc rate   Fraction of sections with a corrupted CRC\n");
+    printf("  --cc rate    Fraction of packets with a continuity counter jump\n");
+    printf("  --tei rate   Fraction of packets flagged with transport_error_indicator\n");
+    printf("  -v           Enable verbose/debug logging\n");
+}
+
+static void parse_langs(const char *arg) {
+    opt_lang_count = 0;
+    const char *p = arg;
+    while (*p && opt_lang_count < MAX_LANGS) {
+        size_t n = strcspn(p, ",");
+        if (n == 3) {
+            memcpy(opt_langs[opt_lang_count], p, 3);
+            opt_langs[opt_lang_count][3] = '\0';
+            opt_lang_count++;
+        }
+        p += n;
+        if (*p == ',') p++;
+    }
+    if (opt_lang_count == 0) {
+        strcpy(opt_langs[0], "eng");
+        opt_lang_count = 1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *conf = NULL;
+    const char *conf_out = NULL;
+    const char *out_path = NULL;
+
+    static const struct option long_opts[] = {
+        { "crc", required_argument, NULL, 1 },
+        { "cc",  required_argument, NULL, 2 },
+        { "tei", required_argument, NULL, 3 },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:n:m:C:e:g:r:D:l:HPT:s:o:vh", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'c': conf = optarg; break;
+            case 'n': opt_channels = atoi(optarg); break;
+            case 'm': opt_muxes = atoi(optarg); break;
+            case 'C': conf_out = optarg; break;
+            case 'e': opt_events = atoi(optarg); break;
+            case 'g': opt_depth = atoi(optarg); break;
+            case 'r': opt_cycles = atoi(optarg); break;
+            case 'D': opt_desc_len = atoi(optarg); break;
+            case 'l': parse_langs(optarg); break;
+            case 'H': opt_huffman = 1; break;
+            case 'P': opt_pack = 1; break;
+            case 'T': opt_time_base = atoll(optarg); break;
+            case 's': opt_seed = (unsigned)strtoul(optarg, NULL, 10); break;
+            case 'o': out_path = optarg; break;
+            case 1: opt_crc_rate = atof(optarg); break;
+            case 2: opt_cc_rate = atof(optarg); break;
+            case 3: opt_tei_rate = atof(optarg); break;
+            case 'v': g_verbose = 1; break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!out_path) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opt_depth < 1) opt_depth = 1;
+    if (opt_depth > EPG_MAX_GUIDE_DEPTH) opt_depth = EPG_MAX_GUIDE_DEPTH;
+    if (opt_events < 1) opt_events = 1;
+    if (opt_cycles < 1) opt_cycles = 1;
+    if (opt_channels < 1) opt_channels = 1;
+    if (opt_muxes < 1) opt_muxes = 1;
+    if (opt_desc_len < 1) opt_desc_len = 1;
+    if (opt_desc_len > 900) opt_desc_len = 900;   // Every language must fit one ETT section
+    if (opt_huffman && !huffman_tables_valid) {
+        LOG_WARN("GEN", "No Huffman tables compiled in; writing plain text");
+    }
+
+    rng = opt_seed;
+    long long time_base = opt_time_base ? opt_time_base : time(NULL);
+    time_base -= time_base % BLOCK_SECONDS;
+
+    // Group channels by mux: from channels.conf, or synthesized
+    int mux_count = 0;
+    uint32_t *mux_freq = NULL;
+    GenChannel **mux_channels = NULL;
+    int *mux_sizes = NULL;
+
+    if (conf) {
+        if (load_channels(conf) < 0) return 1;
+        ChannelTable *lineup = channels_acquire();
+        mux_freq = calloc(lineup->count, sizeof(uint32_t));
+        mux_channels = calloc(lineup->count, sizeof(GenChannel *));
+        mux_sizes = calloc(lineup->count, sizeof(int));
+        for (int i = 0; i < lineup->count; i++) {
+            const Channel *c = &lineup->channels[i];
+            int m = 0;
+            while (m < mux_count && mux_freq[m] != c->freq_hz) m++;
+            if (m == mux_count) {
+                mux_freq[m] = c->freq_hz;
+                mux_channels[m] = calloc(lineup->count, sizeof(GenChannel));
+                mux_count++;
+            }
+            GenChannel *g = &mux_channels[m][mux_sizes[m]++];
+            snprintf(g->name, sizeof(g->name), "%s", c->name);
+            g->major = c->major;
+            g->minor = c->minor;
+            g->source_id = c->sid;
+        }
+        channels_release(lineup);
+    } else {
+        mux_count = opt_muxes;
+        mux_freq = calloc(mux_count, sizeof(uint32_t));
+        mux_channels = calloc(mux_count, sizeof(GenChannel *));
+        mux_sizes = calloc(mux_count, sizeof(int));
+        for (int m = 0; m < mux_count; m++) {
+            mux_freq[m] = 473000000 + (uint32_t)m * 6000000;
+            mux_channels[m] = calloc(opt_channels, sizeof(GenChannel));
+            mux_sizes[m] = opt_channels;
+            for (int c = 0; c < opt_channels; c++) {
+                GenChannel *g = &mux_channels[m][c];
+                g->major = 2 + m;
+                g->minor = 1 + c;
+                g->source_id = 1 + c;
+                snprintf(g->name, sizeof(g->name), "SYN%d-%d", g->major, g->minor);
+            }
+        }
+    }
+
+    if (conf_out) {
+        FILE *f = fopen(conf_out, "w");
+        if (!f) {
+            LOG_ERROR("GEN", "Cannot write %s", conf_out);
+            return 1;
+        }
+        for (int m = 0; m < mux_count; m++) {
+            for (int c = 0; c < mux_sizes[m]; c++) {
+                const GenChannel *g = &mux_channels[m][c];
+                fprintf(f, "[%s]\n\tVCHANNEL = %d.%d\n\tSERVICE_ID = %d\n\tFREQUENCY = %u\n",
+                        g->name, g->major, g->minor, g->source_id, mux_freq[m]);
+            }
+        }
+        fclose(f);
+    }
+
+    int multi = mux_count > 1;
+    if (multi) mkdir(out_path, 0755);
+    int rc = 0;
+    for (int m = 0; m < mux_count; m++) {
+        char path[1024];
+        if (multi) snprintf(path, sizeof(path), "%s/%u.ts", out_path, mux_freq[m]);
+        else snprintf(path, sizeof(path), "%s", out_path);
+        if (generate_mux(path, mux_channels[m], mux_sizes[m], 0x0100 + m, time_base) < 0) rc = 1;
+        free(mux_channels[m]);
+    }
+
+    fprintf(stderr, "Generated %d mux(es): %ld packets, %ld sections, %ld events, %ld Huffman / %ld plain strings\n",
+            mux_count, stats.packets, stats.sections, stats.events, stats.huffman_strings, stats.plain_strings);
+    fprintf(stderr, "Injected errors: %ld CRC, %ld CC, %ld TEI\n", stats.crc_errors, stats.cc_errors, stats.tei_errors);
+
+    free(mux_freq);
+    free(mux_channels);
+    free(mux_sizes);
+    free(sections);
+    return rc;
+}